@@ -0,0 +1,265 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "leafs.h"
+
+namespace
+{
+	/**
+	 * Number of distinct module types available to the benchmarks.
+	 * One per benchmark thread, so churn benchmarks do not serialize on a single module latch.
+	 */
+	constexpr std::size_t kModuleCount = 128;
+
+	template<std::size_t Index>
+	class BenchmarkModule : FKL_MODULE_INTERFACE
+	{
+	public:
+		std::size_t Value() const
+		{
+			return Index;
+		}
+	};
+
+	template<std::size_t... Indices>
+	constexpr std::array<fkleafs::ModuleInfo, sizeof...(Indices)> MakeModuleInfos(std::index_sequence<Indices...>)
+	{
+		return { { fkleafs::ModuleInfo::GetModuleInfo<BenchmarkModule<Indices>>()... } };
+	}
+
+	constexpr std::array<fkleafs::ModuleInfo, kModuleCount> kModuleInfos = MakeModuleInfos(std::make_index_sequence<kModuleCount>());
+
+	/**
+	 * Registers all benchmark modules during static initialization, like FKL_REGISTER_MODULE does.
+	 */
+	template<std::size_t... Indices>
+	bool RegisterModules(std::index_sequence<Indices...>)
+	{
+		return (FKL_MODULE_MANAGER().RegisterModule<BenchmarkModule<Indices>>() && ...);
+	}
+
+	const bool kModulesRegistered = RegisterModules(std::make_index_sequence<kModuleCount>());
+
+	/**
+	 * Samples the latency of every 64th operation of a benchmark thread
+	 * and reports the percentiles as counters, averaged over all threads.
+	 */
+	class LatencySampler
+	{
+	public:
+		static constexpr std::uint64_t kSampleInterval = 64;
+
+		/**
+		 * Runs an operation, measuring it if it is sampled.
+		 */
+		template<typename Operation>
+		void Run(Operation&& operation)
+		{
+			if (m_operations++ % kSampleInterval != 0)
+			{
+				operation();
+				return;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			operation();
+			const auto end = std::chrono::steady_clock::now();
+			m_samples.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+		}
+
+		void Report(benchmark::State& state)
+		{
+			if (m_samples.empty())
+			{
+				return;
+			}
+
+			std::sort(m_samples.begin(), m_samples.end());
+			const auto percentile = [this](double fraction)
+				{
+					return m_samples[std::min(m_samples.size() - 1, static_cast<std::size_t>(fraction * m_samples.size()))];
+				};
+			state.counters["p50_ns"] = benchmark::Counter(percentile(0.50), benchmark::Counter::kAvgThreads);
+			state.counters["p99_ns"] = benchmark::Counter(percentile(0.99), benchmark::Counter::kAvgThreads);
+			state.counters["p999_ns"] = benchmark::Counter(percentile(0.999), benchmark::Counter::kAvgThreads);
+		}
+
+	private:
+		std::uint64_t m_operations = 0;
+		std::vector<double> m_samples;
+	};
+
+	void BM_GetModulePtr(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		if (state.thread_index() == 0)
+		{
+			manager.LoadModule<BenchmarkModule<0>>();
+		}
+
+		LatencySampler sampler;
+		for (auto _ : state)
+		{
+			sampler.Run([&manager]()
+				{
+					benchmark::DoNotOptimize(manager.GetModulePtr<BenchmarkModule<0>>().lock());
+				});
+		}
+		sampler.Report(state);
+		state.SetItemsProcessed(state.iterations());
+
+		if (state.thread_index() == 0)
+		{
+			manager.TearDown();
+		}
+	}
+	BENCHMARK(BM_GetModulePtr)->ThreadRange(1, kModuleCount)->UseRealTime();
+
+	void BM_ModuleHandleGet(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		if (state.thread_index() == 0)
+		{
+			manager.LoadModule<BenchmarkModule<0>>();
+		}
+		const fkleafs::ModuleHandle<BenchmarkModule<0>> handle = manager.GetModuleHandle<BenchmarkModule<0>>();
+
+		LatencySampler sampler;
+		for (auto _ : state)
+		{
+			sampler.Run([&handle]()
+				{
+					benchmark::DoNotOptimize(handle->Value());
+				});
+		}
+		sampler.Report(state);
+		state.SetItemsProcessed(state.iterations());
+
+		if (state.thread_index() == 0)
+		{
+			manager.TearDown();
+		}
+	}
+	BENCHMARK(BM_ModuleHandleGet)->ThreadRange(1, kModuleCount)->UseRealTime();
+
+	void BM_IsModuleLoaded(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		if (state.thread_index() == 0)
+		{
+			manager.LoadModule<BenchmarkModule<0>>();
+		}
+
+		LatencySampler sampler;
+		for (auto _ : state)
+		{
+			sampler.Run([&manager]()
+				{
+					benchmark::DoNotOptimize(manager.IsModuleLoaded<BenchmarkModule<0>>());
+				});
+		}
+		sampler.Report(state);
+		state.SetItemsProcessed(state.iterations());
+
+		if (state.thread_index() == 0)
+		{
+			manager.TearDown();
+		}
+	}
+	BENCHMARK(BM_IsModuleLoaded)->ThreadRange(1, kModuleCount)->UseRealTime();
+
+	void BM_LoadUnloadChurn(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		const fkleafs::ModuleInfo info = kModuleInfos[static_cast<std::size_t>(state.thread_index()) % kModuleCount];
+
+		LatencySampler sampler;
+		for (auto _ : state)
+		{
+			sampler.Run([&manager, &info]()
+				{
+					manager.LoadModule(info);
+					manager.UnloadModule(info);
+				});
+		}
+		sampler.Report(state);
+		state.SetItemsProcessed(state.iterations());
+	}
+	BENCHMARK(BM_LoadUnloadChurn)->ThreadRange(1, kModuleCount)->UseRealTime();
+
+	void BM_RegisterModule(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		const auto creator = []() -> std::shared_ptr<fkleafs::ModuleInterface>
+			{
+				return fkleafs::StaticallyLinkedModuleCreator<BenchmarkModule<0>>::CreateModuleInterface();
+			};
+
+		// Every registration needs a new name, names must outlive the registration.
+		static std::deque<std::string> names[kModuleCount];
+		std::deque<std::string>& thread_names = names[static_cast<std::size_t>(state.thread_index()) % kModuleCount];
+
+		LatencySampler sampler;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			thread_names.push_back("BenchmarkRegisteredModule" + std::to_string(state.thread_index()) + "_" + std::to_string(thread_names.size()));
+			const fkleafs::ModuleInfo info = fkleafs::ModuleInfo::FromName(thread_names.back());
+			state.ResumeTiming();
+
+			sampler.Run([&manager, &creator, &info]()
+				{
+					benchmark::DoNotOptimize(manager.RegisterModule(creator, info));
+				});
+		}
+		sampler.Report(state);
+		state.SetItemsProcessed(state.iterations());
+	}
+	BENCHMARK(BM_RegisterModule)->ThreadRange(1, kModuleCount)->UseRealTime();
+
+	void BM_TearDown(benchmark::State& state)
+	{
+		fkleafs::ModuleManager& manager = FKL_MODULE_MANAGER();
+		const std::size_t module_count = static_cast<std::size_t>(state.range(0));
+
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			for (std::size_t index = 0; index < module_count; ++index)
+			{
+				manager.LoadModule(kModuleInfos[index]);
+			}
+			state.ResumeTiming();
+
+			manager.TearDown();
+		}
+		state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(module_count));
+	}
+	// TearDown is process wide, it already runs the shutdowns on the thread pool of the manager.
+	BENCHMARK(BM_TearDown)->RangeMultiplier(2)->Range(1, kModuleCount)->UseRealTime();
+}
+
+BENCHMARK_MAIN();
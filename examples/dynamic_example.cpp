@@ -0,0 +1,33 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "leafs.h"
+
+int main()
+{
+	// The host does not know the type of the module, only its name.
+	constexpr fkleafs::ModuleInfo info = fkleafs::ModuleInfo::FromName("DynamicModule");
+
+	FKL_MODULE_MANAGER().RegisterDynamicModule(info, FKL_DYNAMIC_EXAMPLE_MODULE_PATH);
+
+	// Opens the library and starts the module.
+	FKL_MODULE_MANAGER().LoadModule(info);
+
+	// Loads the library again next to the running one and hands the state of the running module over.
+	FKL_MODULE_MANAGER().ReloadModule(info);
+
+	// Shuts the module down and closes the library.
+	FKL_MODULE_MANAGER().UnloadModule(info);
+	return 0;
+}
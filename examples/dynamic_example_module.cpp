@@ -0,0 +1,42 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+
+#include "dynamic_module.h"
+
+class DynamicModule : public fkleafs::ModuleInterface
+{
+public:
+	virtual void OnStartupModule() override
+	{
+		std::cout << "Startup DynamicModule" << std::endl;
+	}
+
+	virtual void OnReloadModule(fkleafs::ModuleInterface& previous_module) override
+	{
+		// Both instances export the same module, only the library they live in differs.
+		m_reload_count = static_cast<DynamicModule&>(previous_module).m_reload_count + 1;
+		std::cout << "Reload DynamicModule " << m_reload_count << std::endl;
+	}
+
+	virtual void OnShutdownModule() override
+	{
+		std::cout << "Shutdown DynamicModule" << std::endl;
+	}
+
+private:
+	int m_reload_count = 0;
+};
+FKL_IMPLEMENT_DYNAMIC_MODULE(DynamicModule)
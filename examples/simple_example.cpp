@@ -36,17 +36,18 @@ FKL_REGISTER_MODULE(ModuleA)
 
 class ModuleB : FKL_MODULE_INTERFACE
 {
+	// ModuleA is started before ModuleB.
+	FKL_MODULE_DEPENDENCIES(ModuleA)
+
 public:
 
-	FKL_INJECT_MODULE(ModuleA, GetModuleA)
+	FKL_INJECT_PINNED_MODULE(ModuleA, GetModuleA)
 
 	virtual void OnStartupModule() override
 	{
 		LOG(INFO) << "Startup B";
 
-		FKL_REQUIRE_MODULE(ModuleA);
-
-		GetModuleA().lock()->Greet();
+		GetModuleA()->Greet();
 	}
 
 	virtual void OnShutdownModule() override
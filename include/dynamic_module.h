@@ -0,0 +1,232 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_DYNAMIC_MODULE_H
+#define FKL_DYNAMIC_MODULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "module_info.h"
+#include "module_interface.h"
+
+// This header is included by module libraries as well, so it must not depend on the compiled part of fkleafs.
+// A module library must not link its own copy of fkleafs, otherwise it would see a second ModuleManager.
+
+#if defined(_WIN32)
+#define FKL_MODULE_EXPORT __declspec(dllexport)
+#else
+#define FKL_MODULE_EXPORT __attribute__((visibility("default")))
+#endif
+
+/**
+ * Name of the single symbol a module library exports.
+ */
+#define FKL_DYNAMIC_MODULE_EXPORT_SYMBOL "FKLeafsGetModuleExport"
+
+namespace fkleafs
+{
+	/**
+	 * Describes the module exported by a module library.
+	 * Returned by the FKL_DYNAMIC_MODULE_EXPORT_SYMBOL function of the library.
+	 */
+	struct DynamicModuleExport
+	{
+		/**
+		 * Incremented whenever the layout of this struct, the data members of ModuleInterface or its vtable change.
+		 */
+		static constexpr std::uint32_t kAbiVersion = 6;
+
+		std::uint32_t abi_version;
+
+		/**
+		 * Name and hash of the module, equal to ModuleInfo::GetModuleInfo<Module>() of the exported module.
+		 * The name is not null terminated and only valid while the library is loaded.
+		 */
+		const char* module_name;
+		std::size_t module_name_length;
+		std::size_t module_hash;
+
+		/**
+		 * Creates and destroys the module inside the library, so that the module is allocated and freed by the same runtime.
+		 */
+		ModuleInterface* (*create)();
+		void (*destroy)(ModuleInterface*);
+
+		/**
+		 * Returns the export description of a module.
+		 *
+		 * @tparam Module The module to export.
+		 * @return The export description.
+		 */
+		template<typename Module>
+		static DynamicModuleExport Create()
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			constexpr ModuleInfo info = ModuleInfo::GetModuleInfo<Module>();
+			return DynamicModuleExport{
+				kAbiVersion,
+				info.ModuleName().data(),
+				info.ModuleName().size(),
+				info.ModuleHash(),
+				[]() -> ModuleInterface* { return new Module(); },
+				[](ModuleInterface* module) { delete module; } };
+		}
+	};
+
+	/**
+	 * Signature of the FKL_DYNAMIC_MODULE_EXPORT_SYMBOL function.
+	 */
+	using DynamicModuleExportFunction = const DynamicModuleExport* (*)();
+
+	/**
+	 * A loaded shared library.
+	 * The library is closed when the last reference is released.
+	 */
+	class DynamicLibrary
+	{
+	public:
+		/**
+		 * Opens a shared library.
+		 *
+		 * @param library_path The path of the library.
+		 * @return The library or nullptr if it could not be opened.
+		 */
+		static std::shared_ptr<DynamicLibrary> Open(const std::string& library_path);
+
+		/**
+		 * Opens a private copy of a shared library.
+		 * The dynamic loader opens every path only once, a copy is the only way to load a new build of a library
+		 * next to the build that is already loaded from the same path.
+		 * The copy is placed next to the library, so that relative dependencies of the library are still found,
+		 * and it is deleted as soon as possible.
+		 *
+		 * @param library_path The path of the library.
+		 * @return The library or nullptr if it could not be copied or opened.
+		 */
+		static std::shared_ptr<DynamicLibrary> OpenCopy(const std::string& library_path);
+
+		/**
+		 * Tests whether a shared library is currently opened by the process, without opening it.
+		 *
+		 * @param library_path The path of the library.
+		 * @return True if the library is open, false otherwise.
+		 */
+		static bool IsOpen(const std::string& library_path);
+
+		/**
+		 * Closes the library.
+		 */
+		~DynamicLibrary();
+
+		DynamicLibrary(const DynamicLibrary&) = delete;
+		DynamicLibrary& operator=(const DynamicLibrary&) = delete;
+
+		/**
+		 * Resolves a symbol of the library.
+		 *
+		 * @param symbol_name The name of the symbol.
+		 * @return The address of the symbol or nullptr if the library does not export it.
+		 */
+		void* FindSymbol(const char* symbol_name) const;
+
+		/**
+		 * Getter for the path of the library.
+		 *
+		 * @return The path of the library.
+		 */
+		const std::string& LibraryPath() const
+		{
+			return m_library_path;
+		}
+
+	private:
+		DynamicLibrary(void* handle, std::string library_path, std::string copy_path = std::string())
+			: m_handle(handle)
+			, m_library_path(std::move(library_path))
+			, m_copy_path(std::move(copy_path))
+		{
+		}
+
+		void* m_handle;
+		std::string m_library_path;
+
+		/**
+		 * Path of the private copy that still has to be deleted once the library is closed, empty if there is none.
+		 */
+		std::string m_copy_path;
+	};
+
+	/**
+	 * Creates a module that lives in a shared library.
+	 * The library is opened when the module is created and its export symbol is resolved at that point.
+	 * Every created module keeps the library open, it is closed once the module is destroyed after UnloadModule.
+	 * If the library is still open when a module is created, for example during ModuleManager::ReloadModule,
+	 * a private copy of the library is opened, so the module is created from the build that is currently on disk.
+	 */
+	class DynamicallyLinkedModule
+	{
+	public:
+		/**
+		 * Constructor.
+		 *
+		 * @param info The module info the library has to export.
+		 * @param library_path The path of the library.
+		 */
+		DynamicallyLinkedModule(const ModuleInfo& info, std::string library_path)
+			: m_info(info)
+			, m_library_path(std::move(library_path))
+		{
+		}
+
+		/**
+		 * Opens the library and creates the module.
+		 *
+		 * @return The module or nullptr if the library could not be loaded or exports a different module.
+		 */
+		std::shared_ptr<ModuleInterface> CreateModuleInterface() const;
+
+		/**
+		 * Getter for the path of the library.
+		 *
+		 * @return The path of the library.
+		 */
+		const std::string& LibraryPath() const
+		{
+			return m_library_path;
+		}
+
+	private:
+		ModuleInfo m_info;
+		std::string m_library_path;
+	};
+}
+
+/**
+ * Exports a module from a module library.
+ * Must be used exactly once per library.
+ */
+#define FKL_IMPLEMENT_DYNAMIC_MODULE(ModuleType) \
+	extern "C" FKL_MODULE_EXPORT const fkleafs::DynamicModuleExport* FKLeafsGetModuleExport() \
+	{ \
+		static const fkleafs::DynamicModuleExport module_export = fkleafs::DynamicModuleExport::Create<ModuleType>(); \
+		return &module_export; \
+	}
+
+#endif // !FKL_DYNAMIC_MODULE_H
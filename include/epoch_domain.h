@@ -0,0 +1,203 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_EPOCH_DOMAIN_H
+#define FKL_EPOCH_DOMAIN_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace fkleafs
+{
+	/**
+	 * Epoch based memory reclamation.
+	 *
+	 * Readers enter a critical section by publishing the global epoch they observed.
+	 * Writers first unlink an object, so that no new reader can reach it, and then retire it.
+	 * A retired object is tagged with a fresh epoch and destroyed as soon as every thread
+	 * that is still inside a critical section has entered it at or after that epoch.
+	 *
+	 * Entering and leaving a critical section never locks and only touches memory owned by the calling thread.
+	 */
+	class EpochDomain
+	{
+	private:
+		/**
+		 * Private constructor for the singleton pattern.
+		 */
+		EpochDomain()
+		{
+		}
+
+	public:
+		/**
+		 * Getter for the process wide epoch domain.
+		 * The domain is never destroyed, so it can safely be used from static destructors and exiting threads.
+		 *
+		 * @return The epoch domain.
+		 */
+		static EpochDomain& Get();
+
+		EpochDomain(const EpochDomain&) = delete;
+		EpochDomain& operator=(const EpochDomain&) = delete;
+
+		/**
+		 * Enters a critical section on the calling thread.
+		 * Critical sections may be nested, only the outermost one publishes an epoch.
+		 */
+		void Enter();
+
+		/**
+		 * Leaves a critical section on the calling thread.
+		 */
+		void Leave();
+
+		/**
+		 * Tests whether the calling thread is inside a critical section.
+		 *
+		 * @return True if the calling thread is inside a critical section, false otherwise.
+		 */
+		bool InCriticalSection() const;
+
+		/**
+		 * Retires an object that has already been unlinked from every shared structure.
+		 * The deleter is invoked once no reader can hold a reference to the object anymore.
+		 *
+		 * @param deleter The function that destroys the object.
+		 */
+		void Retire(std::function<void()> deleter);
+
+		/**
+		 * Retires an object that has already been unlinked from every shared structure.
+		 *
+		 * @tparam T The type of the object.
+		 * @param object The object to delete once no reader can reference it anymore.
+		 */
+		template<typename T>
+		void Retire(const T* object)
+		{
+			Retire([object]() { delete object; });
+		}
+
+		/**
+		 * Destroys every retired object that can no longer be referenced by a reader.
+		 * Never blocks on readers.
+		 */
+		void Reclaim();
+
+		/**
+		 * Waits until every reader that is currently inside a critical section has left it
+		 * and destroys all objects that have been retired before the call.
+		 * Must not be called from inside a critical section, in that case only Reclaim() is performed.
+		 */
+		void Synchronize();
+
+	private:
+		/**
+		 * Marks a thread record that is not inside a critical section.
+		 */
+		static constexpr std::uint64_t kInactive = std::numeric_limits<std::uint64_t>::max();
+
+		/**
+		 * Per thread state.
+		 * Records are never freed, a record of an exited thread is reused by the next new thread.
+		 */
+		struct ThreadRecord
+		{
+			std::atomic<std::uint64_t> epoch{ kInactive };
+			std::atomic<bool> in_use{ false };
+			ThreadRecord* next = nullptr;
+
+			/**
+			 * Nesting depth of critical sections, only accessed by the owning thread.
+			 */
+			std::uint32_t nesting = 0;
+		};
+
+		/**
+		 * An object waiting for destruction.
+		 */
+		struct RetiredObject
+		{
+			std::uint64_t epoch;
+			std::function<void()> deleter;
+		};
+
+		/**
+		 * Returns the record of the calling thread, acquiring one on first use.
+		 *
+		 * @return The record of the calling thread.
+		 */
+		ThreadRecord& LocalRecord() const;
+
+		/**
+		 * Returns the smallest epoch published by a thread inside a critical section.
+		 *
+		 * @return The smallest active epoch or kInactive if no thread is inside a critical section.
+		 */
+		std::uint64_t MinimumActiveEpoch() const;
+
+		/**
+		 * The global epoch. Advanced once for every retired object.
+		 */
+		std::atomic<std::uint64_t> m_global_epoch{ 1 };
+
+		/**
+		 * Lock free, push only list of all thread records.
+		 */
+		mutable std::atomic<ThreadRecord*> m_records{ nullptr };
+
+		/**
+		 * Objects waiting for destruction.
+		 */
+		std::vector<RetiredObject> m_retired;
+
+		/**
+		 * Mutex used to lock the m_retired variable.
+		 */
+		absl::Mutex m_retired_mutex;
+	};
+
+	/**
+	 * RAII critical section of the epoch domain.
+	 * Every pointer loaded from an epoch protected structure stays valid until the guard is destroyed.
+	 */
+	class EpochGuard
+	{
+	public:
+		EpochGuard()
+			: m_domain(EpochDomain::Get())
+		{
+			m_domain.Enter();
+		}
+
+		~EpochGuard()
+		{
+			m_domain.Leave();
+		}
+
+		EpochGuard(const EpochGuard&) = delete;
+		EpochGuard& operator=(const EpochGuard&) = delete;
+
+	private:
+		EpochDomain& m_domain;
+	};
+}
+
+#endif // !FKL_EPOCH_DOMAIN_H
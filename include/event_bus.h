@@ -0,0 +1,353 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_EVENT_BUS_H
+#define FKL_EVENT_BUS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+
+#include "epoch_domain.h"
+#include "module_info.h"
+#include "module_interface.h"
+#include "mpmc_queue.h"
+
+namespace fkleafs
+{
+	/**
+	 * Identity of an event channel, computed at compile time from the event type like a ModuleInfo.
+	 */
+	class ChannelInfo
+	{
+	private:
+		constexpr ChannelInfo(std::string_view channel_name, std::size_t channel_hash)
+			: m_channel_name(channel_name)
+			, m_channel_hash(channel_hash)
+		{}
+
+	public:
+		/**
+		 * Returns the info of the channel that carries an event type.
+		 *
+		 * @tparam Event The event type.
+		 * @return The channel info.
+		 */
+		template<typename Event>
+		static constexpr ChannelInfo GetChannelInfo()
+		{
+			return ChannelInfo(detail::TypeIdentity<Event>::name, detail::TypeIdentity<Event>::hash);
+		}
+
+		constexpr std::string_view ChannelName() const
+		{
+			return m_channel_name;
+		}
+
+		constexpr std::size_t ChannelHash() const
+		{
+			return m_channel_hash;
+		}
+
+		struct ChannelInfoHash
+		{
+			constexpr std::size_t operator()(const ChannelInfo& channel_info) const
+			{
+				return channel_info.ChannelHash();
+			}
+		};
+
+		struct ChannelInfoEqual
+		{
+			constexpr bool operator()(const ChannelInfo& lhs, const ChannelInfo& rhs) const
+			{
+				return lhs.ChannelHash() == rhs.ChannelHash();
+			}
+		};
+
+	private:
+		std::string_view m_channel_name;
+		std::size_t m_channel_hash;
+	};
+
+	/**
+	 * Typed publish and subscribe channels between modules.
+	 *
+	 * Every event type has its own channel with a bounded lock free queue, so producers never block each other
+	 * or a consumer. Dispatch drains the queues and hands each subscriber all events of a channel as one batch.
+	 * Subscriptions belong to a module and are removed when the module is unloaded by the ModuleManager.
+	 */
+	class EventBus
+	{
+	public:
+		/**
+		 * Capacity of channels that are created implicitly by Publish or Subscribe.
+		 */
+		static constexpr std::size_t kDefaultChannelCapacity = 1024;
+
+		/**
+		 * Receives a batch of events of one channel, in publishing order per producer.
+		 */
+		template<typename Event>
+		using EventHandler = std::function<void(absl::Span<const Event>)>;
+
+		EventBus();
+		~EventBus();
+
+		EventBus(const EventBus&) = delete;
+		EventBus& operator=(const EventBus&) = delete;
+
+		/**
+		 * Creates the channel of an event type with a custom capacity.
+		 *
+		 * @tparam Event The event type.
+		 * @param capacity The number of events the channel queues between two dispatches.
+		 * @return True if the channel has been created, false if it already exists.
+		 */
+		template<typename Event>
+		bool CreateChannel(std::size_t capacity)
+		{
+			bool created = false;
+			GetOrCreateChannel<Event>(capacity, created);
+			return created;
+		}
+
+		/**
+		 * Queues an event for the next dispatch without locking.
+		 *
+		 * @tparam Event The event type.
+		 * @param event The event.
+		 * @return True if the event has been queued, false if the channel is full.
+		 */
+		template<typename Event>
+		bool Publish(Event event)
+		{
+			bool created = false;
+			return GetOrCreateChannel<Event>(kDefaultChannelCapacity, created).queue.TryPush(std::move(event));
+		}
+
+		/**
+		 * Subscribes a module to the events of a type.
+		 * The handler is called from Dispatch, on the dispatching thread.
+		 *
+		 * @tparam Event The event type.
+		 * @param subscriber The subscribing module, its subscriptions are removed when it is unloaded.
+		 * @param handler Receives the batches of events.
+		 */
+		template<typename Event>
+		void Subscribe(const ModuleInterface& subscriber, EventHandler<Event> handler)
+		{
+			bool created = false;
+			TypedChannel<Event>& channel = GetOrCreateChannel<Event>(kDefaultChannelCapacity, created);
+			std::shared_ptr<typename TypedChannel<Event>::Subscription> subscription = std::make_shared<typename TypedChannel<Event>::Subscription>();
+			subscription->subscriber = &subscriber;
+			subscription->handler = std::move(handler);
+
+			channel.mutex.Lock();
+			channel.subscriptions.push_back(std::move(subscription));
+			channel.mutex.Unlock();
+		}
+
+		/**
+		 * Removes all subscriptions of a module.
+		 * Waits for a running dispatch, so no handler of the module runs once this returns,
+		 * unless it is called from a handler itself.
+		 *
+		 * @param subscriber The module.
+		 */
+		void Unsubscribe(const ModuleInterface& subscriber);
+
+		/**
+		 * Delivers the queued events of all channels to their subscribers.
+		 * At most the capacity of a channel is delivered per call, so busy producers cannot stall the dispatch.
+		 * Events of channels without subscribers are dropped. Dispatches are serialized, handlers must not dispatch.
+		 *
+		 * @return The number of events that have been taken from the queues.
+		 */
+		std::size_t Dispatch();
+
+	private:
+		/**
+		 * Type erased part of a channel.
+		 */
+		struct Channel
+		{
+			virtual ~Channel()
+			{
+			}
+
+			virtual std::size_t Dispatch() = 0;
+			virtual void Unsubscribe(const ModuleInterface& subscriber) = 0;
+		};
+
+		template<typename Event>
+		struct TypedChannel : Channel
+		{
+			struct Subscription
+			{
+				const ModuleInterface* subscriber = nullptr;
+				EventHandler<Event> handler;
+
+				/**
+				 * Cleared when the subscription is removed, a running dispatch may still hold it.
+				 */
+				std::atomic<bool> active{ true };
+			};
+
+			explicit TypedChannel(std::size_t capacity)
+				: queue(capacity)
+			{
+			}
+
+			std::size_t Dispatch() override
+			{
+				// Only the dispatching thread touches the batch buffers, dispatches are serialized.
+				batch.clear();
+				while (batch.size() < queue.Capacity())
+				{
+					std::optional<Event> event = queue.TryPop();
+					if (!event.has_value())
+					{
+						break;
+					}
+					batch.push_back(std::move(*event));
+				}
+				if (batch.empty())
+				{
+					return 0;
+				}
+
+				mutex.Lock();
+				dispatched_subscriptions = subscriptions;
+				mutex.Unlock();
+
+				const absl::Span<const Event> events = absl::MakeConstSpan(batch);
+				for (const std::shared_ptr<Subscription>& subscription : dispatched_subscriptions)
+				{
+					if (subscription->active.load(std::memory_order_acquire))
+					{
+						subscription->handler(events);
+					}
+				}
+				dispatched_subscriptions.clear();
+				return events.size();
+			}
+
+			void Unsubscribe(const ModuleInterface& subscriber) override
+			{
+				mutex.Lock();
+				const auto removed = std::remove_if(subscriptions.begin(), subscriptions.end(), [&subscriber](const std::shared_ptr<Subscription>& subscription)
+					{
+						if (subscription->subscriber != &subscriber)
+						{
+							return false;
+						}
+						subscription->active.store(false, std::memory_order_release);
+						return true;
+					});
+				subscriptions.erase(removed, subscriptions.end());
+				mutex.Unlock();
+			}
+
+			MpmcQueue<Event> queue;
+
+			absl::Mutex mutex;
+			std::vector<std::shared_ptr<Subscription>> subscriptions;
+
+			std::vector<Event> batch;
+			std::vector<std::shared_ptr<Subscription>> dispatched_subscriptions;
+		};
+
+		using ChannelMap = absl::flat_hash_map<ChannelInfo, Channel*, ChannelInfo::ChannelInfoHash, ChannelInfo::ChannelInfoEqual>;
+
+		/**
+		 * Returns the channel of an event type, creating it if needed.
+		 *
+		 * @tparam Event The event type.
+		 * @param capacity The capacity if the channel is created.
+		 * @param created Set to true if the channel has been created.
+		 * @return The channel.
+		 */
+		template<typename Event>
+		TypedChannel<Event>& GetOrCreateChannel(std::size_t capacity, bool& created)
+		{
+			constexpr ChannelInfo info = ChannelInfo::GetChannelInfo<Event>();
+			Channel* channel = FindChannel(info);
+			if (channel == nullptr)
+			{
+				channel = AddChannel(info, std::make_unique<TypedChannel<Event>>(capacity), created);
+			}
+			return static_cast<TypedChannel<Event>&>(*channel);
+		}
+
+		/**
+		 * Looks up a channel without locking.
+		 *
+		 * @param info The channel info.
+		 * @return The channel or nullptr if it does not exist yet.
+		 */
+		Channel* FindChannel(const ChannelInfo& info) const
+		{
+			EpochGuard guard;
+			const ChannelMap* channels = m_channels.load(std::memory_order_acquire);
+			const auto iterator = channels->find(info);
+			return iterator != channels->end() ? iterator->second : nullptr;
+		}
+
+		/**
+		 * Adds a channel unless another thread added it first.
+		 *
+		 * @param info The channel info.
+		 * @param channel The new channel.
+		 * @param created Set to true if the new channel has been added.
+		 * @return The channel that is registered for the info.
+		 */
+		Channel* AddChannel(const ChannelInfo& info, std::unique_ptr<Channel> channel, bool& created);
+
+		/**
+		 * Returns all channels, in creation order.
+		 *
+		 * @return The channels.
+		 */
+		std::vector<Channel*> Channels();
+
+		/**
+		 * Snapshot of all channels, replaced when a channel is added. Channels live as long as the bus.
+		 */
+		std::atomic<const ChannelMap*> m_channels;
+
+		/**
+		 * Serializes writers of m_channels and guards m_channel_storage.
+		 */
+		absl::Mutex m_channels_mutex;
+		std::vector<std::unique_ptr<Channel>> m_channel_storage;
+
+		/**
+		 * Held while a dispatch runs.
+		 */
+		absl::Mutex m_dispatch_mutex;
+	};
+}
+
+#endif // !FKL_EVENT_BUS_H
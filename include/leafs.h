@@ -15,8 +15,26 @@
 #ifndef FKL_LEAFS_H
 #define FKL_LEAFS_H
 
+#include "dynamic_module.h"
+#include "epoch_domain.h"
+#include "event_bus.h"
+#include "module_allocation.h"
+#include "module_dependencies.h"
+#include "module_executor.h"
+#include "module_factory.h"
+#include "module_handle.h"
 #include "module_info.h"
+#include "module_instrumentation.h"
 #include "module_interface.h"
 #include "module_manager.h"
+#include "module_memory.h"
+#include "module_service.h"
+#include "module_set.h"
+#include "module_tick.h"
+#include "module_trace.h"
+#include "mpmc_queue.h"
+#include "numa_topology.h"
+#include "startup_manifest.h"
+#include "thread_pool.h"
 
 #endif
\ No newline at end of file
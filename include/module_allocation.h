@@ -0,0 +1,377 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_ALLOCATION_H
+#define FKL_MODULE_ALLOCATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace fkleafs
+{
+	class ModuleManager;
+
+	/**
+	 * Where the pages of a ModuleArena are placed on machines with several NUMA nodes.
+	 */
+	enum class NumaPlacement
+	{
+		/**
+		 * Left to the system, usually the node of the thread that touches a page first.
+		 */
+		kDefault,
+
+		/**
+		 * Pages are spread round robin across all nodes, so no node becomes a hotspot for modules used from everywhere.
+		 */
+		kInterleave,
+
+		/**
+		 * Pages are placed on ModuleArenaOptions::numa_node.
+		 */
+		kNode
+	};
+
+	/**
+	 * Options of a ModuleArena.
+	 */
+	struct ModuleArenaOptions
+	{
+		/**
+		 * Size of the blocks the arena carves modules from.
+		 */
+		std::size_t block_size = 2 * 1024 * 1024;
+
+		/**
+		 * Requests huge pages for the blocks. Only a hint, the arena silently falls back to regular pages.
+		 */
+		bool use_huge_pages = false;
+
+		/**
+		 * Requests a NUMA placement for the blocks. Only a hint as well, ignored on single node machines.
+		 */
+		NumaPlacement numa_placement = NumaPlacement::kDefault;
+		std::uint32_t numa_node = 0;
+	};
+
+	/**
+	 * Bump allocator for modules.
+	 * Modules are placed next to each other in large blocks, every allocation starts on its own cache line,
+	 * so modules that are used together share pages but never share cache lines.
+	 * Memory is not reused when a module is destroyed, the blocks are released in bulk once no allocation is alive anymore.
+	 */
+	class ModuleArena
+	{
+	public:
+		/**
+		 * Alignment and size granularity of all allocations.
+		 */
+		static constexpr std::size_t kCacheLineSize = 64;
+
+		explicit ModuleArena(const ModuleArenaOptions& options = ModuleArenaOptions())
+			: m_options(options)
+		{
+		}
+
+		/**
+		 * Releases the blocks, unless allocations are still alive, then the blocks are leaked.
+		 */
+		~ModuleArena();
+
+		ModuleArena(const ModuleArena&) = delete;
+		ModuleArena& operator=(const ModuleArena&) = delete;
+
+		/**
+		 * Replaces the options of the arena.
+		 * Only possible before the first allocation or after Release.
+		 *
+		 * @param options The new options.
+		 * @return True if the options have been applied, false if the arena already owns blocks.
+		 */
+		bool Configure(const ModuleArenaOptions& options);
+
+		/**
+		 * Allocates memory.
+		 *
+		 * @param size The size of the allocation.
+		 * @param alignment The alignment of the allocation, at most the page size.
+		 * @return The memory, aligned to at least kCacheLineSize.
+		 */
+		void* Allocate(std::size_t size, std::size_t alignment);
+
+		/**
+		 * Marks an allocation as dead. The memory is only reclaimed by Release.
+		 */
+		void Deallocate(void* /*pointer*/, std::size_t /*size*/)
+		{
+			m_live_allocations.fetch_sub(1, std::memory_order_acq_rel);
+		}
+
+		/**
+		 * Releases all blocks at once.
+		 *
+		 * @return True if the blocks have been released, false if allocations are still alive.
+		 */
+		bool Release();
+
+		/**
+		 * Returns the number of allocations that have not been deallocated yet.
+		 *
+		 * @return The number of live allocations.
+		 */
+		std::size_t LiveAllocations() const
+		{
+			return m_live_allocations.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Returns the number of bytes reserved for blocks.
+		 *
+		 * @return The reserved bytes.
+		 */
+		std::size_t ReservedBytes() const;
+
+	private:
+		struct Block
+		{
+			char* memory;
+			std::size_t size;
+		};
+
+		/**
+		 * Maps a new block of at least the given size.
+		 * m_mutex must be held.
+		 *
+		 * @param size The minimum size of the block.
+		 * @return The block, with a null memory pointer if the system is out of memory.
+		 */
+		Block MapBlock(std::size_t size) const;
+
+#if defined(_WIN32)
+		/**
+		 * Allocates pages on the node requested by the options, falls back to any node.
+		 *
+		 * @param size The size of the allocation.
+		 * @param allocation_type The allocation type flags of VirtualAlloc.
+		 * @return The memory or nullptr if the system is out of memory.
+		 */
+		void* AllocateVirtualMemory(std::size_t size, unsigned long allocation_type) const;
+#else
+		/**
+		 * Applies the NUMA placement of the options to a freshly mapped block.
+		 *
+		 * @param memory The memory of the block.
+		 * @param size The size of the block.
+		 */
+		void ApplyNumaPlacement(void* memory, std::size_t size) const;
+#endif
+
+		/**
+		 * Unmaps a block returned by MapBlock.
+		 *
+		 * @param block The block.
+		 */
+		static void UnmapBlock(const Block& block);
+
+		mutable absl::Mutex m_mutex;
+		ModuleArenaOptions m_options;
+		std::vector<Block> m_blocks;
+
+		/**
+		 * Bump pointer into the last block of m_blocks.
+		 */
+		char* m_current = nullptr;
+		char* m_end = nullptr;
+
+		std::atomic<std::size_t> m_live_allocations{ 0 };
+	};
+
+	/**
+	 * Standard allocator that allocates from a ModuleArena, used with std::allocate_shared.
+	 *
+	 * @tparam T The allocated type.
+	 */
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+
+		explicit ArenaAllocator(ModuleArena& arena)
+			: m_arena(&arena)
+		{
+		}
+
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other)
+			: m_arena(other.m_arena)
+		{
+		}
+
+		T* allocate(std::size_t count)
+		{
+			void* memory = m_arena->Allocate(count * sizeof(T), alignof(T));
+			if (memory == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(memory);
+		}
+
+		void deallocate(T* pointer, std::size_t count)
+		{
+			m_arena->Deallocate(pointer, count * sizeof(T));
+		}
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U>& other) const
+		{
+			return m_arena == other.m_arena;
+		}
+
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const
+		{
+			return m_arena != other.m_arena;
+		}
+
+	private:
+		template<typename U>
+		friend class ArenaAllocator;
+
+		ModuleArena* m_arena;
+	};
+
+	/**
+	 * Allocation policy that uses the global allocator, the default for all modules.
+	 */
+	struct DefaultModuleAllocation
+	{
+		template<typename Module>
+		static std::shared_ptr<Module> Create(ModuleManager& /*manager*/)
+		{
+			return std::make_shared<Module>();
+		}
+	};
+
+	/**
+	 * Allocation policy that places the module and its control block in the module arena of the ModuleManager.
+	 * Defined in module_manager.h.
+	 */
+	struct ArenaModuleAllocation
+	{
+		template<typename Module>
+		static std::shared_ptr<Module> Create(ModuleManager& manager);
+	};
+
+	/**
+	 * Allocation policy that places the module and its control block in the memory resource of the module,
+	 * so the module itself counts towards its memory statistics and budget.
+	 * Defined in module_manager.h.
+	 */
+	struct TrackedModuleAllocation
+	{
+		template<typename Module>
+		static std::shared_ptr<Module> Create(ModuleManager& manager);
+	};
+
+	/**
+	 * Allocation policy that places the module in an arena whose pages are interleaved across all NUMA nodes.
+	 * Suited for large modules that are used from threads on every node.
+	 * Defined in module_manager.h.
+	 */
+	struct InterleavedModuleAllocation
+	{
+		template<typename Module>
+		static std::shared_ptr<Module> Create(ModuleManager& manager);
+	};
+
+	/**
+	 * Allocation policy for read-mostly modules that keeps a replica of the module on every NUMA node.
+	 * The module is created on the first node, once OnStartupModule has returned it is copy constructed onto every other node.
+	 * GetModulePtr, PinModule and ModuleHandle then return the replica of the node of the calling thread.
+	 *
+	 * Replicas are snapshots: they receive no lifecycle calls and do not see changes made to the module after its startup,
+	 * reload the module to refresh them. Replicas die together with the module.
+	 * On single node machines no replica is made and the policy behaves like ArenaModuleAllocation.
+	 * Defined in module_manager.h.
+	 */
+	struct ReplicatedModuleAllocation
+	{
+		static constexpr bool kReplicated = true;
+
+		template<typename Module>
+		static std::shared_ptr<Module> Create(ModuleManager& manager);
+
+		/**
+		 * Creates the replica of a started module on a node.
+		 *
+		 * @param manager The manager that owns the module.
+		 * @param module The started module.
+		 * @param node The node of the replica.
+		 * @return The replica.
+		 */
+		template<typename Module>
+		static std::shared_ptr<Module> Replicate(ModuleManager& manager, const Module& module, std::uint32_t node);
+	};
+
+	/**
+	 * Trait that tests whether an allocation policy replicates modules, see ReplicatedModuleAllocation.
+	 * A replicating policy declares kReplicated and provides a static Replicate<Module>(ModuleManager&, const Module&, std::uint32_t).
+	 *
+	 * @tparam Policy The allocation policy.
+	 */
+	template<typename Policy, typename = void>
+	struct IsReplicatedModuleAllocation : std::false_type
+	{
+	};
+
+	template<typename Policy>
+	struct IsReplicatedModuleAllocation<Policy, std::enable_if_t<Policy::kReplicated>> : std::true_type
+	{
+	};
+
+	/**
+	 * Trait that yields the allocation policy of a module.
+	 * Picks up the policy declared with FKL_MODULE_ALLOCATION inside the module,
+	 * may also be specialized for modules that cannot be changed.
+	 * A policy provides a static Create<Module>(ModuleManager&) that returns the new module.
+	 *
+	 * @tparam Module The module to get the allocation policy for.
+	 */
+	template<typename Module, typename = void>
+	struct ModuleAllocation
+	{
+		using type = DefaultModuleAllocation;
+	};
+
+	template<typename Module>
+	struct ModuleAllocation<Module, std::void_t<typename Module::FKLModuleAllocation>>
+	{
+		using type = typename Module::FKLModuleAllocation;
+	};
+}
+
+#define FKL_MODULE_ALLOCATION(Policy) \
+	public: \
+	using FKLModuleAllocation = Policy;
+
+#endif // !FKL_MODULE_ALLOCATION_H
@@ -0,0 +1,77 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_DEPENDENCIES_H
+#define FKL_MODULE_DEPENDENCIES_H
+
+#include <array>
+#include <type_traits>
+
+#include "absl/types/span.h"
+
+#include "module_info.h"
+#include "module_interface.h"
+
+namespace fkleafs
+{
+	/**
+	 * Compile time list of the modules a module depends on.
+	 * The infos live in static storage, so registering them never allocates.
+	 *
+	 * @tparam Modules The modules that have to be started before the depending module.
+	 */
+	template<typename... Modules>
+	struct ModuleDependencyList
+	{
+		// Required that all Modules are derived from ModuleInterface.
+		static_assert((std::is_base_of<ModuleInterface, Modules>::value && ...), "Any Module should be derived from ModuleInterface");
+
+		static constexpr std::array<ModuleInfo, sizeof...(Modules)> kInfos{ { ModuleInfo::GetModuleInfo<Modules>()... } };
+
+		/**
+		 * Returns the infos of all dependencies.
+		 *
+		 * @return The infos of all dependencies.
+		 */
+		static absl::Span<const ModuleInfo> Infos()
+		{
+			return absl::Span<const ModuleInfo>(kInfos.data(), kInfos.size());
+		}
+	};
+
+	/**
+	 * Trait that yields the ModuleDependencyList of a module.
+	 * Picks up the list declared with FKL_MODULE_DEPENDENCIES inside the module,
+	 * may also be specialized for modules that cannot be changed.
+	 *
+	 * @tparam Module The module to get the dependencies for.
+	 */
+	template<typename Module, typename = void>
+	struct ModuleDependencies
+	{
+		using type = ModuleDependencyList<>;
+	};
+
+	template<typename Module>
+	struct ModuleDependencies<Module, std::void_t<typename Module::FKLModuleDependencies>>
+	{
+		using type = typename Module::FKLModuleDependencies;
+	};
+}
+
+#define FKL_MODULE_DEPENDENCIES(...) \
+	public: \
+	using FKLModuleDependencies = fkleafs::ModuleDependencyList<__VA_ARGS__>;
+
+#endif // !FKL_MODULE_DEPENDENCIES_H
@@ -0,0 +1,155 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_EXECUTOR_H
+#define FKL_MODULE_EXECUTOR_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+#include "thread_pool.h"
+
+namespace fkleafs
+{
+	/**
+	 * How a ModuleExecutor runs its tasks.
+	 */
+	enum class ModuleExecutorKind
+	{
+		/**
+		 * Tasks run on the thread pool of the ModuleManager, one batch at a time, so they never run concurrently.
+		 */
+		kStrand,
+
+		/**
+		 * Tasks run on a thread owned by the executor, optionally pinned to a processor.
+		 */
+		kPinnedThread
+	};
+
+	/**
+	 * Options of a ModuleExecutor, see ModuleManager::CreateModuleExecutor.
+	 */
+	struct ModuleExecutorOptions
+	{
+		ModuleExecutorKind kind = ModuleExecutorKind::kStrand;
+
+		/**
+		 * Processor the thread of a kPinnedThread executor is pinned to, -1 to leave the placement to the system.
+		 * Only a hint, ignored on platforms without thread affinity.
+		 */
+		int processor = -1;
+
+		/**
+		 * Number of tasks after which a strand yields its worker to other tasks of the pool, 0 for no limit.
+		 */
+		std::size_t max_batch_size = 256;
+	};
+
+	/**
+	 * Serial executor owned by a module.
+	 *
+	 * Tasks run one after another in the order they have been posted and never concurrently,
+	 * so state that is only touched by the tasks of the executor needs no locks.
+	 * Producers append to a shared queue, the executor takes the whole queue at once and runs it as a batch,
+	 * so the queue mutex is taken once per post and once per batch, never per executed task.
+	 */
+	class ModuleExecutor : public std::enable_shared_from_this<ModuleExecutor>
+	{
+	public:
+		/**
+		 * Creates an executor and starts its thread for kPinnedThread executors.
+		 *
+		 * @param options The options of the executor.
+		 * @param pool The pool strands run on, must outlive the executor.
+		 * @return The executor.
+		 */
+		static std::shared_ptr<ModuleExecutor> Create(const ModuleExecutorOptions& options, ThreadPool& pool);
+
+		/**
+		 * Stops the executor, see Stop.
+		 */
+		~ModuleExecutor();
+
+		ModuleExecutor(const ModuleExecutor&) = delete;
+		ModuleExecutor& operator=(const ModuleExecutor&) = delete;
+
+		/**
+		 * Appends a task to the queue.
+		 *
+		 * @param task The task.
+		 * @return True if the task has been queued, false if the executor has been stopped.
+		 */
+		bool Post(std::function<void()> task);
+
+		/**
+		 * Tests whether the calling thread is running a task of this executor.
+		 *
+		 * @return True if the calling thread is running a task of this executor, false otherwise.
+		 */
+		bool IsCurrent() const;
+
+		/**
+		 * Rejects new tasks, runs the queued ones and waits until they have finished.
+		 * Called on a task of the executor itself, it only rejects new tasks, the queue is drained once the task returns.
+		 */
+		void Stop();
+
+	private:
+		ModuleExecutor(const ModuleExecutorOptions& options, ThreadPool& pool);
+
+		/**
+		 * Runs batches until the queue is empty or max_tasks tasks have run.
+		 * Must only be called by the owner of the strand, clears m_running once the queue is empty.
+		 *
+		 * @param max_tasks The number of tasks after which no further batch is taken.
+		 * @return True if the queue is empty, false if tasks are left.
+		 */
+		bool RunBatches(std::size_t max_tasks);
+
+		/**
+		 * Schedules a strand onto the pool, the strand keeps the executor alive until it has run.
+		 */
+		void ScheduleStrand();
+
+		/**
+		 * Main loop of a kPinnedThread executor.
+		 *
+		 * @param self The executor, locked while a batch runs so that a task releasing the last reference
+		 * to the executor does not destroy it underneath the loop.
+		 */
+		void ThreadLoop(std::weak_ptr<ModuleExecutor> self);
+
+		const ModuleExecutorOptions m_options;
+		ThreadPool& m_pool;
+
+		absl::Mutex m_mutex;
+		std::vector<std::function<void()>> m_tasks;
+
+		/**
+		 * True while a strand is scheduled or running, or while Stop drains the queue.
+		 */
+		bool m_running = false;
+		bool m_stopping = false;
+
+		std::thread m_thread;
+	};
+}
+
+#endif // !FKL_MODULE_EXECUTOR_H
@@ -0,0 +1,269 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_FACTORY_H
+#define FKL_MODULE_FACTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "absl/types/span.h"
+
+#include "module_allocation.h"
+#include "module_dependencies.h"
+#include "module_info.h"
+#include "module_interface.h"
+#include "module_service.h"
+#include "module_tick.h"
+
+namespace fkleafs
+{
+	/**
+	 * Creates a new instance of a module.
+	 */
+	using ModuleCreateFunction = std::shared_ptr<ModuleInterface> (*)();
+
+	/**
+	 * Returns the declared dependencies of a module.
+	 */
+	using ModuleDependenciesFunction = absl::Span<const ModuleInfo> (*)();
+
+	/**
+	 * Creates the replica of a started module on a NUMA node, see ReplicatedModuleAllocation.
+	 */
+	using ModuleReplicateFunction = std::shared_ptr<ModuleInterface> (*)(const ModuleInterface& module, std::uint32_t node);
+
+	/**
+	 * Phase a module is loaded in by ModuleManager::StartupPhases, see FKL_REGISTER_MODULE_IN_PHASE.
+	 */
+	enum class ModuleStartupPhase
+	{
+		/**
+		 * Loaded synchronously, required before the application reports readiness.
+		 */
+		kCritical,
+
+		/**
+		 * Loaded in the background right after the critical phase.
+		 */
+		kDefault,
+
+		/**
+		 * Loaded in the background once the default phase has been loaded.
+		 */
+		kBackground
+	};
+
+	/**
+	 * Statically registered module.
+	 * Plain data without a constructor, so it can live in static storage of the registering translation unit
+	 * and be linked into the ModuleFactoryTable during static initialization without allocating or locking.
+	 */
+	struct ModuleFactory
+	{
+		ModuleInfo info;
+
+		/**
+		 * Stable name the module can be looked up by, see FKL_REGISTER_NAMED_MODULE.
+		 * The spelling of the type name by the compiler unless a name has been declared.
+		 */
+		std::string_view name;
+		ModuleCreateFunction create;
+		ModuleDependenciesFunction dependencies;
+		ModuleTickFunction tick;
+		ModuleServicesFunction services;
+
+		/**
+		 * nullptr unless the allocation policy of the module replicates it.
+		 */
+		ModuleReplicateFunction replicate;
+		ModuleStartupPhase phase;
+
+		/**
+		 * Size and alignment of the module type.
+		 */
+		std::size_t size;
+		std::size_t alignment;
+
+		/**
+		 * Intrusive link of the registration list, owned by the ModuleFactoryTable.
+		 */
+		ModuleFactory* next;
+	};
+
+	/**
+	 * Process wide table of all statically registered modules.
+	 *
+	 * Registrations are pushed onto a lock free intrusive list during static initialization.
+	 * The first lookup seals the table: the list is turned into a dense array sorted by module hash
+	 * that is never modified again and is read without locking.
+	 * Registrations that arrive after the table has been sealed are rejected, callers register those at runtime instead.
+	 *
+	 * Sealing also builds a minimal perfect hash of the module names (hash and displace),
+	 * so a lookup by name hashes the name once and compares a single candidate, without allocating or probing.
+	 */
+	class ModuleFactoryTable
+	{
+	private:
+		/**
+		 * Private constructor for the singleton pattern.
+		 */
+		ModuleFactoryTable();
+
+	public:
+		/**
+		 * Getter for the sealed table, seals the table on first use.
+		 *
+		 * @return The sealed table.
+		 */
+		static const ModuleFactoryTable& Get();
+
+		/**
+		 * Adds a factory to the table.
+		 * Lock free and allocation free, safe to call during static initialization.
+		 *
+		 * @param factory The factory, must stay valid for the lifetime of the process.
+		 * @return True if the factory has been added, false if the table is already sealed.
+		 */
+		static bool Add(ModuleFactory& factory);
+
+		/**
+		 * Tests whether a module is statically registered, without sealing the table.
+		 * Safe to call during static initialization.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module is statically registered, false otherwise.
+		 */
+		static bool IsRegistered(const ModuleInfo& info);
+
+		ModuleFactoryTable(const ModuleFactoryTable&) = delete;
+		ModuleFactoryTable& operator=(const ModuleFactoryTable&) = delete;
+
+		/**
+		 * Looks up the factory of a module.
+		 *
+		 * @param info The module info of the module.
+		 * @return The factory or nullptr if the module is not statically registered.
+		 */
+		const ModuleFactory* Find(const ModuleInfo& info) const;
+
+		/**
+		 * Looks up the factory of a module by the name it has been registered under.
+		 *
+		 * @param name The name of the module.
+		 * @return The factory or nullptr if no module is statically registered under the name.
+		 */
+		const ModuleFactory* FindByName(std::string_view name) const
+		{
+			if (m_name_slots.empty())
+			{
+				return nullptr;
+			}
+			const std::uint64_t hash = detail::HashModuleName(name);
+			const std::uint64_t displacement = m_name_displacements[hash % m_name_displacements.size()];
+			const ModuleFactory* factory = m_name_slots[NameSlot(hash, displacement, m_name_slots.size())];
+			return factory != nullptr && factory->name == name ? factory : nullptr;
+		}
+
+		/**
+		 * Returns all factories, densely indexed and sorted by module hash.
+		 *
+		 * @return All factories.
+		 */
+		absl::Span<const ModuleFactory* const> Factories() const
+		{
+			return absl::MakeConstSpan(m_factories);
+		}
+
+	private:
+		/**
+		 * Maps the hash of a name to its slot, given the displacement of the bucket of the name.
+		 */
+		static std::size_t NameSlot(std::uint64_t hash, std::uint64_t displacement, std::size_t slot_count)
+		{
+			std::uint64_t mixed = hash ^ (displacement * 0x9e3779b97f4a7c15ull);
+			mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+			mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+			return static_cast<std::size_t>((mixed ^ (mixed >> 31)) % slot_count);
+		}
+
+		/**
+		 * Builds m_name_displacements and m_name_slots from m_factories.
+		 */
+		void BuildNameTable();
+
+		std::vector<const ModuleFactory*> m_factories;
+
+		/**
+		 * Displacement of every bucket of names and the factory of every slot, nullptr for empty slots.
+		 */
+		std::vector<std::uint32_t> m_name_displacements;
+		std::vector<const ModuleFactory*> m_name_slots;
+	};
+
+	/**
+	 * Returns the function that replicates a module, if the allocation policy of the module replicates it.
+	 *
+	 * @tparam Module The module.
+	 * @tparam Creator Provides a static ReplicateModuleInterface function that replicates the module.
+	 * @return The function or nullptr if the module is not replicated.
+	 */
+	template<typename Module, typename Creator>
+	constexpr ModuleReplicateFunction MakeModuleReplicateFunction()
+	{
+		if constexpr (IsReplicatedModuleAllocation<typename ModuleAllocation<Module>::type>::value)
+		{
+			return &Creator::ReplicateModuleInterface;
+		}
+		else
+		{
+			return nullptr;
+		}
+	}
+
+	/**
+	 * Returns the factory of a module type.
+	 *
+	 * @tparam Module The module.
+	 * @tparam Creator Provides a static CreateModuleInterface function that creates the module.
+	 * @tparam Phase The startup phase of the module.
+	 * @param name The stable name of the module or an empty name to use the type name. Must have static storage duration.
+	 * @return The factory, not yet linked into the table.
+	 */
+	template<typename Module, typename Creator, ModuleStartupPhase Phase = ModuleStartupPhase::kDefault>
+	constexpr ModuleFactory MakeModuleFactory(std::string_view name = std::string_view())
+	{
+		// Required that Module is derived from ModuleInterface.
+		static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+		return ModuleFactory{
+			ModuleInfo::GetModuleInfo<Module>(),
+			name.empty() ? ModuleInfo::GetModuleInfo<Module>().ModuleName() : name,
+			&Creator::CreateModuleInterface,
+			&ModuleDependencies<Module>::type::Infos,
+			&ModuleTickTraits<Module>::Settings,
+			&ModuleServiceTraits<Module>::Settings,
+			MakeModuleReplicateFunction<Module, Creator>(),
+			Phase,
+			sizeof(Module),
+			alignof(Module),
+			nullptr };
+	}
+}
+
+#endif // !FKL_MODULE_FACTORY_H
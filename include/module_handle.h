@@ -0,0 +1,455 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_HANDLE_H
+#define FKL_MODULE_HANDLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#include "absl/synchronization/mutex.h"
+
+#include "epoch_domain.h"
+#include "module_info.h"
+#include "module_interface.h"
+
+namespace fkleafs
+{
+	class ModuleManager;
+
+	/**
+	 * Lifecycle state of a module slot.
+	 */
+	enum class ModuleSlotState
+	{
+		kUnloaded,
+		kLoading,
+		kLoaded,
+		kUnloading
+	};
+
+	/**
+	 * Storage for one module in the dense slot array of the ModuleManager.
+	 * A slot is assigned to a module once and is never reused for another module,
+	 * so it stays valid across any number of load and unload cycles.
+	 */
+	struct ModuleSlot
+	{
+		/**
+		 * The loaded module or nullptr if the module is not loaded.
+		 */
+		std::atomic<ModuleInterface*> module{ nullptr };
+
+		/**
+		 * Incremented on every load and every unload of the module.
+		 * The generation is odd while the module is loaded.
+		 */
+		std::atomic<std::uint32_t> generation{ 0 };
+
+		/**
+		 * Once style latch that serializes loading and unloading of the module.
+		 * The thread that moves the state to kLoading or kUnloading owns the transition,
+		 * all other threads that want to change the state, TearDown included, wait on this slot only.
+		 * Lookups never take the latch, they may see the module while it is shutting down.
+		 */
+		absl::Mutex state_mutex;
+		ModuleSlotState state = ModuleSlotState::kUnloaded;
+		std::thread::id state_owner;
+
+		/**
+		 * The thread running OnTickModule of the module, guarded by state_mutex.
+		 * Ticks only start while the module is kLoaded and the unload latch waits for a running tick to return,
+		 * so OnShutdownModule never overlaps OnTickModule of another thread.
+		 */
+		std::thread::id tick_owner;
+	};
+
+	/**
+	 * Dense array of module slots.
+	 * Slots are allocated in fixed size chunks that are never moved, so a reference to a slot stays valid
+	 * for the lifetime of the array and readers can access slots without locking.
+	 */
+	class ModuleSlotArray
+	{
+	public:
+		/**
+		 * Marks an invalid slot index.
+		 */
+		static constexpr std::uint32_t kInvalidIndex = std::numeric_limits<std::uint32_t>::max();
+
+		/**
+		 * Number of slots in a chunk.
+		 */
+		static constexpr std::uint32_t kSlotsPerChunk = 64;
+
+		/**
+		 * Maximum number of chunks.
+		 */
+		static constexpr std::uint32_t kMaxChunks = 1024;
+
+		ModuleSlotArray()
+		{
+			for (std::atomic<ModuleSlot*>& chunk : m_chunks)
+			{
+				chunk.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		~ModuleSlotArray()
+		{
+			for (std::atomic<ModuleSlot*>& chunk : m_chunks)
+			{
+				delete[] chunk.load(std::memory_order_relaxed);
+			}
+		}
+
+		ModuleSlotArray(const ModuleSlotArray&) = delete;
+		ModuleSlotArray& operator=(const ModuleSlotArray&) = delete;
+
+		/**
+		 * Returns the slot at the given index.
+		 * The index must have been returned by Allocate.
+		 *
+		 * @param index The index of the slot.
+		 * @return The slot.
+		 */
+		ModuleSlot& operator[](std::uint32_t index) const
+		{
+			return m_chunks[index / kSlotsPerChunk].load(std::memory_order_acquire)[index % kSlotsPerChunk];
+		}
+
+		/**
+		 * Allocates a new slot.
+		 * Calls must be serialized by the owner of the array.
+		 *
+		 * @return The index of the new slot or kInvalidIndex if the array is full.
+		 */
+		std::uint32_t Allocate()
+		{
+			const std::uint32_t index = m_size;
+			if (index / kSlotsPerChunk >= kMaxChunks)
+			{
+				return kInvalidIndex;
+			}
+
+			if (index % kSlotsPerChunk == 0)
+			{
+				m_chunks[index / kSlotsPerChunk].store(new ModuleSlot[kSlotsPerChunk], std::memory_order_release);
+			}
+			++m_size;
+			return index;
+		}
+
+		/**
+		 * Returns the number of allocated slots.
+		 * Calls must be serialized with Allocate.
+		 *
+		 * @return The number of allocated slots.
+		 */
+		std::uint32_t Size() const
+		{
+			return m_size;
+		}
+
+	private:
+		mutable std::atomic<ModuleSlot*> m_chunks[kMaxChunks];
+		std::uint32_t m_size = 0;
+	};
+
+	template<typename Module>
+	class ModuleHandle;
+
+	/**
+	 * Pinned reference to a loaded module.
+	 * The calling thread stays inside an epoch critical section while the pin exists, so the module cannot be destroyed.
+	 * Modules that are unloaded meanwhile are shut down, but their destruction is deferred until all pins have been released.
+	 * Pinning is cheaper than locking a std::weak_ptr, it never touches the shared reference count of the module.
+	 *
+	 * A pin must be released on the thread that created it. Keep pins short lived,
+	 * while a pin exists no retired memory can be reclaimed and TearDown waits for the pin to be released.
+	 *
+	 * @tparam Module The type of the module.
+	 */
+	template<typename Module>
+	class PinnedModule
+	{
+		// Required that Module is derived from ModuleInterface.
+		static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+	public:
+		/**
+		 * Constructs an empty pin.
+		 */
+		PinnedModule()
+			: m_module(nullptr)
+		{
+		}
+
+		~PinnedModule()
+		{
+			Release();
+		}
+
+		PinnedModule(PinnedModule&& other) noexcept
+			: m_module(other.m_module)
+		{
+			other.m_module = nullptr;
+		}
+
+		PinnedModule& operator=(PinnedModule&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Release();
+				m_module = other.m_module;
+				other.m_module = nullptr;
+			}
+			return *this;
+		}
+
+		PinnedModule(const PinnedModule&) = delete;
+		PinnedModule& operator=(const PinnedModule&) = delete;
+
+		/**
+		 * Returns the pinned module.
+		 *
+		 * @return The module or nullptr if the pin is empty.
+		 */
+		Module* Get() const
+		{
+			return m_module;
+		}
+
+		Module* operator->() const
+		{
+			return m_module;
+		}
+
+		Module& operator*() const
+		{
+			return *m_module;
+		}
+
+		explicit operator bool() const
+		{
+			return m_module != nullptr;
+		}
+
+		/**
+		 * Releases the pin early.
+		 */
+		void Release()
+		{
+			if (m_module != nullptr)
+			{
+				m_module = nullptr;
+				EpochDomain::Get().Leave();
+			}
+		}
+
+	private:
+		friend class ModuleManager;
+
+		template<typename OtherModule>
+		friend class ModuleHandle;
+
+		/**
+		 * Adopts the critical section the calling thread has entered.
+		 *
+		 * @param module The module found inside the critical section, must not be nullptr.
+		 */
+		explicit PinnedModule(Module* module)
+			: m_module(module)
+		{
+		}
+
+		Module* m_module;
+	};
+
+	/**
+	 * Typed handle to a module.
+	 * Obtained once through ModuleManager::GetModuleHandle, resolving the module afterwards
+	 * is a single load from the slot of the module plus a generation check, without hashing, reference counting or an epoch.
+	 * Get() is therefore only safe while the module cannot be unloaded concurrently, Pin() and Lock() are the safe accessors
+	 * for threads that race with UnloadModule.
+	 * The handle caches a pointer to the slot next to its dense index: slots are never moved,
+	 * so the pointer saves indexing the chunks of the ModuleSlotArray on every access.
+	 * The handle stays valid across UnloadModule and LoadModule cycles and reports nullptr while the module is not loaded.
+	 *
+	 * @tparam Module The type of the module.
+	 */
+	template<typename Module>
+	class ModuleHandle
+	{
+		// Required that Module is derived from ModuleInterface.
+		static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+	public:
+		/**
+		 * Constructs an invalid handle.
+		 */
+		ModuleHandle()
+			: m_manager(nullptr)
+			, m_slot(nullptr)
+			, m_slot_index(ModuleSlotArray::kInvalidIndex)
+			, m_info(ModuleInfo::GetModuleInfo<Module>())
+		{
+		}
+
+		/**
+		 * Tests whether the handle refers to a slot.
+		 *
+		 * @return True if the handle is valid, false otherwise.
+		 */
+		bool IsValid() const
+		{
+			return m_slot != nullptr;
+		}
+
+		/**
+		 * Returns the module.
+		 * A single load from the slot, validated against the generation of the slot so that a module
+		 * replaced in between is not returned. The module is not protected against destruction:
+		 * Get may only be called while the caller knows that the module is not unloaded,
+		 * for example on the thread that owns the lifecycle of the module.
+		 * Threads that race with UnloadModule must use Pin() or Lock() instead.
+		 * Replicated modules resolve to the replica on the node of the calling thread.
+		 *
+		 * @return The module or nullptr if the module is not loaded.
+		 */
+		Module* Get() const
+		{
+			if (m_slot == nullptr)
+			{
+				return nullptr;
+			}
+
+			const std::uint32_t generation = m_slot->generation.load(std::memory_order_acquire);
+			ModuleInterface* module = m_slot->module.load(std::memory_order_acquire);
+			if (module == nullptr || m_slot->generation.load(std::memory_order_acquire) != generation)
+			{
+				return nullptr;
+			}
+			return static_cast<Module*>(module->GetLocalReplica());
+		}
+
+		Module* operator->() const
+		{
+			return Get();
+		}
+
+		Module& operator*() const
+		{
+			return *Get();
+		}
+
+		/**
+		 * Tests whether the module is currently loaded.
+		 *
+		 * @return True if the module is loaded, false otherwise.
+		 */
+		bool IsLoaded() const
+		{
+			return m_slot != nullptr && m_slot->module.load(std::memory_order_acquire) != nullptr;
+		}
+
+		explicit operator bool() const
+		{
+			return IsLoaded();
+		}
+
+		/**
+		 * Returns the generation of the slot.
+		 * The generation changes on every load and unload, callers can compare generations to detect a reload of the module.
+		 *
+		 * @return The generation of the slot, odd while the module is loaded.
+		 */
+		std::uint32_t Generation() const
+		{
+			return m_slot != nullptr ? m_slot->generation.load(std::memory_order_acquire) : 0;
+		}
+
+		/**
+		 * Pins the module, the returned reference stays valid until the pin is released even if the module is unloaded meanwhile.
+		 *
+		 * @return The pinned module or an empty pin if the module is not loaded.
+		 */
+		PinnedModule<Module> Pin() const
+		{
+			if (m_slot == nullptr)
+			{
+				return PinnedModule<Module>();
+			}
+
+			EpochDomain::Get().Enter();
+			ModuleInterface* module = m_slot->module.load(std::memory_order_acquire);
+			if (module == nullptr)
+			{
+				EpochDomain::Get().Leave();
+				return PinnedModule<Module>();
+			}
+			return PinnedModule<Module>(static_cast<Module*>(module->GetLocalReplica()));
+		}
+
+		/**
+		 * Shares ownership of the module.
+		 * Slower than Get(), the module stays alive as long as the returned pointer exists.
+		 *
+		 * @return The module or an empty pointer if the module is not loaded.
+		 */
+		std::shared_ptr<Module> Lock() const;
+
+		/**
+		 * Getter for the dense index of the slot.
+		 *
+		 * @return The slot index or ModuleSlotArray::kInvalidIndex for invalid handles.
+		 */
+		std::uint32_t SlotIndex() const
+		{
+			return m_slot_index;
+		}
+
+		/**
+		 * Getter for the info of the module.
+		 *
+		 * @return The module info.
+		 */
+		const ModuleInfo& Info() const
+		{
+			return m_info;
+		}
+
+	private:
+		friend class ModuleManager;
+
+		ModuleHandle(ModuleManager* manager, ModuleSlot* slot, std::uint32_t slot_index, const ModuleInfo& info)
+			: m_manager(manager)
+			, m_slot(slot)
+			, m_slot_index(slot_index)
+			, m_info(info)
+		{
+		}
+
+		ModuleManager* m_manager;
+		ModuleSlot* m_slot;
+		std::uint32_t m_slot_index;
+		ModuleInfo m_info;
+	};
+}
+
+#endif // !FKL_MODULE_HANDLE_H
@@ -15,18 +15,106 @@
 #ifndef FKL_MODULE_INFO_H
 #define FKL_MODULE_INFO_H
 
-#include <string>
-#include <typeinfo>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
 #include <type_traits>
 
 #include "module_interface.h"
 
 namespace fkleafs
 {
+	namespace detail
+	{
+		/**
+		 * Returns the signature of this function as reported by the compiler.
+		 * The signature contains the spelling of T, which is extracted by ExtractTypeName.
+		 *
+		 * @tparam T The type to retrieve the signature for.
+		 * @return The compiler generated signature.
+		 */
+		template<typename T>
+		constexpr std::string_view RawTypeName()
+		{
+#if defined(__clang__) || defined(__GNUC__)
+			return __PRETTY_FUNCTION__;
+#elif defined(_MSC_VER)
+			return __FUNCSIG__;
+#else
+#error "fkleafs requires a compiler that supports __PRETTY_FUNCTION__ or __FUNCSIG__"
+#endif
+		}
+
+		/**
+		 * Length of the signature text in front of the type name.
+		 * Computed by probing the signature generated for void.
+		 */
+		constexpr std::size_t kRawTypeNamePrefixLength = RawTypeName<void>().find("void");
+
+		/**
+		 * Length of the signature text behind the type name.
+		 */
+		constexpr std::size_t kRawTypeNameSuffixLength = RawTypeName<void>().size() - kRawTypeNamePrefixLength - std::string_view("void").size();
+
+		/**
+		 * Removes the signature around the type name and the elaborated type specifier MSVC puts in front of class types.
+		 *
+		 * @param raw_name The signature generated by RawTypeName.
+		 * @return The plain name of the type.
+		 */
+		constexpr std::string_view ExtractTypeName(std::string_view raw_name)
+		{
+			std::string_view name = raw_name.substr(kRawTypeNamePrefixLength, raw_name.size() - kRawTypeNamePrefixLength - kRawTypeNameSuffixLength);
+			for (const std::string_view keyword : { std::string_view("class "), std::string_view("struct ") })
+			{
+				if (name.substr(0, keyword.size()) == keyword)
+				{
+					name.remove_prefix(keyword.size());
+				}
+			}
+			return name;
+		}
+
+		/**
+		 * 64 bit FNV-1a hash of a module name.
+		 * The hash only depends on the name, so it is stable across builds and shared library boundaries for a given compiler.
+		 *
+		 * @param name The name to hash.
+		 * @return The hash of the name.
+		 */
+		constexpr std::size_t HashModuleName(std::string_view name)
+		{
+			std::uint64_t hash = 14695981039346656037ull;
+			for (const char character : name)
+			{
+				hash ^= static_cast<unsigned char>(character);
+				hash *= 1099511628211ull;
+			}
+			return static_cast<std::size_t>(hash);
+		}
+
+		/**
+		 * Static storage for the identity of a type.
+		 * The name is a view into the signature string of RawTypeName<T>, which has static storage duration,
+		 * so every instantiation is interned exactly once and never copied.
+		 * The name and hash are stable for a given compiler only, GCC, Clang and MSVC spell some types differently,
+		 * so a host and its dynamic modules must be built with the same compiler to agree on the identity of a module.
+		 */
+		template<typename T>
+		struct TypeIdentity
+		{
+			static constexpr std::string_view name = ExtractTypeName(RawTypeName<T>());
+			static constexpr std::size_t hash = HashModuleName(name);
+		};
+	}
+
 	/**
 	 * Info about a module.
 	 * Stores a identification hash that is unique for any given module
-	 * and a string containing the name of the module.
+	 * and a view of the name of the module.
+	 * 
+	 * The info is computed at compile time and is trivially copyable,
+	 * so passing it by value or building it as a key costs nothing.
 	 */
 	class ModuleInfo
 	{
@@ -35,47 +123,48 @@ namespace fkleafs
 		 * Private constructor.
 		 * Instances of the class are being generated by calling fkleafs::ModuleInfo::GetModuleInfo<ModuleType>()
 		 */
-		ModuleInfo()
-			: m_module_name()
-			, m_module_hash(-1)
+		constexpr ModuleInfo(std::string_view module_name, std::size_t module_hash)
+			: m_module_name(module_name)
+			, m_module_hash(module_hash)
 		{}
 
 	public:
 
 		/**
-		 * Returns a new instance of ModuleInfo.
+		 * Returns the info for the given module type.
 		 * 
 		 * @template param Module The module type to generate the info for.
 		 * @return The module info for the given module type.
 		 */
 		template<typename Module>
-		static inline ModuleInfo GetModuleInfo()
+		static constexpr ModuleInfo GetModuleInfo()
 		{
 			// Required that Module is derived from ModuleInterface.
 			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
 
-			// Use typeid to retrieve the info about the module.
-			//
-			// When applied to an expression of polymorphic type, 
-			// evaluation of a typeid expression may involve runtime overhead 
-			// (a virtual table lookup), otherwise typeid expression is resolved at compile time.
-			// https://en.cppreference.com/w/cpp/language/typeid
-			// 
-			// There should be no runtime overhead here.
-			const std::type_info& type_info = typeid(Module);
-
-			ModuleInfo module_info;
-			module_info.m_module_name = type_info.name();
-			module_info.m_module_hash = type_info.hash_code();
-			return module_info;
+			return ModuleInfo(detail::TypeIdentity<Module>::name, detail::TypeIdentity<Module>::hash);
+		}
+
+		/**
+		 * Returns the info of a module that is only known by name, for example a module that lives in a shared library.
+		 * The info equals GetModuleInfo<Module>() if the name is the name of Module.
+		 * The name is not copied, so it has to outlive the info.
+		 *
+		 * @param module_name The name of the module.
+		 * @return The module info for the given name.
+		 */
+		static constexpr ModuleInfo FromName(std::string_view module_name)
+		{
+			return ModuleInfo(module_name, detail::HashModuleName(module_name));
 		}
 
 		/**
 		 * Getter for the name of the module.
+		 * The returned view has static storage duration, unless the info has been created by FromName.
 		 *
 		 * @return the name of the module.
 		 */
-		const std::string& ModuleName() const
+		constexpr std::string_view ModuleName() const
 		{
 			return m_module_name;
 		}
@@ -85,7 +174,7 @@ namespace fkleafs
 		 *
 		 * @return the hash identifier.
 		 */
-		std::size_t ModuleHash() const
+		constexpr std::size_t ModuleHash() const
 		{
 			return m_module_hash;
 		}
@@ -97,7 +186,7 @@ namespace fkleafs
 		 */
 		struct ModuleInfoHash
 		{
-			std::size_t operator()(const ModuleInfo& module_info) const
+			constexpr std::size_t operator()(const ModuleInfo& module_info) const
 			{
 				return module_info.ModuleHash();
 			}
@@ -108,16 +197,18 @@ namespace fkleafs
 		 */
 		struct ModuleInfoEqual
 		{
-			bool operator()(const ModuleInfo& lhs, const ModuleInfo& rhs) const
+			constexpr bool operator()(const ModuleInfo& lhs, const ModuleInfo& rhs) const
 			{
 				return lhs.ModuleHash() == rhs.ModuleHash();
 			}
 		};
 
 	private:
-		std::string m_module_name;
+		std::string_view m_module_name;
 		std::size_t m_module_hash;
 	};
+
+	static_assert(std::is_trivially_copyable<ModuleInfo>::value, "ModuleInfo must stay cheap to pass by value");
 }
 
 #endif // !FKL_MODULE_INFO_H
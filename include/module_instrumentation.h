@@ -0,0 +1,393 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_INSTRUMENTATION_H
+#define FKL_MODULE_INSTRUMENTATION_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+#include "module_info.h"
+#include "module_memory.h"
+#include "module_trace.h"
+
+// Instrumentation is compiled in with the FKLEAFS_ENABLE_INSTRUMENTATION definition, see the CMake option of the same name.
+// Without it all recording functions are empty and inlined away, the query API stays available and reports nothing.
+
+namespace fkleafs
+{
+	/**
+	 * Lifecycle timings and lookup counts of one module.
+	 * Durations are summed over all loads of the module.
+	 */
+	struct ModuleStatistics
+	{
+		ModuleInfo info;
+
+		/**
+		 * Time spent in the creator of the module, that is the constructor or opening the library of a dynamic module.
+		 */
+		absl::Duration construction_duration = absl::ZeroDuration();
+
+		/**
+		 * Time spent in OnStartupModule.
+		 */
+		absl::Duration startup_duration = absl::ZeroDuration();
+
+		/**
+		 * Time spent in OnShutdownModule.
+		 */
+		absl::Duration shutdown_duration = absl::ZeroDuration();
+
+		/**
+		 * Time spent in OnTickModule, summed over all ticks, and the longest single tick.
+		 */
+		absl::Duration tick_duration = absl::ZeroDuration();
+		absl::Duration max_tick_duration = absl::ZeroDuration();
+		std::uint64_t tick_count = 0;
+
+		std::uint64_t load_count = 0;
+		std::uint64_t unload_count = 0;
+
+		/**
+		 * Number of lookups through ModuleManager::GetModuleInterfacePtr.
+		 */
+		std::uint64_t lookup_count = 0;
+
+		/**
+		 * Usage of the memory resource of the module, see ModuleManager::GetModuleMemoryResource.
+		 * Reported independent of FKLEAFS_ENABLE_INSTRUMENTATION, for every module whose resource has been requested.
+		 */
+		bool has_memory_statistics = false;
+		ModuleMemoryStatistics memory = ModuleMemoryStatistics();
+	};
+
+	/**
+	 * Point in time view of the instrumentation of a ModuleManager.
+	 */
+	struct InstrumentationSnapshot
+	{
+		/**
+		 * All modules that have been constructed, started, shut down or looked up, in unspecified order.
+		 */
+		std::vector<ModuleStatistics> modules;
+
+		/**
+		 * Time threads spent waiting to acquire the registry mutexes of the ModuleManager.
+		 */
+		absl::Duration modules_mutex_wait = absl::ZeroDuration();
+		absl::Duration registered_modules_mutex_wait = absl::ZeroDuration();
+	};
+
+	/**
+	 * Lifecycle phases of a module that are timed.
+	 */
+	enum class ModulePhase
+	{
+		kConstruction,
+		kStartup,
+		kShutdown,
+		kTick
+	};
+
+#if defined(FKLEAFS_ENABLE_INSTRUMENTATION)
+	/**
+	 * absl::Mutex that accumulates the time threads wait to acquire it.
+	 * Uncontended acquisitions only pay for a failed try lock, the clock is read only when a thread has to wait.
+	 * Waits are also recorded as spans if a tracer is set, see SetTracer.
+	 */
+	class InstrumentedMutex
+	{
+	public:
+		/**
+		 * Sets the tracer the waits are recorded into.
+		 * Must be called before the mutex is used.
+		 *
+		 * @param tracer The tracer.
+		 * @param name The name of the mutex on the timeline, must have static storage duration.
+		 */
+		void SetTracer(ModuleTracer* tracer, std::string_view name)
+		{
+			m_tracer = tracer;
+			m_name = name;
+		}
+
+		void Lock()
+		{
+			if (!m_mutex.TryLock())
+			{
+				const absl::Time start = absl::Now();
+				m_mutex.Lock();
+				AddWaitTime(start, absl::Now() - start);
+			}
+		}
+
+		void Unlock()
+		{
+			m_mutex.Unlock();
+		}
+
+		void ReaderLock()
+		{
+			if (!m_mutex.ReaderTryLock())
+			{
+				const absl::Time start = absl::Now();
+				m_mutex.ReaderLock();
+				AddWaitTime(start, absl::Now() - start);
+			}
+		}
+
+		void ReaderUnlock()
+		{
+			m_mutex.ReaderUnlock();
+		}
+
+		/**
+		 * Returns the total time threads waited for the mutex.
+		 *
+		 * @return The accumulated wait time.
+		 */
+		absl::Duration WaitTime() const
+		{
+			return absl::Nanoseconds(m_wait_nanoseconds.load(std::memory_order_relaxed));
+		}
+
+	private:
+		void AddWaitTime(absl::Time start, absl::Duration wait_time)
+		{
+			m_wait_nanoseconds.fetch_add(absl::ToInt64Nanoseconds(wait_time), std::memory_order_relaxed);
+			if (m_tracer != nullptr)
+			{
+				m_tracer->RecordSpan(TraceEventType::kMutexWait, m_name, start, wait_time);
+			}
+		}
+
+		absl::Mutex m_mutex;
+		std::atomic<std::int64_t> m_wait_nanoseconds{ 0 };
+		ModuleTracer* m_tracer = nullptr;
+		std::string_view m_name;
+	};
+
+	/**
+	 * Records lifecycle timings and lookup counts of the modules of one ModuleManager.
+	 * Timings are recorded under a mutex, they happen once per load.
+	 * Lookups are counted in a record owned by the calling thread and only summed up when a snapshot is taken.
+	 */
+	class ModuleInstrumentation
+	{
+	public:
+		/**
+		 * True if instrumentation is compiled in.
+		 */
+		static constexpr bool kEnabled = true;
+
+		/**
+		 * Times one lifecycle phase of a module, from construction to destruction of the scope.
+		 */
+		class ScopedPhase
+		{
+		public:
+			ScopedPhase(ModuleInstrumentation& instrumentation, const ModuleInfo& info, ModulePhase phase)
+				: m_instrumentation(instrumentation)
+				, m_info(info)
+				, m_phase(phase)
+				, m_start(absl::Now())
+			{
+			}
+
+			~ScopedPhase()
+			{
+				const absl::Duration duration = absl::Now() - m_start;
+				m_instrumentation.RecordPhase(m_info, m_phase, duration);
+				m_instrumentation.TracePhase(m_info, m_phase, m_start, duration);
+			}
+
+			ScopedPhase(const ScopedPhase&) = delete;
+			ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+		private:
+			ModuleInstrumentation& m_instrumentation;
+			const ModuleInfo m_info;
+			const ModulePhase m_phase;
+			const absl::Time m_start;
+		};
+
+		ModuleInstrumentation();
+
+		ModuleInstrumentation(const ModuleInstrumentation&) = delete;
+		ModuleInstrumentation& operator=(const ModuleInstrumentation&) = delete;
+
+		/**
+		 * Adds the duration of a lifecycle phase to the statistics of a module.
+		 *
+		 * @param info The module info of the module.
+		 * @param phase The phase that has been timed.
+		 * @param duration The duration of the phase.
+		 */
+		void RecordPhase(const ModuleInfo& info, ModulePhase phase, absl::Duration duration);
+
+		/**
+		 * Records a lifecycle phase of a module on the timeline, if tracing.
+		 *
+		 * @param info The module info of the module.
+		 * @param phase The phase that has been timed.
+		 * @param start The start of the phase.
+		 * @param duration The duration of the phase.
+		 */
+		void TracePhase(const ModuleInfo& info, ModulePhase phase, absl::Time start, absl::Duration duration)
+		{
+			switch (phase)
+			{
+			case ModulePhase::kConstruction:
+				m_tracer.RecordSpan(TraceEventType::kConstruction, info.ModuleName(), start, duration);
+				break;
+			case ModulePhase::kStartup:
+				m_tracer.RecordSpan(TraceEventType::kStartup, info.ModuleName(), start, duration);
+				break;
+			case ModulePhase::kShutdown:
+				m_tracer.RecordSpan(TraceEventType::kShutdown, info.ModuleName(), start, duration);
+				break;
+			case ModulePhase::kTick:
+				break;
+			}
+		}
+
+		/**
+		 * Getter for the tracer of the timeline.
+		 *
+		 * @return The tracer.
+		 */
+		ModuleTracer& Tracer()
+		{
+			return m_tracer;
+		}
+
+		/**
+		 * Counts a lookup of a module on the calling thread.
+		 *
+		 * @param info The module info of the module.
+		 */
+		void RecordLookup(const ModuleInfo& info);
+
+		/**
+		 * Sums up the statistics of all modules.
+		 *
+		 * @return The statistics, the mutex wait times are left for the caller to fill in.
+		 */
+		InstrumentationSnapshot Snapshot() const;
+
+	private:
+		/**
+		 * Lookup counts of one thread.
+		 * Written by its thread only, the mutex is uncontended unless a snapshot is taken.
+		 */
+		struct LookupRecord
+		{
+			absl::Mutex mutex;
+			absl::flat_hash_map<ModuleInfo, std::uint64_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> lookup_counts;
+		};
+
+		/**
+		 * Returns the lookup record of the calling thread, creating it on first use.
+		 *
+		 * @return The lookup record.
+		 */
+		LookupRecord& GetLookupRecord();
+
+		/**
+		 * Identifies the instrumentation in the thread local caches, addresses could be reused.
+		 */
+		const std::uint64_t m_id;
+
+		mutable absl::Mutex m_statistics_mutex;
+		absl::flat_hash_map<ModuleInfo, ModuleStatistics, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> m_statistics;
+
+		/**
+		 * Lookup records of all threads that ever looked up a module, they outlive their threads so no count is lost.
+		 */
+		mutable absl::Mutex m_lookup_records_mutex;
+		std::vector<std::unique_ptr<LookupRecord>> m_lookup_records;
+
+		ModuleTracer m_tracer;
+	};
+#else
+	/**
+	 * Mutex of the registry, a plain absl::Mutex while instrumentation is compiled out.
+	 */
+	class InstrumentedMutex : public absl::Mutex
+	{
+	public:
+		void SetTracer(ModuleTracer*, std::string_view)
+		{
+		}
+
+		absl::Duration WaitTime() const
+		{
+			return absl::ZeroDuration();
+		}
+	};
+
+	/**
+	 * Empty stand in while instrumentation is compiled out.
+	 */
+	class ModuleInstrumentation
+	{
+	public:
+		static constexpr bool kEnabled = false;
+
+		class ScopedPhase
+		{
+		public:
+			ScopedPhase(ModuleInstrumentation&, const ModuleInfo&, ModulePhase)
+			{
+			}
+		};
+
+		void RecordPhase(const ModuleInfo&, ModulePhase, absl::Duration)
+		{
+		}
+
+		void TracePhase(const ModuleInfo&, ModulePhase, absl::Time, absl::Duration)
+		{
+		}
+
+		ModuleTracer& Tracer()
+		{
+			return m_tracer;
+		}
+
+		void RecordLookup(const ModuleInfo&)
+		{
+		}
+
+		InstrumentationSnapshot Snapshot() const
+		{
+			return InstrumentationSnapshot();
+		}
+
+	private:
+		ModuleTracer m_tracer;
+	};
+#endif
+}
+
+#endif // !FKL_MODULE_INSTRUMENTATION_H
@@ -15,8 +15,22 @@
 #ifndef FKL_MODULE_INTERFACE_H
 #define FKL_MODULE_INTERFACE_H
 
+#include <memory>
+#include <vector>
+
+#include "numa_topology.h"
+
 namespace fkleafs
 {
+	class ModuleExecutor;
+	class ModuleManager;
+
+	template<typename Module>
+	class ModuleHandle;
+
+	template<typename... Modules>
+	class ModuleSet;
+
 	/**
 	 * Interface for all modules.
 	 * Inherit from this to declare a module.
@@ -24,6 +38,22 @@ namespace fkleafs
 	class ModuleInterface
 	{
 	public:
+		ModuleInterface() = default;
+
+		/**
+		 * Copies the module manager only, the replicas and the executor of a module belong to the module,
+		 * see ReplicatedModuleAllocation and ModuleManager::CreateModuleExecutor.
+		 */
+		ModuleInterface(const ModuleInterface& other)
+			: m_module_manager(other.m_module_manager)
+		{
+		}
+
+		ModuleInterface& operator=(const ModuleInterface& other)
+		{
+			m_module_manager = other.m_module_manager;
+			return *this;
+		}
 
 		/**
 		 * Note: Even though this is an interface class we need a virtual destructor here because modules are deleted via a pointer to this interface
@@ -39,12 +69,103 @@ namespace fkleafs
 		{
 		}
 
+		/**
+		 * Called on the new instance of a module that replaces a running instance, see ModuleManager::ReloadModule.
+		 * Runs before OnStartupModule of the new instance and before OnShutdownModule of the previous instance,
+		 * so the new instance can take over the state of the previous one, for example warm caches.
+		 * The previous instance is still in use by other threads while the state is handed over.
+		 *
+		 * The previous instance may live in a different copy of a module library that is closed once it has been destroyed.
+		 * State that is taken over must therefore not refer to code of the previous instance,
+		 * like virtual functions or function pointers of types defined in the library.
+		 *
+		 * @param previous_module The instance that is replaced, of the same module.
+		 */
+		virtual void OnReloadModule(ModuleInterface& /*previous_module*/)
+		{
+		}
+
+		/**
+		 * Called once per ModuleManager::Tick for modules that declare FKL_MODULE_TICK,
+		 * possibly on a worker thread and in parallel with ticks of modules whose accesses do not conflict.
+		 *
+		 * @param delta_time The time since the previous tick in seconds.
+		 */
+		virtual void OnTickModule(float /*delta_time*/)
+		{
+		}
+
 		/**
 		 * Called before the module is unloaded, right before the module object is destroyed.
 		 */
 		virtual void OnShutdownModule()
 		{
 		}
+
+		/**
+		 * Getter for the module manager the module has been loaded or attached by.
+		 *
+		 * @return The module manager or nullptr if the module is not managed by a module manager.
+		 */
+		ModuleManager* GetModuleManager() const
+		{
+			return m_module_manager;
+		}
+
+		/**
+		 * Getter for the executor of the module, see ModuleManager::CreateModuleExecutor.
+		 *
+		 * @return The executor or nullptr if the module has not opted into an executor.
+		 */
+		ModuleExecutor* GetModuleExecutor() const
+		{
+			return m_executor.get();
+		}
+
+	private:
+		friend class ModuleManager;
+
+		template<typename Module>
+		friend class ModuleHandle;
+
+		template<typename... Modules>
+		friend class ModuleSet;
+
+		/**
+		 * Copies of a module on the NUMA nodes, indexed by node.
+		 * The entry of the node the module itself lives on refers to the module.
+		 */
+		struct Replicas
+		{
+			std::vector<ModuleInterface*> nodes;
+			std::vector<std::shared_ptr<ModuleInterface>> storage;
+		};
+
+		/**
+		 * Returns the replica on the node of the calling thread.
+		 *
+		 * @return The replica, or this module if the module is not replicated.
+		 */
+		ModuleInterface* GetLocalReplica()
+		{
+			const Replicas* replicas = m_replicas.get();
+			return replicas == nullptr ? this : replicas->nodes[NumaTopology::CurrentNode()];
+		}
+
+		/**
+		 * Set by the module manager when it creates or attaches the module.
+		 */
+		ModuleManager* m_module_manager = nullptr;
+
+		/**
+		 * Set by the module manager after the startup of a replicated module, before the module is published.
+		 */
+		std::unique_ptr<const Replicas> m_replicas;
+
+		/**
+		 * Set by ModuleManager::CreateModuleExecutor, stopped by the module manager before OnShutdownModule.
+		 */
+		std::shared_ptr<ModuleExecutor> m_executor;
 	};
 }
 
@@ -15,62 +15,249 @@
 #ifndef FKL_MODULE_MANAGER_H
 #define FKL_MODULE_MANAGER_H
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
 #include <memory>
 #include <functional>
+#include <future>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "absl/base/call_once.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/base/log_severity.h"
 #include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 
+#include "dynamic_module.h"
+#include "epoch_domain.h"
+#include "event_bus.h"
+#include "module_allocation.h"
+#include "module_dependencies.h"
+#include "module_executor.h"
+#include "module_factory.h"
+#include "module_handle.h"
 #include "module_info.h"
+#include "module_instrumentation.h"
 #include "module_interface.h"
+#include "module_memory.h"
+#include "module_service.h"
+#include "module_tick.h"
+#include "module_trace.h"
+#include "numa_topology.h"
+#include "startup_manifest.h"
+#include "thread_pool.h"
+
+/**
+ * Number of shards the module registry is split into.
+ * Every shard has its own locks, so loading and unloading modules of different shards never contends.
+ * One shard is the right choice unless modules are loaded and unloaded at a high rate.
+ */
+#if !defined(FKLEAFS_REGISTRY_SHARD_COUNT)
+#define FKLEAFS_REGISTRY_SHARD_COUNT 1
+#endif
 
 namespace fkleafs
 {
+	template<typename Module>
+	class StaticallyLinkedModuleCreator;
+
+	struct ModuleBatch;
+
+	/**
+	 * Options for ModuleManager::TearDown.
+	 */
+	struct TearDownOptions
+	{
+		/**
+		 * Time a single OnShutdownModule call may take before the module is reported as overrunning.
+		 */
+		absl::Duration module_deadline = absl::InfiniteDuration();
+
+		/**
+		 * Time the whole teardown may take.
+		 * Once it is exceeded TearDown returns, modules that have not been shut down yet are released without OnShutdownModule
+		 * and modules that are still shutting down finish in the background.
+		 */
+		absl::Duration deadline = absl::InfiniteDuration();
+	};
+
+	/**
+	 * Result of ModuleManager::TearDown.
+	 */
+	struct TearDownReport
+	{
+		/**
+		 * Modules whose OnShutdownModule took longer than the module deadline.
+		 */
+		std::vector<ModuleInfo> overran_modules;
+
+		/**
+		 * Modules that were not shut down when the global deadline expired.
+		 */
+		std::vector<ModuleInfo> unfinished_modules;
+
+		/**
+		 * Wall clock time of the teardown.
+		 */
+		absl::Duration duration;
+
+		/**
+		 * Tests whether all modules have been shut down within their deadlines.
+		 *
+		 * @return True if no module overran a deadline, false otherwise.
+		 */
+		bool MetDeadlines() const
+		{
+			return overran_modules.empty() && unfinished_modules.empty();
+		}
+	};
+
+	/**
+	 * Options of ModuleManager::StartupPhases.
+	 */
+	struct PhasedStartupOptions
+	{
+		/**
+		 * Number of threads that load the default and background phases.
+		 */
+		std::size_t background_threads = 1;
+
+		/**
+		 * Scheduling priority of the background threads.
+		 */
+		ThreadPriority background_priority = ThreadPriority::kLow;
+	};
+
+	/**
+	 * Makes a module manager the current one of the calling thread, see ModuleManager::Current.
+	 * Scopes nest, the previous module manager is current again once the scope ends.
+	 */
+	class ModuleManagerScope
+	{
+	public:
+		explicit ModuleManagerScope(ModuleManager& manager);
+		~ModuleManagerScope();
+
+		ModuleManagerScope(const ModuleManagerScope&) = delete;
+		ModuleManagerScope& operator=(const ModuleManagerScope&) = delete;
+
+	private:
+		ModuleManager* m_previous_manager;
+		const ModuleInfo* m_previous_starting_module;
+		ModuleBatch* m_previous_batch;
+	};
+
 	/**
 	 * Manages all modules.
+	 *
+	 * Get returns the process wide module manager that FKL_MODULE_MANAGER refers to by default.
+	 * Further module managers can be constructed as isolated contexts, for example one per tenant or per test.
+	 * All contexts share the statically registered modules of the ModuleFactoryTable, which is read only once sealed,
+	 * and keep their own runtime registrations, loaded modules, services, event bus and thread pool.
+	 * Construction does not allocate more than a few small maps, the thread pool is only created on first use.
 	 */
 	class ModuleManager
 	{
-	private:
+	public:
 		/**
-		 * Private constructor for the singleton pattern. 
+		 * Constructs an empty module manager context.
 		 */
 		ModuleManager()
 		{
+			for (RegistryShard& shard : m_shards)
+			{
+				shard.mutex.SetTracer(&m_instrumentation.Tracer(), "modules_mutex");
+				shard.registered_modules_mutex.SetTracer(&m_instrumentation.Tracer(), "registered_modules_mutex");
+			}
+
+			ModuleArenaOptions interleaved_options;
+			interleaved_options.numa_placement = NumaPlacement::kInterleave;
+			m_interleaved_module_arena.Configure(interleaved_options);
 		}
 
-	public:
+		ModuleManager(const ModuleManager&) = delete;
+		ModuleManager& operator=(const ModuleManager&) = delete;
+
 		/**
-		 * Getter for the singleton of the ModuleManager.
+		 * Getter for the process wide ModuleManager.
 		 *
-		 * @return The singleton ModuleManager.
+		 * @return The process wide ModuleManager.
 		 */
 		static ModuleManager &Get();
 
+		/**
+		 * Returns the module manager of the calling thread.
+		 * That is the module manager that creates, starts, ticks or shuts down a module on the thread,
+		 * or the one of the innermost ModuleManagerScope, and the process wide one otherwise.
+		 *
+		 * @return The current module manager.
+		 */
+		static ModuleManager& Current();
+
+		/**
+		 * Returns the module manager an object belongs to.
+		 * For modules that is the module manager that loaded them, otherwise the current one.
+		 *
+		 * @param owner The object, usually this of the caller.
+		 * @return The module manager.
+		 */
+		template<typename Owner>
+		static ModuleManager& Of(const Owner& owner)
+		{
+			if constexpr (std::is_base_of<ModuleInterface, Owner>::value)
+			{
+				ModuleManager* manager = static_cast<const ModuleInterface&>(owner).GetModuleManager();
+				if (manager != nullptr)
+				{
+					return *manager;
+				}
+			}
+			return Current();
+		}
+
 		/**
 		 * Destructor.
 		 */
 		~ModuleManager()
 		{
 			TearDown();
+
+			// Shutdown tasks abandoned by a TearDown deadline still use the members, join them before any member is destroyed.
+			m_thread_pool.reset();
+			delete m_services.load(std::memory_order_relaxed);
 		}
 
 		/**
-		 * Deletes all smart pointers to modules. 
+		 * Shuts down and deletes all modules.
+		 * A module is shut down only after all modules that depend on it, declared or observed while loading, have been shut down.
+		 * Independent modules are shut down in parallel on the thread pool.
+		 * The teardown takes the unload latch of every loaded module first, so it waits for loads and unloads in flight
+		 * and no concurrent UnloadModule shuts a module down a second time.
+		 * OnShutdownModule must therefore not unload other modules during a teardown, such an unload waits for the teardown itself.
 		 */
 		void TearDown()
 		{
-			m_modules_mutex.Lock();
-			for (auto& iterator : m_modules)
-			{
-				iterator.second->OnShutdownModule();
-			}
-			m_modules.clear();
-			m_modules_mutex.Unlock();
+			TearDown(TearDownOptions());
 		}
 
+		/**
+		 * Shuts down and deletes all modules, respecting the given deadlines.
+		 *
+		 * @param options The deadlines of the teardown.
+		 * @return The report of the modules that overran their deadlines.
+		 */
+		TearDownReport TearDown(const TearDownOptions& options);
+
 		/**
 		 * Returns the count of currently loaded modules.
 		 *
@@ -78,10 +265,13 @@ namespace fkleafs
 		 */
 		inline int ModuleCount() const
 		{
-			m_modules_mutex.ReaderLock();
-			const int size = m_modules.size();
-			m_modules_mutex.ReaderUnlock();
-			return size;
+			EpochGuard guard;
+			std::size_t module_count = 0;
+			for (const RegistryShard& shard : m_shards)
+			{
+				module_count += shard.modules.load(std::memory_order_acquire)->size();
+			}
+			return static_cast<int>(module_count);
 		}
 
 		/**
@@ -92,10 +282,8 @@ namespace fkleafs
 		 */
 		inline bool IsModuleLoaded(const ModuleInfo &info) const
 		{
-			m_modules_mutex.ReaderLock();
-			const bool result = m_modules.contains(info);
-			m_modules_mutex.ReaderUnlock();
-			return result;
+			EpochGuard guard;
+			return GetShard(info).modules.load(std::memory_order_acquire)->contains(info);
 		}
 
 		/**
@@ -116,9 +304,15 @@ namespace fkleafs
 
 		inline bool IsModuleRegistered(const ModuleInfo& info) const
 		{
-			m_statically_registered_modules_mutex.ReaderLock();
-			const bool result = m_statically_registered_modules.contains(info);
-			m_statically_registered_modules_mutex.ReaderUnlock();
+			if (ModuleFactoryTable::IsRegistered(info))
+			{
+				return true;
+			}
+
+			const RegistryShard& shard = GetShard(info);
+			shard.registered_modules_mutex.ReaderLock();
+			const bool result = shard.registered_modules.contains(info);
+			shard.registered_modules_mutex.ReaderUnlock();
 			return result;
 		}
 
@@ -131,56 +325,95 @@ namespace fkleafs
 			return IsModuleRegistered(info);
 		}
 
-		bool RegisterModule(std::function<std::shared_ptr<ModuleInterface>()> module_creator_function, const ModuleInfo& info)
+		/**
+		 * Registers a module.
+		 *
+		 * @param module_creator_function Creates a new instance of the module.
+		 * @param info The module info of the module.
+		 * @param dependencies The modules that have to be loaded before the module is started. The storage must outlive the ModuleManager.
+		 * @param tick How the module ticks or nullptr if it does not tick. The storage must outlive the ModuleManager.
+		 * @param services The services the module provides or nullptr if it provides none. The storage must outlive the ModuleManager.
+		 * @return True if the module has been registered, false if it was already registered.
+		 */
+		bool RegisterModule(std::function<std::shared_ptr<ModuleInterface>()> module_creator_function, const ModuleInfo& info, absl::Span<const ModuleInfo> dependencies = {},
+			const ModuleTickSettings* tick = nullptr, const ModuleServiceSettings* services = nullptr)
 		{
-			if (IsModuleRegistered(info))
-			{
-				LOG(ERROR) << "The module: " << info.ModuleName() << " is already registered";
-				return false;
-			}
+			return RegisterModule(info, RegisteredModule{ nullptr, std::move(module_creator_function), dependencies, tick, services });
+		}
 
-			m_statically_registered_modules_mutex.Lock();
-			m_statically_registered_modules.emplace(info, module_creator_function);
-			m_statically_registered_modules_mutex.Unlock();
-			return true;
+		/**
+		 * Registers a module at runtime, prefer FKL_REGISTER_MODULE which registers without locking.
+		 *
+		 * @tparam Module The module to register.
+		 * @return True if the module has been registered, false if it was already registered.
+		 */
+		template<typename Module>
+		inline bool RegisterModule()
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return RegisterModule(ModuleInfo::GetModuleInfo<Module>(), RegisteredModule{ &StaticallyLinkedModuleCreator<Module>::CreateModuleInterface, nullptr, ModuleDependencies<Module>::type::Infos(),
+				ModuleTickTraits<Module>::Settings(), ModuleServiceTraits<Module>::Settings(), MakeModuleReplicateFunction<Module, StaticallyLinkedModuleCreator<Module>>() });
+		}
+
+		template<typename Module>
+		inline bool RegisterModule(std::function<std::shared_ptr<ModuleInterface>()> module_creator_function, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return RegisterModule(std::move(module_creator_function), info, ModuleDependencies<Module>::type::Infos(), ModuleTickTraits<Module>::Settings(),
+				ModuleServiceTraits<Module>::Settings());
+		}
+
+		/**
+		 * Registers a module that lives in a shared library.
+		 * The library is opened when the module is loaded and closed after the module has been unloaded.
+		 *
+		 * @param info The module info of the module the library exports.
+		 * @param library_path The path of the library.
+		 * @param dependencies The modules that have to be loaded before the module is started. The storage must outlive the ModuleManager.
+		 * @param tick How the module ticks or nullptr if it does not tick. The storage must outlive the ModuleManager.
+		 * @param services The services the module provides or nullptr if it provides none. The storage must outlive the ModuleManager.
+		 * @return True if the module has been registered, false if it was already registered.
+		 */
+		bool RegisterDynamicModule(const ModuleInfo& info, const std::string& library_path, absl::Span<const ModuleInfo> dependencies = {},
+			const ModuleTickSettings* tick = nullptr, const ModuleServiceSettings* services = nullptr)
+		{
+			std::shared_ptr<DynamicallyLinkedModule> dynamic_module = std::make_shared<DynamicallyLinkedModule>(info, library_path);
+			return RegisterModule([dynamic_module]() -> std::shared_ptr<ModuleInterface>
+				{
+					return dynamic_module->CreateModuleInterface();
+				}, info, dependencies, tick, services);
 		}
 
 		template<typename Module>
-		inline bool RegisterModule(std::function<std::shared_ptr<ModuleInterface>()> module_creator_function = []() -> std::shared_ptr<ModuleInterface>
-			{ 
-				return StaticallyLinkedModuleCreator<Module>::CreateModuleInterface(); 
-			}, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		inline bool RegisterDynamicModule(const std::string& library_path, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
 		{
 			// Required that Module is derived from ModuleInterface.
 			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
 
-			return RegisterModule(module_creator_function, info);
+			return RegisterDynamicModule(info, library_path, ModuleDependencies<Module>::type::Infos(), ModuleTickTraits<Module>::Settings(),
+				ModuleServiceTraits<Module>::Settings());
 		}
 
+		/**
+		 * Loads a module.
+		 * Declared dependencies that are not loaded yet are loaded first, on the calling thread.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module and all its dependencies have been loaded, false otherwise.
+		 */
 		bool LoadModule(const ModuleInfo& info)
 		{
 			if (IsModuleLoaded(info))
 			{
-				LOG(ERROR) << "The module: " << info.ModuleName() << " is already loaded";
-				return false;
-			}
-
-			if (!IsModuleRegistered(info))
-			{
-				LOG(ERROR) << "The module: " << info.ModuleName() << " is not registered and cannot be loaded";
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is already loaded";
 				return false;
 			}
 
-			m_statically_registered_modules_mutex.ReaderLock();
-			std::shared_ptr<ModuleInterface> module_ptr = m_statically_registered_modules.at(info)();
-			m_statically_registered_modules_mutex.ReaderUnlock();
-
-			module_ptr->OnStartupModule();
-
-			m_modules_mutex.Lock();
-			m_modules.emplace(info, module_ptr);
-			m_modules_mutex.Unlock();
-			return true;
+			return LoadModuleIfNeeded(info);
 		}
 
 		template<typename Module>
@@ -192,135 +425,1901 @@ namespace fkleafs
 			return LoadModule(info);
 		}
 
-		bool UnloadModule(const ModuleInfo& info)
+		/**
+		 * Loads a module by the name it has been registered under, see FindModuleInfo.
+		 *
+		 * @param name The name of the module, for example read from a config file.
+		 * @return True if the module and all its dependencies have been loaded, false otherwise.
+		 */
+		bool LoadModule(std::string_view name)
 		{
-			if (!IsModuleLoaded(info))
+			ModuleInfo info = ModuleInfo::FromName(std::string_view());
+			if (!FindModuleInfo(name, info))
 			{
-				LOG(ERROR) << "The module: " << info.ModuleName() << " is not loaded and cannot be unloaded";
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "No module is registered under the name: " << name;
 				return false;
 			}
+			return LoadModule(info);
+		}
 
-			m_modules_mutex.Lock();
-			m_modules.at(info)->OnShutdownModule();
-			m_modules.erase(info);
-			m_modules_mutex.Unlock();
+		/**
+		 * Loads a batch of modules by name as a single transaction, see LoadModules.
+		 * Fails without loading anything if a name is unknown.
+		 *
+		 * @param names The names of the modules.
+		 * @return True if all modules are loaded, false otherwise.
+		 */
+		bool LoadModulesByName(absl::Span<const std::string_view> names);
 
-			return true;
+		/**
+		 * Resolves the name of a module.
+		 * Statically registered modules are found by the name declared with FKL_REGISTER_NAMED_MODULE, or by their type name,
+		 * through a perfect hash built when the ModuleFactoryTable is sealed. Modules registered at runtime are found by the name of their info.
+		 * Neither allocates.
+		 *
+		 * @param name The name of the module.
+		 * @param info Receives the module info of the registration, its name outlives the given name.
+		 * @return True if a module is registered under the name, false otherwise.
+		 */
+		bool FindModuleInfo(std::string_view name, ModuleInfo& info) const
+		{
+			const ModuleFactory* factory = ModuleFactoryTable::Get().FindByName(name);
+			if (factory != nullptr)
+			{
+				info = factory->info;
+				return true;
+			}
+
+			// The info of the registration is returned, the given name may not outlive the call.
+			const RegistryShard& shard = GetShard(ModuleInfo::FromName(name));
+			shard.registered_modules_mutex.ReaderLock();
+			const auto iterator = shard.registered_modules.find(ModuleInfo::FromName(name));
+			const bool registered = iterator != shard.registered_modules.end();
+			if (registered)
+			{
+				info = iterator->first;
+			}
+			shard.registered_modules_mutex.ReaderUnlock();
+			return registered;
 		}
 
-		template<typename Module>
-		bool UnloadModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
-		{
-			// Required that Module is derived from ModuleInterface.
-			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+		/**
+		 * Loads a batch of modules and their dependencies as a single transaction.
+		 * The whole batch is validated up front, the modules are created and started in parallel on the pool
+		 * and published to the registry in one step once all of them have been started.
+		 * Other threads never observe a partially loaded batch, loading a module of the batch waits until the batch is published.
+		 * If any module fails, all started modules of the batch are shut down again and nothing is published.
+		 * Modules of the batch can access the modules of the batch they declared as dependencies during OnStartupModule.
+		 *
+		 * @param infos The module infos of the modules to load.
+		 * @param pool The pool to create and start the modules on.
+		 * @return True if all modules are loaded, false if the batch has been rolled back.
+		 */
+		bool LoadModules(absl::Span<const ModuleInfo> infos, ThreadPool& pool);
 
-			return UnloadModule(info);
+		bool LoadModules(absl::Span<const ModuleInfo> infos)
+		{
+			return LoadModules(infos, GetThreadPool());
 		}
 
-		std::weak_ptr<ModuleInterface> GetModuleInterfacePtr(const ModuleInfo& info)
+		template<typename... Modules>
+		bool LoadModules()
 		{
-			if (!IsModuleLoaded(info))
-			{
-				LOG(ERROR) << "The module: " << info.ModuleName() << " is not loaded";
+			return LoadModules(ModuleDependencyList<Modules...>::Infos());
+		}
 
-				// Try to recover from the error and attempt to load the module.
-				if (!LoadModule(info))
-				{
-					LOG(ERROR) << "Failed to load module: " << info.ModuleName() << ". Nullptr is returned";
-					return std::weak_ptr<ModuleInterface>();
-				}
-			}
+		/**
+		 * Loads a module and its dependencies on a thread pool without blocking the calling thread.
+		 * Waiting on the future from a worker of the same pool can dead lock a pool without idle workers,
+		 * such callers should poll the future and run ThreadPool::TryRunPendingTask in between.
+		 *
+		 * @param info The module info of the module.
+		 * @param pool The pool to run the construction and startup on.
+		 * @return Resolves to the handle of the module once it is loaded, or to an invalid handle if loading failed.
+		 */
+		std::future<ModuleHandle<ModuleInterface>> LoadModuleAsync(const ModuleInfo& info, ThreadPool& pool);
 
-			m_modules_mutex.ReaderLock();
-			std::weak_ptr<ModuleInterface> result = m_modules.at(info);
-			m_modules_mutex.ReaderUnlock();
-			return result;
+		std::future<ModuleHandle<ModuleInterface>> LoadModuleAsync(const ModuleInfo& info)
+		{
+			return LoadModuleAsync(info, GetThreadPool());
 		}
 
 		template<typename Module>
-		std::weak_ptr<ModuleInterface> GetModuleInterfacePtr(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		std::future<ModuleHandle<Module>> LoadModuleAsync(ThreadPool& pool, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
 		{
 			// Required that Module is derived from ModuleInterface.
 			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
 
-			return GetModuleInterfacePtr(info);
+			std::shared_ptr<std::promise<ModuleHandle<Module>>> promise = std::make_shared<std::promise<ModuleHandle<Module>>>();
+			std::future<ModuleHandle<Module>> future = promise->get_future();
+			pool.Schedule([this, promise, info]()
+				{
+					promise->set_value(LoadModuleIfNeeded(info) ? GetModuleHandle<Module>(info) : ModuleHandle<Module>());
+				});
+			return future;
 		}
 
 		template<typename Module>
-		std::weak_ptr<Module> GetModulePtr(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		std::future<ModuleHandle<Module>> LoadModuleAsync(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
 		{
-			// Required that Module is derived from ModuleInterface.
-			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+			return LoadModuleAsync<Module>(GetThreadPool(), info);
+		}
 
-			std::shared_ptr<ModuleInterface> module_ptr = GetModuleInterfacePtr(info).lock();
-			return std::static_pointer_cast<Module>(module_ptr);
+		/**
+		 * Loads modules and their dependencies in parallel.
+		 * Modules are started as soon as all their declared dependencies are started,
+		 * so independent OnStartupModule calls run concurrently on the pool.
+		 * Modules that are already loaded are skipped.
+		 *
+		 * @param infos The module infos of the modules to load.
+		 * @param pool The pool to run the startups on.
+		 * @return True if all modules are loaded, false otherwise.
+		 */
+		bool LoadModulesParallel(absl::Span<const ModuleInfo> infos, ThreadPool& pool);
+
+		bool LoadModulesParallel(absl::Span<const ModuleInfo> infos)
+		{
+			return LoadModulesParallel(infos, GetThreadPool());
 		}
 
-	private:
+		template<typename... Modules>
+		bool LoadModulesParallel()
+		{
+			return LoadModulesParallel(ModuleDependencyList<Modules...>::Infos());
+		}
 
 		/**
-		 * Hashmap that holds all modules.
-		 * We use the ModuleInfo class as keys.
+		 * Describes the modules that are loaded right now: the graph of their declared and observed dependencies
+		 * in topological order, the parallelization levels and the time every module took to start.
+		 * Attached modules are not part of the manifest, their owner starts them.
+		 *
+		 * @return The manifest.
+		 */
+		StartupManifest CreateStartupManifest() const;
+
+		/**
+		 * Writes the manifest of the modules that are loaded right now, see CreateStartupManifest.
+		 *
+		 * @param path The path of the manifest file.
+		 * @return True if the manifest has been written, false otherwise.
+		 */
+		bool WriteStartupManifest(const std::string& path) const
+		{
+			return CreateStartupManifest().Write(path);
+		}
+
+		/**
+		 * Loads modules and their dependencies for a cold boot.
+		 * If the manifest file has been written for the same registered modules, the startup is scheduled from it right away:
+		 * dependencies that were only observed during the previous boot are known upfront
+		 * and the modules on the longest chain of startup costs are started first.
+		 * If there is no manifest, or the registered modules or their declared dependencies have changed since it was written,
+		 * the modules are loaded like LoadModulesParallel does.
+		 * After a successful boot the manifest is rewritten with the startup costs of this boot.
+		 *
+		 * @param infos The modules to load.
+		 * @param manifest_path The path of the manifest file.
+		 * @param pool The pool to start the modules on.
+		 * @return True if all modules are loaded, false otherwise.
 		 */
-		absl::flat_hash_map<ModuleInfo, std::shared_ptr<ModuleInterface>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> m_modules;
+		bool BootModules(absl::Span<const ModuleInfo> infos, const std::string& manifest_path, ThreadPool& pool);
+
+		bool BootModules(absl::Span<const ModuleInfo> infos, const std::string& manifest_path)
+		{
+			return BootModules(infos, manifest_path, GetThreadPool());
+		}
 
 		/**
-		 * All registered modules.
-		 * NOTE: A module can be registered but no loaded.
+		 * Loads all registered modules in parallel.
+		 *
+		 * @return True if all registered modules are loaded, false otherwise.
 		 */
-		absl::flat_hash_map<ModuleInfo, std::function<std::shared_ptr<ModuleInterface>()>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> m_statically_registered_modules;
+		bool LoadAllModulesParallel();
 
 		/**
-		 * Mutex used to lock the m_modules variable.
+		 * Loads all registered modules phase by phase, see ModuleStartupPhase.
+		 * The critical phase is loaded in parallel on the pool before the call returns, see IsReady.
+		 * The default and then the background phase are loaded afterwards on background threads, see IsStartupComplete.
+		 * Modules registered at runtime belong to the default phase.
+		 * A module of a later phase that is looked up before it has been loaded is loaded right away on the looking up thread.
+		 *
+		 * @param pool The pool to load the critical phase on.
+		 * @param options The options of the background threads.
+		 * @return True if the critical phase has been loaded, false otherwise.
 		 */
-		mutable absl::Mutex m_modules_mutex;
+		bool StartupPhases(ThreadPool& pool, const PhasedStartupOptions& options = PhasedStartupOptions());
+
+		bool StartupPhases(const PhasedStartupOptions& options = PhasedStartupOptions())
+		{
+			return StartupPhases(GetThreadPool(), options);
+		}
 
 		/**
-		 * Mutex used to lock the m_statically_registered_modules variable.
+		 * Tests whether the critical phase of StartupPhases has been loaded.
+		 *
+		 * @return True if the critical phase has been loaded, false otherwise.
 		 */
-		mutable absl::Mutex m_statically_registered_modules_mutex;
-	};
+		bool IsReady() const
+		{
+			return m_phased_startup.ready.load(std::memory_order_acquire);
+		}
 
-	template<typename Module>
-	class StaticallyLinkedModuleCreator
-	{
-	public:
+		/**
+		 * Tests whether StartupPhases has finished all phases.
+		 *
+		 * @return True if the background threads are done, false otherwise.
+		 */
+		bool IsStartupComplete() const
+		{
+			return m_phased_startup.complete.load(std::memory_order_acquire);
+		}
 
-		static std::shared_ptr<ModuleInterface> CreateModuleInterface()
+		/**
+		 * Waits until StartupPhases has finished all phases.
+		 *
+		 * @param timeout The longest time to wait.
+		 * @return True if all modules of all phases have been loaded, false on failure or timeout.
+		 */
+		bool WaitForStartup(absl::Duration timeout = absl::InfiniteDuration());
+
+		/**
+		 * Ticks all loaded modules that declare FKL_MODULE_TICK, see ModuleTickSettings.
+		 * Tick groups run one after another, the modules of a group run in parallel on the pool
+		 * as far as their declared accesses allow. Returns once every module has ticked.
+		 * The schedule is computed once and reused until a module is loaded or unloaded.
+		 * Ticks are serialized, a concurrent call waits for the running tick to finish.
+		 * Modules that are being unloaded are skipped and an unload waits until a running OnTickModule of the module has returned,
+		 * so a tick never overlaps the shutdown of its module. OnTickModule must therefore not wait for a module
+		 * that is being unloaded, for example by loading or unloading it, since that unload may be waiting for the tick.
+		 * With instrumentation every OnTickModule is timed, see ModuleStatistics::tick_duration.
+		 *
+		 * @param delta_time The time since the previous tick in seconds, passed to every OnTickModule.
+		 * @param pool The pool to run the ticks on.
+		 */
+		void Tick(float delta_time, ThreadPool& pool);
+
+		void Tick(float delta_time)
 		{
-			return std::static_pointer_cast<ModuleInterface>(CreateModule());
+			Tick(delta_time, GetThreadPool());
 		}
 
-		static std::shared_ptr<Module> CreateModule()
+		/**
+		 * Getter for the event bus the modules of this manager communicate through.
+		 * Subscriptions of a module are removed when the module is unloaded, right before its OnShutdownModule.
+		 *
+		 * @return The event bus.
+		 */
+		EventBus& GetEventBus()
 		{
-			return std::make_shared<Module>();
+			return m_event_bus;
 		}
-	};
 
-	template<typename Module>
-	class StaticallyLinkedModuleRegistrant
-	{
-	public:
-		StaticallyLinkedModuleRegistrant()
+		/**
+		 * Getter for the thread pool of the module manager.
+		 * The pool is created on first use with one worker per hardware thread.
+		 *
+		 * @return The thread pool.
+		 */
+		ThreadPool& GetThreadPool()
 		{
-			ModuleManager::Get().RegisterModule<Module>();
+			absl::call_once(m_thread_pool_once, [this]()
+				{
+					m_thread_pool = std::make_unique<ThreadPool>();
+				});
+			return *m_thread_pool;
 		}
-	};
-}
 
-#define FKL_MODULE_INTERFACE public fkleafs::ModuleInterface
-#define FKL_MODULE_MANAGER() fkleafs::ModuleManager::Get()
-#define FKL_REGISTER_MODULE(ModuleType) \
-	namespace \
-	{ \
-		fkleafs::StaticallyLinkedModuleRegistrant<ModuleType> statically_linked_module_registrant_##ModuleType; \
-	}
-#define FKL_REQUIRE_MODULE(ModuleType) FKL_MODULE_MANAGER().LoadModule<ModuleType>()
-#define FKL_INJECT_MODULE(ModuleType, GetterName) \
-	std::weak_ptr<ModuleType> GetterName() const \
+		/**
+		 * Gives a module its own serial executor, meant to be called from OnStartupModule of the module:
+		 *
+		 *     void OnStartupModule() override
+		 *     {
+		 *         ModuleManager::Of(*this).CreateModuleExecutor(*this, { ModuleExecutorKind::kPinnedThread, 3 });
+		 *     }
+		 *
+		 * Functions posted to the module with Post or Call run on the executor one after another,
+		 * so state that is only touched by them needs no locks. The executor is drained and stopped
+		 * before OnShutdownModule, posts that arrive afterwards are rejected.
+		 * Replicated modules run the functions on the module itself, not on the replicas.
+		 *
+		 * @param module The module, before it has been published.
+		 * @param options The options of the executor.
+		 * @return True if the executor has been created, false if the module already has one.
+		 */
+		bool CreateModuleExecutor(ModuleInterface& module, const ModuleExecutorOptions& options = ModuleExecutorOptions());
+
+		/**
+		 * Runs a function on the executor of a loaded module, see CreateModuleExecutor.
+		 * The module is not loaded on demand, the function keeps it alive until it has run.
+		 *
+		 * @tparam Module The module.
+		 * @param function The function, invoked with the module. Must be copy constructible.
+		 * @param info The module info of the module.
+		 * @return True if the function has been queued, false if the module is not loaded, has no executor or is shutting down.
+		 */
+		template<typename Module, typename Function>
+		bool Post(Function&& function, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			std::shared_ptr<ModuleInterface> module_ptr = FindModuleWithExecutor(info);
+			if (module_ptr == nullptr)
+			{
+				return false;
+			}
+
+			ModuleExecutor& executor = *module_ptr->m_executor;
+			if (!executor.Post([module_ptr = std::move(module_ptr), function = std::forward<Function>(function)]() mutable
+				{
+					function(static_cast<Module&>(*module_ptr));
+				}))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is shutting down and does not accept calls";
+				return false;
+			}
+			return true;
+		}
+
+		/**
+		 * Runs a function on the executor of a loaded module and returns its result, see Post.
+		 * A call from a function that already runs on the executor of the module is run inline.
+		 * Threads of the thread pool that wait on the future of a strand should run ThreadPool::TryRunPendingTask in between.
+		 *
+		 * @tparam Module The module.
+		 * @param function The function, invoked with the module.
+		 * @param info The module info of the module.
+		 * @return The future of the result, or an invalid future if the function has not been queued.
+		 */
+		template<typename Module, typename Function>
+		std::future<std::invoke_result_t<Function&, Module&>> Call(Function&& function, const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			using Result = std::invoke_result_t<Function&, Module&>;
+
+			std::shared_ptr<ModuleInterface> module_ptr = FindModuleWithExecutor(info);
+			if (module_ptr == nullptr)
+			{
+				return std::future<Result>();
+			}
+
+			ModuleExecutor& executor = *module_ptr->m_executor;
+			const auto task = std::make_shared<std::packaged_task<Result()>>([module_ptr, function = std::forward<Function>(function)]() mutable
+				{
+					return function(static_cast<Module&>(*module_ptr));
+				});
+			std::future<Result> result = task->get_future();
+
+			// Waiting for a queued function on the executor itself would never return.
+			if (executor.IsCurrent())
+			{
+				(*task)();
+				return result;
+			}
+
+			if (!executor.Post([task]() { (*task)(); }))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is shutting down and does not accept calls";
+				return std::future<Result>();
+			}
+			return result;
+		}
+
+		/**
+		 * Publishes a module that is owned and started by the caller, for example by a ModuleSet.
+		 * The module can be looked up like any loaded module, but the module manager never shuts it down:
+		 * UnloadModule refuses attached modules and TearDown only detaches them.
+		 * Shared pointers obtained for an attached module do not own it and must not outlive it.
+		 *
+		 * @param info The module info of the module.
+		 * @param module The started module.
+		 * @return True if the module has been attached, false if a module with the same info is already loaded.
+		 */
+		bool AttachModule(const ModuleInfo& info, ModuleInterface& module);
+
+		/**
+		 * Removes an attached module from the registry without shutting it down.
+		 * Lookups that are still in flight may use the module until the epoch domain has been synchronized.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module has been detached, false if it is not attached.
+		 */
+		bool DetachModule(const ModuleInfo& info);
+
+		/**
+		 * Getter for the arena modules with the ArenaModuleAllocation policy are placed in.
+		 * The arena is released in bulk by TearDown once all modules allocated in it have been destroyed.
+		 *
+		 * @return The module arena.
+		 */
+		ModuleArena& GetModuleArena()
+		{
+			return m_module_arena;
+		}
+
+		/**
+		 * Getter for the arena modules with the InterleavedModuleAllocation policy are placed in.
+		 * Its pages are interleaved across all NUMA nodes.
+		 *
+		 * @return The interleaved module arena.
+		 */
+		ModuleArena& GetInterleavedModuleArena()
+		{
+			return m_interleaved_module_arena;
+		}
+
+		/**
+		 * Getter for the arena of a NUMA node, modules with the ReplicatedModuleAllocation policy and their replicas are placed in.
+		 * The arenas of all nodes are created on first use.
+		 *
+		 * @param node The node, less than NumaTopology::NodeCount.
+		 * @return The arena of the node.
+		 */
+		ModuleArena& GetNumaModuleArena(std::uint32_t node);
+
+		/**
+		 * Shuts down and unloads a module.
+		 * Waits if the module is currently being loaded or unloaded by another thread.
+		 * OnShutdownModule runs without the registry being locked and the module stays published meanwhile,
+		 * so lookups of other threads may still reach it while it shuts down. Ticks skip it, a running tick is waited for, see Tick.
+		 * Only the latch holders are serialized against the shutdown: loads, unloads, reloads and TearDown of the module.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module has been unloaded, false if it was not loaded.
+		 */
+		bool UnloadModule(const ModuleInfo& info);
+
+		template<typename Module>
+		bool UnloadModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return UnloadModule(info);
+		}
+
+		/**
+		 * Replaces a loaded module with a new instance without unloading it.
+		 * The new instance is created from the registration of the module, a module that lives in a shared library
+		 * is created from the library that is currently on disk, next to the library of the running instance.
+		 * The new instance takes over the state of the running instance in OnReloadModule and is started,
+		 * then it atomically replaces the running instance in the registry and the running instance is shut down.
+		 * The running instance is destroyed once no reader can use it anymore.
+		 * Handles stay valid and resolve to the new instance, their generation changes.
+		 * Waits if the module is currently being loaded or unloaded by another thread.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module has been replaced, false if it was not loaded or the new instance could not be created.
+		 */
+		bool ReloadModule(const ModuleInfo& info);
+
+		template<typename Module>
+		bool ReloadModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return ReloadModule(info);
+		}
+
+		/**
+		 * Shuts down and unloads a batch of modules as a single transaction.
+		 * Fails without unloading anything unless all modules are loaded.
+		 * Modules of the batch are shut down after the modules of the batch that depend on them,
+		 * they stay visible until all of them have been shut down and are removed from the registry in one step.
+		 *
+		 * @param infos The module infos of the modules to unload.
+		 * @return True if the modules have been unloaded, false otherwise.
+		 */
+		bool UnloadModules(absl::Span<const ModuleInfo> infos);
+
+		template<typename... Modules>
+		bool UnloadModules()
+		{
+			return UnloadModules(ModuleDependencyList<Modules...>::Infos());
+		}
+
+		std::weak_ptr<ModuleInterface> GetModuleInterfacePtr(const ModuleInfo& info)
+		{
+			m_instrumentation.RecordLookup(info);
+
+			std::weak_ptr<ModuleInterface> result = FindModule(info);
+			if (!result.expired())
+			{
+				return result;
+			}
+
+			bool staged = false;
+			std::shared_ptr<ModuleInterface> staged_module;
+			if (!LoadMissingModule(info, staged, staged_module))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "Failed to load module: " << info.ModuleName() << ". Nullptr is returned";
+				return std::weak_ptr<ModuleInterface>();
+			}
+			if (staged)
+			{
+				return staged_module;
+			}
+
+			return FindModule(info);
+		}
+
+		template<typename Module>
+		std::weak_ptr<ModuleInterface> GetModuleInterfacePtr(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return GetModuleInterfacePtr(info);
+		}
+
+		/**
+		 * Returns a loaded module, without loading it and without logging, for probing optional modules on hot paths.
+		 * Misses are reported with a status code only, without a message, so a miss does not allocate either.
+		 *
+		 * @param info The module info of the module.
+		 * @return The module, or kNotFound if the module is not loaded.
+		 */
+		template<typename Module>
+		absl::StatusOr<std::shared_ptr<Module>> TryGetModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			m_instrumentation.RecordLookup(info);
+			std::shared_ptr<ModuleInterface> module_ptr = FindModule(info).lock();
+			if (module_ptr == nullptr)
+			{
+				bool staged = false;
+				module_ptr = FindStagedModule(info, staged);
+				if (module_ptr == nullptr)
+				{
+					return absl::Status(absl::StatusCode::kNotFound, absl::string_view());
+				}
+			}
+			return std::shared_ptr<Module>(module_ptr, static_cast<Module*>(module_ptr->GetLocalReplica()));
+		}
+
+		/**
+		 * Returns a module, loading it if it is registered and not loaded yet.
+		 * Unlike GetModulePtr a missing registration is reported without logging and without a load attempt.
+		 *
+		 * @param info The module info of the module.
+		 * @return The module, kNotFound if the module is not registered or has been unloaded right away by another thread,
+		 * or kInternal if the module or one of its dependencies failed to load.
+		 */
+		template<typename Module>
+		absl::StatusOr<std::shared_ptr<Module>> TryLoadModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			absl::StatusOr<std::shared_ptr<Module>> module_ptr = TryGetModule<Module>(info);
+			if (module_ptr.ok())
+			{
+				return module_ptr;
+			}
+			if (!IsModuleRegistered(info))
+			{
+				return absl::Status(absl::StatusCode::kNotFound, absl::string_view());
+			}
+
+			// The loader logs why a load failed, that is an error of the module and not a miss.
+			if (!LoadModuleIfNeeded(info))
+			{
+				return absl::Status(absl::StatusCode::kInternal, absl::string_view());
+			}
+			return TryGetModule<Module>(info);
+		}
+
+		/**
+		 * Returns a module by the name it has been registered under, loading it if it is not loaded yet, see FindModuleInfo.
+		 *
+		 * @param name The name of the module.
+		 * @return The module or an empty pointer if no module is registered under the name or it could not be loaded.
+		 */
+		std::weak_ptr<ModuleInterface> GetModule(std::string_view name)
+		{
+			ModuleInfo info = ModuleInfo::FromName(std::string_view());
+			if (!FindModuleInfo(name, info))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "No module is registered under the name: " << name;
+				return std::weak_ptr<ModuleInterface>();
+			}
+			return GetModuleInterfacePtr(info);
+		}
+
+		template<typename Module>
+		std::weak_ptr<Module> GetModulePtr(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			// Replicated modules resolve to the replica on the node of the calling thread, which shares the lifetime of the module.
+			std::shared_ptr<ModuleInterface> module_ptr = GetModuleInterfacePtr(info).lock();
+			if (module_ptr == nullptr)
+			{
+				return std::weak_ptr<Module>();
+			}
+			return std::shared_ptr<Module>(module_ptr, static_cast<Module*>(module_ptr->GetLocalReplica()));
+		}
+
+		/**
+		 * Returns the loaded provider of a service interface with the highest priority, see FKL_MODULE_SERVICES.
+		 * Providers are resolved when modules are loaded or unloaded, the lookup itself indexes a flat table without locking.
+		 *
+		 * @tparam Service The service interface.
+		 * @return The service or an empty pointer if no loaded module provides it.
+		 */
+		template<typename Service>
+		std::weak_ptr<Service> GetService() const
+		{
+			static const std::uint32_t service_index = GetServiceIndex(ServiceInfo::GetServiceInfo<Service>());
+
+			EpochGuard guard;
+			const ServiceTable& services = *m_services.load(std::memory_order_acquire);
+			if (service_index >= services.size() || services[service_index].empty())
+			{
+				return std::weak_ptr<Service>();
+			}
+			const ServiceProvider& provider = services[service_index].front();
+			return std::shared_ptr<Service>(provider.module, static_cast<Service*>(provider.service));
+		}
+
+		/**
+		 * Returns all loaded providers of a service interface, highest priority first.
+		 *
+		 * @tparam Service The service interface.
+		 * @return The services.
+		 */
+		template<typename Service>
+		std::vector<std::shared_ptr<Service>> GetAllServices() const
+		{
+			static const std::uint32_t service_index = GetServiceIndex(ServiceInfo::GetServiceInfo<Service>());
+
+			std::vector<std::shared_ptr<Service>> result;
+			EpochGuard guard;
+			const ServiceTable& services = *m_services.load(std::memory_order_acquire);
+			if (service_index < services.size())
+			{
+				result.reserve(services[service_index].size());
+				for (const ServiceProvider& provider : services[service_index])
+				{
+					result.emplace_back(provider.module, static_cast<Service*>(provider.service));
+				}
+			}
+			return result;
+		}
+
+		/**
+		 * Pins a module, loading it if it is not loaded yet.
+		 * Unlike GetModulePtr the access does not touch the reference count of the module,
+		 * an unload while the pin exists defers the destruction of the module until the pin is released.
+		 * Inside a batch, siblings of the batch resolve to their staged instance like in GetModulePtr,
+		 * such pins must be released before the startup that created them returns.
+		 *
+		 * @param info The module info of the module.
+		 * @return The pinned module or an empty pin if the module could not be loaded.
+		 */
+		template<typename Module>
+		PinnedModule<Module> PinModule(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			ModuleInterface* module = EnterAndFindModule(info);
+			if (module == nullptr)
+			{
+				// Loading happens outside of the critical section, startups may take long.
+				bool staged = false;
+				std::shared_ptr<ModuleInterface> staged_module;
+				if (!LoadMissingModule(info, staged, staged_module))
+				{
+					LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "Failed to load module: " << info.ModuleName() << ". An empty pin is returned";
+					return PinnedModule<Module>();
+				}
+				if (staged)
+				{
+					if (staged_module == nullptr)
+					{
+						return PinnedModule<Module>();
+					}
+
+					// The batch owns its staged modules until it has finished, the pin only enters the critical section it releases.
+					EpochDomain::Get().Enter();
+					return PinnedModule<Module>(static_cast<Module*>(staged_module->GetLocalReplica()));
+				}
+
+				module = EnterAndFindModule(info);
+				if (module == nullptr)
+				{
+					return PinnedModule<Module>();
+				}
+			}
+			return PinnedModule<Module>(static_cast<Module*>(module->GetLocalReplica()));
+		}
+
+		/**
+		 * Returns a handle to a module.
+		 * The handle does not load the module, it reports nullptr until the module is loaded.
+		 * Obtain the handle once and keep it, resolving it is a single load plus a generation check.
+		 *
+		 * @param info The module info of the module.
+		 * @return The handle or an invalid handle if no slot could be assigned to the module.
+		 */
+		ModuleHandle<ModuleInterface> GetModuleInterfaceHandle(const ModuleInfo& info)
+		{
+			RegistryShard& shard = GetShard(info);
+			shard.mutex.Lock();
+			const std::uint32_t slot_index = AcquireModuleSlot(shard, info);
+			shard.mutex.Unlock();
+
+			if (slot_index == ModuleSlotArray::kInvalidIndex)
+			{
+				LOG(ERROR) << "No slot left for the module: " << info.ModuleName() << ". An invalid handle is returned";
+				return ModuleHandle<ModuleInterface>();
+			}
+			return ModuleHandle<ModuleInterface>(this, &m_module_slots[slot_index], slot_index, info);
+		}
+
+		template<typename Module>
+		ModuleHandle<Module> GetModuleHandle(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			const ModuleHandle<ModuleInterface> handle = GetModuleInterfaceHandle(info);
+			if (!handle.IsValid())
+			{
+				return ModuleHandle<Module>();
+			}
+			return ModuleHandle<Module>(this, handle.m_slot, handle.m_slot_index, info);
+		}
+
+		/**
+		 * Returns the lifecycle timings, lookup counts and mutex wait times recorded so far.
+		 * Empty unless the library is built with FKLEAFS_ENABLE_INSTRUMENTATION, see ModuleInstrumentation::kEnabled,
+		 * except for the memory statistics of the modules that have a memory resource.
+		 *
+		 * @return The instrumentation snapshot.
+		 */
+		InstrumentationSnapshot GetInstrumentationSnapshot() const;
+
+		/**
+		 * Starts recording the timeline of registrations, module creation, OnStartupModule and OnShutdownModule
+		 * and the waits on the registry mutexes, for WriteTrace.
+		 * Does nothing unless the library is built with FKLEAFS_ENABLE_INSTRUMENTATION, see ModuleTracer::kEnabled.
+		 * Modules registered statically are registered before any trace can start and do not show up.
+		 */
+		void StartTrace()
+		{
+			m_instrumentation.Tracer().Start();
+		}
+
+		/**
+		 * Stops recording the timeline, the recorded events can still be written.
+		 */
+		void StopTrace()
+		{
+			m_instrumentation.Tracer().Stop();
+		}
+
+		/**
+		 * Writes the timeline recorded since the last call in the Chrome trace event format,
+		 * open it with Perfetto or chrome://tracing.
+		 *
+		 * @param path The path of the trace file.
+		 * @return True if the trace has been written, false otherwise.
+		 */
+		bool WriteTrace(const std::string& path)
+		{
+			return m_instrumentation.Tracer().WriteChromeTrace(path);
+		}
+
+		/**
+		 * Returns the memory resource that accounts allocations to a module, creating it on first use.
+		 * Modules allocate through it, for example with std::pmr containers or the TrackedModuleAllocation policy,
+		 * and the usage is reported through GetInstrumentationSnapshot.
+		 * The resource lives as long as the module manager, memory allocated from it may outlive the module.
+		 *
+		 * @param info The module info of the module.
+		 * @return The memory resource of the module.
+		 */
+		ModuleMemoryResource& GetModuleMemoryResource(const ModuleInfo& info);
+
+		template<typename Module>
+		ModuleMemoryResource& GetModuleMemoryResource(const ModuleInfo info = ModuleInfo::GetModuleInfo<Module>())
+		{
+			// Required that Module is derived from ModuleInterface.
+			static_assert(std::is_base_of<ModuleInterface, Module>::value, "Any Module should be derived from ModuleInterface");
+
+			return GetModuleMemoryResource(info);
+		}
+
+		/**
+		 * Sets the memory budget of a module, see ModuleMemoryBudget.
+		 *
+		 * @param info The module info of the module.
+		 * @param budget The budget.
+		 */
+		void SetModuleMemoryBudget(const ModuleInfo& info, ModuleMemoryBudget budget)
+		{
+			GetModuleMemoryResource(info).SetBudget(std::move(budget));
+		}
+
+	private:
+		template<typename Module>
+		friend class ModuleHandle;
+
+		/**
+		 * Misses and failed preconditions of the lookup, load and unload functions are logged at most once per interval and call site,
+		 * so a caller that probes for optional modules does not pay for formatting and writing a log line on every miss.
+		 */
+		static constexpr double kMissLogIntervalSeconds = 1.0;
+
+		/**
+		 * Everything that is known about a registered module.
+		 */
+		struct RegisteredModule
+		{
+			/**
+			 * Creates the module, set for modules registered without a custom creator.
+			 */
+			ModuleCreateFunction create;
+
+			/**
+			 * Custom creator, only used if create is nullptr.
+			 */
+			std::function<std::shared_ptr<ModuleInterface>()> creator;
+
+			absl::Span<const ModuleInfo> dependencies;
+
+			/**
+			 * How the module ticks, nullptr if it does not tick.
+			 */
+			const ModuleTickSettings* tick = nullptr;
+
+			/**
+			 * The services the module provides, nullptr if it provides none.
+			 */
+			const ModuleServiceSettings* services = nullptr;
+
+			/**
+			 * Replicates the module onto the NUMA nodes, nullptr if the module is not replicated.
+			 */
+			ModuleReplicateFunction replicate = nullptr;
+
+			std::shared_ptr<ModuleInterface> Create() const
+			{
+				return create != nullptr ? create() : creator();
+			}
+		};
+
+		/**
+		 * Registers a module at runtime.
+		 *
+		 * @param info The module info of the module.
+		 * @param registration The registration of the module.
+		 * @return True if the module has been registered, false if it was already registered.
+		 */
+		bool RegisterModule(const ModuleInfo& info, RegisteredModule registration)
+		{
+			if (IsModuleRegistered(info))
+			{
+				LOG(ERROR) << "The module: " << info.ModuleName() << " is already registered";
+				return false;
+			}
+
+			RegistryShard& shard = GetShard(info);
+			shard.registered_modules_mutex.Lock();
+			const bool registered = shard.registered_modules.emplace(info, std::move(registration)).second;
+			shard.registered_modules_mutex.Unlock();
+			if (!registered)
+			{
+				LOG(ERROR) << "The module: " << info.ModuleName() << " is already registered";
+				return false;
+			}
+			m_instrumentation.Tracer().RecordInstant(TraceEventType::kRegistration, info.ModuleName());
+			return true;
+		}
+
+		/**
+		 * Looks up a registered module in the ModuleFactoryTable and in the modules registered at runtime.
+		 *
+		 * @param info The module info of the module.
+		 * @param registration Receives the registration of the module.
+		 * @return True if the module is registered, false otherwise.
+		 */
+		bool FindRegisteredModule(const ModuleInfo& info, RegisteredModule& registration) const
+		{
+			const ModuleFactory* factory = ModuleFactoryTable::Get().Find(info);
+			if (factory != nullptr)
+			{
+				registration = RegisteredModule{ factory->create, nullptr, factory->dependencies(), factory->tick(), factory->services(), factory->replicate };
+				return true;
+			}
+
+			const RegistryShard& shard = GetShard(info);
+			shard.registered_modules_mutex.ReaderLock();
+			const auto iterator = shard.registered_modules.find(info);
+			const bool registered = iterator != shard.registered_modules.end();
+			if (registered)
+			{
+				registration = iterator->second;
+			}
+			shard.registered_modules_mutex.ReaderUnlock();
+			return registered;
+		}
+
+		/**
+		 * Copies a started module onto every other NUMA node if its allocation policy replicates it.
+		 * Must be called before the module is published, the replicas are not modified afterwards.
+		 * Nodes whose replica cannot be created fall back to the module itself.
+		 *
+		 * @param info The module info of the module.
+		 * @param registration The registration of the module.
+		 * @param module The started module.
+		 */
+		void ReplicateModule(const ModuleInfo& info, const RegisteredModule& registration, ModuleInterface& module);
+
+		/**
+		 * Returns a loaded or staged module that has an executor, logging why if there is none.
+		 *
+		 * @param info The module info of the module.
+		 * @return The module or nullptr.
+		 */
+		std::shared_ptr<ModuleInterface> FindModuleWithExecutor(const ModuleInfo& info)
+		{
+			std::shared_ptr<ModuleInterface> module_ptr = FindModule(info).lock();
+			if (module_ptr == nullptr)
+			{
+				bool staged = false;
+				module_ptr = FindStagedModule(info, staged);
+			}
+			if (module_ptr == nullptr)
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is not loaded";
+				return nullptr;
+			}
+			if (module_ptr->m_executor == nullptr)
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " has no executor";
+				return nullptr;
+			}
+			return module_ptr;
+		}
+
+		/**
+		 * Drains and stops the executor of a module before it is shut down, see CreateModuleExecutor.
+		 *
+		 * @param module The module.
+		 */
+		static void StopModuleExecutor(ModuleInterface& module)
+		{
+			if (module.m_executor != nullptr)
+			{
+				module.m_executor->Stop();
+			}
+		}
+
+		/**
+		 * A module that is part of a startup.
+		 */
+		struct StartupNode
+		{
+			ModuleInfo info;
+			RegisteredModule registration;
+
+			/**
+			 * Indices of the nodes that depend on this node.
+			 */
+			std::vector<std::size_t> dependents;
+
+			/**
+			 * Number of dependencies that are part of the same startup.
+			 */
+			std::size_t dependency_count;
+
+			/**
+			 * Startup cost of the node and the longest chain of its dependents, known from a startup manifest.
+			 * Ready nodes with a longer critical path are started first.
+			 */
+			absl::Duration critical_path_cost;
+		};
+
+		/**
+		 * Outcome of acquiring the latch of a module slot.
+		 */
+		enum class ModuleLatchResult
+		{
+			/**
+			 * The calling thread owns the transition and has to release the latch.
+			 */
+			kAcquired,
+
+			/**
+			 * The module already is in the requested state.
+			 */
+			kAlreadyDone,
+
+			/**
+			 * The calling thread already owns a transition of the module, waiting would dead lock.
+			 */
+			kRecursive
+		};
+
+		/**
+		 * Acquires the latch of a slot to load the module.
+		 * Waits while another thread loads or unloads the module.
+		 *
+		 * @param slot The slot of the module.
+		 * @return kAcquired if the calling thread has to load the module, kAlreadyDone if the module is loaded.
+		 */
+		static ModuleLatchResult AcquireLoadLatch(ModuleSlot& slot);
+
+		/**
+		 * Acquires the latch of a slot to unload the module.
+		 * Waits while another thread loads or unloads the module, and until a tick of the module on another thread has returned.
+		 *
+		 * @param slot The slot of the module.
+		 * @return kAcquired if the calling thread has to unload the module, kAlreadyDone if the module is not loaded.
+		 */
+		static ModuleLatchResult AcquireUnloadLatch(ModuleSlot& slot);
+
+		/**
+		 * Ends the transition owned by the calling thread and wakes up the threads waiting on the slot.
+		 *
+		 * @param slot The slot of the module.
+		 * @param state The new state of the module.
+		 */
+		static void ReleaseLatch(ModuleSlot& slot, ModuleSlotState state);
+
+		/**
+		 * Returns the slot of a module, assigning a new slot on first use.
+		 *
+		 * @param info The module info of the module.
+		 * @return The slot or nullptr if all slots are in use.
+		 */
+		ModuleSlot* GetModuleSlot(const ModuleInfo& info)
+		{
+			RegistryShard& shard = GetShard(info);
+			shard.mutex.Lock();
+			const std::uint32_t slot_index = AcquireModuleSlot(shard, info);
+			shard.mutex.Unlock();
+
+			if (slot_index == ModuleSlotArray::kInvalidIndex)
+			{
+				LOG(ERROR) << "No slot left for the module: " << info.ModuleName();
+				return nullptr;
+			}
+			return &m_module_slots[slot_index];
+		}
+
+		/**
+		 * Loads a module and its dependencies unless it is loaded already.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module is loaded, false otherwise.
+		 */
+		bool LoadModuleIfNeeded(const ModuleInfo& info)
+		{
+			bool staged = false;
+			const std::shared_ptr<ModuleInterface> staged_module = FindStagedModule(info, staged);
+			if (staged)
+			{
+				return staged_module != nullptr;
+			}
+
+			std::vector<StartupNode> nodes;
+			if (!BuildStartupGraph(absl::MakeConstSpan(&info, 1), nodes))
+			{
+				return false;
+			}
+			return RunStartupGraph(std::move(nodes), nullptr);
+		}
+
+		/**
+		 * Collects the modules and all their dependencies that are not loaded yet, in topological order.
+		 *
+		 * @param roots The modules to load.
+		 * @param nodes Receives the graph.
+		 * @return True if the graph is complete and acyclic, false otherwise.
+		 */
+		bool BuildStartupGraph(absl::Span<const ModuleInfo> roots, std::vector<StartupNode>& nodes);
+
+		/**
+		 * Collects the modules and all their dependencies that are not loaded yet from a startup manifest.
+		 *
+		 * @param manifest The manifest.
+		 * @param roots The modules to load.
+		 * @param nodes Receives the graph in the order of the manifest.
+		 * @param observed_dependencies Receives the dependencies of the graph that were observed during the boot that wrote the manifest.
+		 * @return True if the manifest matches the registered modules and contains all roots, false otherwise.
+		 */
+		bool BuildManifestStartupGraph(const StartupManifest& manifest, absl::Span<const ModuleInfo> roots, std::vector<StartupNode>& nodes,
+			std::vector<std::pair<ModuleInfo, ModuleInfo>>& observed_dependencies);
+
+		/**
+		 * Returns all registered modules, statically and at runtime.
+		 *
+		 * @return The module infos of all registered modules.
+		 */
+		std::vector<ModuleInfo> RegisteredModuleInfos() const;
+
+		/**
+		 * Returns a fingerprint of the registered modules and their declared dependencies.
+		 *
+		 * @return The fingerprint, independent of the registration order.
+		 */
+		std::uint64_t RegistryFingerprint() const;
+
+		/**
+		 * Creates, starts and publishes every module of a graph.
+		 * A module is only started if all its dependencies have been started successfully.
+		 *
+		 * @param nodes The graph built by BuildStartupGraph.
+		 * @param pool The pool to run on or nullptr to start the modules one after another on the calling thread.
+		 * @param batch The batch to stage the started modules in instead of publishing them, or nullptr.
+		 * @return True if all modules have been loaded, false otherwise.
+		 */
+		bool RunStartupGraph(std::vector<StartupNode> nodes, ThreadPool* pool, ModuleBatch* batch = nullptr);
+
+		/**
+		 * Looks up a module of the batch that is being loaded by the calling thread.
+		 *
+		 * @param info The module info of the module.
+		 * @param staged Set to true if the module is part of the batch.
+		 * @return The module or nullptr if it is not part of the batch or has not been started yet.
+		 */
+		std::shared_ptr<ModuleInterface> FindStagedModule(const ModuleInfo& info, bool& staged);
+
+		/**
+		 * Resolves a module that a lookup has missed, shared by GetModuleInterfacePtr and PinModule.
+		 * Modules of a batch that is being loaded by the calling thread are only visible to the modules of the batch and are returned staged.
+		 * Modules of the background phases are taken out of their queue and loaded ahead of it without logging a miss,
+		 * all other modules are reported as not loaded and loaded on demand.
+		 * Concurrent accessors of the same module wait for the first one, instead of creating the module twice.
+		 *
+		 * @param info The module info of the module.
+		 * @param staged Set to true if the module is part of the batch of the calling thread.
+		 * @param staged_module Set to the staged module, nullptr if it has not been started yet.
+		 * @return True if the module is staged or loaded, false if it could not be loaded.
+		 */
+		bool LoadMissingModule(const ModuleInfo& info, bool& staged, std::shared_ptr<ModuleInterface>& staged_module)
+		{
+			staged_module = FindStagedModule(info, staged);
+			if (staged)
+			{
+				return true;
+			}
+
+			if (!TakePhasedModule(info))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is not loaded";
+			}
+			return LoadModuleIfNeeded(info);
+		}
+
+		/**
+		 * Publishes all modules of a batch that have been started and releases their latches.
+		 *
+		 * @param batch The batch.
+		 */
+		void PublishBatch(ModuleBatch& batch);
+
+		/**
+		 * Shuts down all modules of a batch that have been started, in reverse order, and releases their latches.
+		 *
+		 * @param batch The batch.
+		 */
+		void RollbackBatch(ModuleBatch& batch);
+
+		/**
+		 * Removes a module that has been shut down from the registry and marks its slot as unloaded,
+		 * which ends an unload transition and wakes up threads waiting to load the module again.
+		 *
+		 * @param info The module info of the module.
+		 */
+		void UnpublishModule(const ModuleInfo& info)
+		{
+			RegistryShard& shard = GetShard(info);
+			shard.mutex.Lock();
+			ModuleMap* modules = new ModuleMap(*shard.modules.load(std::memory_order_relaxed));
+			const auto module_iterator = modules->find(info);
+			if (module_iterator != modules->end())
+			{
+				UpdateServices(info, module_iterator->second.get(), nullptr);
+				modules->erase(module_iterator);
+			}
+			UpdateModuleSlot(shard, info, nullptr);
+			const auto slot_iterator = shard.module_slot_indices.find(info);
+			if (slot_iterator != shard.module_slot_indices.end())
+			{
+				ReleaseLatch(m_module_slots[slot_iterator->second], ModuleSlotState::kUnloaded);
+			}
+			shard.observed_dependencies.erase(info);
+			shard.attached_modules.erase(info);
+			PublishModules(shard, modules);
+			shard.mutex.Unlock();
+
+			EpochDomain::Get().Reclaim();
+		}
+
+		/**
+		 * Records that a module has been used by another module while the other module was starting.
+		 *
+		 * @param module_info The module info of the starting module.
+		 * @param dependency The module info of the module it uses.
+		 */
+		void RecordObservedDependency(const ModuleInfo& module_info, const ModuleInfo& dependency)
+		{
+			RegistryShard& shard = GetShard(module_info);
+			shard.mutex.Lock();
+			shard.observed_dependencies[module_info].push_back(dependency);
+			shard.mutex.Unlock();
+		}
+
+		/**
+		 * Tests whether a module has been attached with AttachModule.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module is attached, false otherwise.
+		 */
+		bool IsModuleAttached(const ModuleInfo& info) const
+		{
+			const RegistryShard& shard = GetShard(info);
+			shard.mutex.Lock();
+			const bool attached = shard.attached_modules.contains(info);
+			shard.mutex.Unlock();
+			return attached;
+		}
+
+		/**
+		 * Creates and starts one module and publishes it to the registry.
+		 * The module is created exactly once, even if several threads start it concurrently.
+		 *
+		 * @param node The node of the module.
+		 * @param batch The batch that already owns the latch of the module and stages it, or nullptr to publish the module.
+		 * @return True if the module has been loaded, false otherwise.
+		 */
+		bool StartupModule(const StartupNode& node, ModuleBatch* batch = nullptr);
+
+		/**
+		 * Publishes a started module.
+		 *
+		 * @param info The module info of the module.
+		 * @param module_ptr The started module.
+		 */
+		void PublishModule(const ModuleInfo& info, const std::shared_ptr<ModuleInterface>& module_ptr)
+		{
+			RegistryShard& shard = GetShard(info);
+			shard.mutex.Lock();
+			ModuleMap* modules = new ModuleMap(*shard.modules.load(std::memory_order_relaxed));
+			if (modules->emplace(info, module_ptr).second)
+			{
+				UpdateModuleSlot(shard, info, module_ptr.get());
+				UpdateServices(info, nullptr, module_ptr);
+			}
+			PublishModules(shard, modules);
+			shard.mutex.Unlock();
+
+			EpochDomain::Get().Reclaim();
+		}
+
+		/**
+		 * Hashmap that holds all modules.
+		 * We use the ModuleInfo class as keys.
+		 */
+		using ModuleMap = absl::flat_hash_map<ModuleInfo, std::shared_ptr<ModuleInterface>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual>;
+
+		/**
+		 * Number of shards of the registry, see FKLEAFS_REGISTRY_SHARD_COUNT.
+		 */
+		static constexpr std::size_t kRegistryShardCount = FKLEAFS_REGISTRY_SHARD_COUNT;
+		static_assert(kRegistryShardCount > 0, "FKLEAFS_REGISTRY_SHARD_COUNT must be at least one");
+
+		/**
+		 * Part of the registry that holds all modules whose hash maps to it.
+		 * Every shard has its own locks, writers of different shards never wait for each other.
+		 * Aligned to a cache line, so that writers of neighbouring shards do not share cache lines.
+		 */
+		struct alignas(64) RegistryShard
+		{
+			RegistryShard()
+				: modules(new ModuleMap())
+			{
+			}
+
+			~RegistryShard()
+			{
+				delete modules.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * Immutable snapshot of the loaded modules of the shard.
+			 * Readers load the snapshot inside an EpochGuard and never lock,
+			 * writers copy the snapshot while holding mutex and publish the copy.
+			 * Replaced snapshots are reclaimed through the EpochDomain once no reader can observe them anymore.
+			 */
+			std::atomic<const ModuleMap*> modules;
+
+			/**
+			 * Incremented whenever a snapshot has been published, used to detect a stale tick plan.
+			 */
+			std::atomic<std::uint64_t> generation{ 0 };
+
+			/**
+			 * Maps modules to their index in m_module_slots.
+			 * Guarded by mutex.
+			 */
+			absl::flat_hash_map<ModuleInfo, std::uint32_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> module_slot_indices;
+
+			/**
+			 * Dependencies that have been observed because a module loaded another module inside its OnStartupModule,
+			 * for example through FKL_REQUIRE_MODULE, keyed by the loading module. Used to order the teardown.
+			 * Guarded by mutex.
+			 */
+			absl::flat_hash_map<ModuleInfo, std::vector<ModuleInfo>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> observed_dependencies;
+
+			/**
+			 * Loaded modules that are owned by somebody else, see AttachModule.
+			 * Guarded by mutex.
+			 */
+			absl::flat_hash_set<ModuleInfo, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> attached_modules;
+
+			/**
+			 * Time the construction and OnStartupModule of the modules took the last time they were loaded.
+			 * Guarded by mutex.
+			 */
+			absl::flat_hash_map<ModuleInfo, absl::Duration, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> startup_costs;
+
+			/**
+			 * Mutex used to serialize writers of modules.
+			 */
+			mutable InstrumentedMutex mutex;
+
+			/**
+			 * Modules registered at runtime, statically registered modules live in the ModuleFactoryTable.
+			 * NOTE: A module can be registered but no loaded.
+			 * Guarded by registered_modules_mutex.
+			 */
+			absl::flat_hash_map<ModuleInfo, RegisteredModule, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> registered_modules;
+			mutable InstrumentedMutex registered_modules_mutex;
+		};
+
+		/**
+		 * Looks up a loaded module without locking.
+		 *
+		 * @param info The module info of the module.
+		 * @return The module or an empty pointer if the module is not loaded.
+		 */
+		std::weak_ptr<ModuleInterface> FindModule(const ModuleInfo& info) const
+		{
+			EpochGuard guard;
+			const ModuleMap* modules = GetShard(info).modules.load(std::memory_order_acquire);
+			const auto iterator = modules->find(info);
+			if (iterator == modules->end())
+			{
+				return std::weak_ptr<ModuleInterface>();
+			}
+			return iterator->second;
+		}
+
+		/**
+		 * Enters an epoch critical section and looks up a loaded module.
+		 * The critical section is left again if the module is not loaded.
+		 * Retired snapshots keep their modules alive, so the module is not destroyed before the caller leaves the critical section.
+		 *
+		 * @param info The module info of the module.
+		 * @return The module or nullptr if the module is not loaded.
+		 */
+		ModuleInterface* EnterAndFindModule(const ModuleInfo& info) const
+		{
+			EpochDomain::Get().Enter();
+			const ModuleMap* modules = GetShard(info).modules.load(std::memory_order_acquire);
+			const auto iterator = modules->find(info);
+			if (iterator == modules->end())
+			{
+				EpochDomain::Get().Leave();
+				return nullptr;
+			}
+			return iterator->second.get();
+		}
+
+		/**
+		 * Returns the slot index of a module, assigning a new slot on first use.
+		 * The mutex of the shard must be held exclusively.
+		 *
+		 * @param shard The shard of the module.
+		 * @param info The module info of the module.
+		 * @return The slot index or ModuleSlotArray::kInvalidIndex if all slots are in use.
+		 */
+		std::uint32_t AcquireModuleSlot(RegistryShard& shard, const ModuleInfo& info)
+		{
+			const auto iterator = shard.module_slot_indices.find(info);
+			if (iterator != shard.module_slot_indices.end())
+			{
+				return iterator->second;
+			}
+
+			m_module_slots_mutex.Lock();
+			const std::uint32_t slot_index = m_module_slots.Allocate();
+			m_module_slots_mutex.Unlock();
+			if (slot_index == ModuleSlotArray::kInvalidIndex)
+			{
+				return slot_index;
+			}
+			shard.module_slot_indices.emplace(info, slot_index);
+
+			// The module may already be loaded, the slot has to reflect that.
+			const ModuleMap* modules = shard.modules.load(std::memory_order_relaxed);
+			const auto module_iterator = modules->find(info);
+			if (module_iterator != modules->end())
+			{
+				ModuleSlot& slot = m_module_slots[slot_index];
+				slot.module.store(module_iterator->second.get(), std::memory_order_release);
+				slot.generation.store(1, std::memory_order_release);
+				slot.state_mutex.Lock();
+				slot.state = ModuleSlotState::kLoaded;
+				slot.state_mutex.Unlock();
+			}
+			return slot_index;
+		}
+
+		/**
+		 * Updates the slot of a module after it has been loaded or unloaded.
+		 * Modules without a slot are skipped, the slot is filled once it is acquired.
+		 * The mutex of the shard must be held exclusively.
+		 *
+		 * @param shard The shard of the module.
+		 * @param info The module info of the module.
+		 * @param module The loaded module or nullptr if the module has been unloaded.
+		 */
+		void UpdateModuleSlot(RegistryShard& shard, const ModuleInfo& info, ModuleInterface* module)
+		{
+			const auto iterator = shard.module_slot_indices.find(info);
+			if (iterator == shard.module_slot_indices.end())
+			{
+				return;
+			}
+
+			// Replacing a module by another one keeps the generation odd.
+			ModuleSlot& slot = m_module_slots[iterator->second];
+			ModuleInterface* previous_module = slot.module.exchange(module, std::memory_order_acq_rel);
+			slot.generation.fetch_add(previous_module != nullptr && module != nullptr ? 2 : 1, std::memory_order_acq_rel);
+		}
+
+		/**
+		 * Returns the shard a module belongs to.
+		 *
+		 * @param info The module info of the module.
+		 * @return The shard of the module.
+		 */
+		RegistryShard& GetShard(const ModuleInfo& info)
+		{
+			return m_shards[info.ModuleHash() % kRegistryShardCount];
+		}
+
+		const RegistryShard& GetShard(const ModuleInfo& info) const
+		{
+			return m_shards[info.ModuleHash() % kRegistryShardCount];
+		}
+
+		/**
+		 * Replaces the current snapshot of a shard and retires the previous one.
+		 * The mutex of the shard must be held exclusively.
+		 *
+		 * @param shard The shard.
+		 * @param modules The new snapshot, ownership is transferred to the module manager.
+		 */
+		static void PublishModules(RegistryShard& shard, const ModuleMap* modules)
+		{
+			const ModuleMap* previous_modules = shard.modules.exchange(modules, std::memory_order_acq_rel);
+			shard.generation.fetch_add(1, std::memory_order_release);
+			EpochDomain::Get().Retire(previous_modules);
+		}
+
+		/**
+		 * A loaded module that provides a service.
+		 */
+		struct ServiceProvider
+		{
+			ModuleInfo info;
+			std::int32_t priority;
+			std::shared_ptr<ModuleInterface> module;
+
+			/**
+			 * The module converted to the service interface.
+			 */
+			void* service;
+		};
+
+		/**
+		 * Providers of every service, ordered by descending priority and name.
+		 */
+		using ServiceTable = std::vector<std::vector<ServiceProvider>>;
+
+		/**
+		 * Returns the dense index of a service, assigned process wide on first use.
+		 *
+		 * @param info The service info.
+		 * @return The index of the service in a ServiceTable.
+		 */
+		static std::uint32_t GetServiceIndex(const ServiceInfo& info);
+
+		/**
+		 * Replaces the services provided by an instance of a module.
+		 * The mutex of the shard of the module must be held exclusively, so updates of one module are ordered like its snapshots.
+		 *
+		 * @param info The module info of the module.
+		 * @param previous_module The instance that is no longer loaded, or nullptr.
+		 * @param module The instance that is now loaded, or nullptr.
+		 */
+		void UpdateServices(const ModuleInfo& info, const ModuleInterface* previous_module, const std::shared_ptr<ModuleInterface>& module);
+
+		/**
+		 * A ticking module within its tick group.
+		 */
+		struct TickNode
+		{
+			ModuleInfo info;
+
+			/**
+			 * Does not keep the module alive, the module is locked for the duration of a tick only.
+			 */
+			std::weak_ptr<ModuleInterface> module;
+
+			/**
+			 * The slot of the module, its state decides whether the module still ticks.
+			 */
+			ModuleSlot* slot;
+
+			/**
+			 * Indices of the nodes of the same group that tick after this node.
+			 */
+			std::vector<std::size_t> dependents;
+
+			/**
+			 * Number of nodes of the same group that tick before this node.
+			 */
+			std::size_t dependency_count;
+		};
+
+		/**
+		 * Cached schedule of Tick.
+		 */
+		struct TickPlan
+		{
+			/**
+			 * The tick groups in ascending order, empty groups are left out.
+			 */
+			std::vector<std::vector<TickNode>> groups;
+
+			/**
+			 * Generations of the shards the plan has been built from.
+			 */
+			std::array<std::uint64_t, kRegistryShardCount> generations;
+
+			bool built = false;
+		};
+
+		/**
+		 * State of the background phases of StartupPhases.
+		 */
+		struct PhasedStartup
+		{
+			absl::Mutex mutex;
+
+			/**
+			 * Modules of the background phases in loading order. Entries that have been taken are skipped.
+			 * Guarded by mutex.
+			 */
+			std::deque<ModuleInfo> queue;
+
+			/**
+			 * All modules of the background phases, mapped to true while they are queued.
+			 * Guarded by mutex.
+			 */
+			absl::flat_hash_map<ModuleInfo, bool, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> modules;
+
+			/**
+			 * Number of load tasks that have not finished yet.
+			 * Guarded by mutex.
+			 */
+			std::size_t remaining_tasks = 0;
+			bool failed = false;
+			bool stopping = false;
+
+			std::atomic<bool> ready{ false };
+			std::atomic<bool> complete{ false };
+
+			/**
+			 * Runs the load tasks. Its idle workers are kept until the next StartupPhases or TearDown.
+			 * Guarded by mutex.
+			 */
+			std::unique_ptr<ThreadPool> pool;
+		};
+
+		/**
+		 * Loads the next queued module of the background phases.
+		 */
+		void LoadNextPhasedModule();
+
+		/**
+		 * Takes a module of the background phases out of the queue, so the caller can load it right away.
+		 *
+		 * @param info The module info of the module.
+		 * @return True if the module belongs to a background phase that is still being loaded, false otherwise.
+		 */
+		bool TakePhasedModule(const ModuleInfo& info);
+
+		/**
+		 * Stops loading the background phases and waits for the module being loaded.
+		 */
+		void StopPhasedStartup();
+
+		/**
+		 * Tests whether the tick plan still matches the loaded modules.
+		 * m_tick_mutex must be held.
+		 *
+		 * @return True if no module has been published or unpublished since the plan has been built, false otherwise.
+		 */
+		bool IsTickPlanCurrent() const;
+
+		/**
+		 * Rebuilds the tick plan from the loaded modules.
+		 * m_tick_mutex must be held.
+		 */
+		void BuildTickPlan();
+
+		/**
+		 * Ticks the modules of a group, respecting the order of conflicting accesses.
+		 *
+		 * @param group The nodes of the group.
+		 * @param delta_time The time since the previous tick in seconds.
+		 * @param pool The pool to run the ticks on.
+		 */
+		void TickGroup(const std::vector<TickNode>& group, float delta_time, ThreadPool& pool);
+
+		std::array<RegistryShard, kRegistryShardCount> m_shards;
+
+		/**
+		 * Dense slots of all modules a handle has been requested for.
+		 * Slots are updated while the mutex of the shard of their module is held exclusively and read without locking.
+		 */
+		ModuleSlotArray m_module_slots;
+
+		/**
+		 * Serializes the allocation of slots of different shards.
+		 */
+		absl::Mutex m_module_slots_mutex;
+
+		/**
+		 * Events between the modules, see GetEventBus.
+		 */
+		EventBus m_event_bus;
+
+		/**
+		 * Memory resources of the modules, see GetModuleMemoryResource. Never removed before the manager is destroyed.
+		 */
+		mutable absl::Mutex m_memory_resources_mutex;
+		absl::flat_hash_map<ModuleInfo, std::unique_ptr<ModuleMemoryResource>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> m_memory_resources;
+
+		/**
+		 * Resolved providers of all services, indexed by GetServiceIndex, see GetService.
+		 * Replaced while m_services_mutex is held, which is only acquired while the mutex of a shard is held.
+		 */
+		std::atomic<const ServiceTable*> m_services{ new ServiceTable() };
+		absl::Mutex m_services_mutex;
+
+		/**
+		 * Serializes Tick and guards m_tick_plan.
+		 */
+		absl::Mutex m_tick_mutex;
+		TickPlan m_tick_plan;
+
+		/**
+		 * The default and background phases of StartupPhases that are still being loaded.
+		 */
+		PhasedStartup m_phased_startup;
+
+		/**
+		 * Memory of the modules that use the ArenaModuleAllocation policy.
+		 */
+		ModuleArena m_module_arena;
+
+		/**
+		 * Memory of the modules that use the InterleavedModuleAllocation policy.
+		 */
+		ModuleArena m_interleaved_module_arena;
+
+		/**
+		 * One arena per NUMA node for replicated modules, created by GetNumaModuleArena.
+		 */
+		std::unique_ptr<ModuleArena[]> m_numa_module_arenas;
+		absl::once_flag m_numa_module_arenas_once;
+
+		/**
+		 * Lifecycle timings and lookup counts, empty unless FKLEAFS_ENABLE_INSTRUMENTATION is defined.
+		 */
+		mutable ModuleInstrumentation m_instrumentation;
+
+		/**
+		 * Pool used for parallel startups, created by GetThreadPool.
+		 * Declared last, tasks on the pool release modules into the arenas above and record into the instrumentation.
+		 */
+		std::unique_ptr<ThreadPool> m_thread_pool;
+		absl::once_flag m_thread_pool_once;
+	};
+
+	template<typename Module>
+	std::shared_ptr<Module> ModuleHandle<Module>::Lock() const
+	{
+		if (m_manager == nullptr || !IsLoaded())
+		{
+			return std::shared_ptr<Module>();
+		}
+		const std::shared_ptr<ModuleInterface> module_ptr = m_manager->FindModule(m_info).lock();
+		if (module_ptr == nullptr)
+		{
+			return std::shared_ptr<Module>();
+		}
+		return std::shared_ptr<Module>(module_ptr, static_cast<Module*>(module_ptr->GetLocalReplica()));
+	}
+
+	template<typename Module>
+	class StaticallyLinkedModuleCreator
+	{
+	public:
+
+		static std::shared_ptr<ModuleInterface> CreateModuleInterface()
+		{
+			return std::static_pointer_cast<ModuleInterface>(CreateModule());
+		}
+
+		static std::shared_ptr<Module> CreateModule()
+		{
+			return ModuleAllocation<Module>::type::template Create<Module>(ModuleManager::Current());
+		}
+
+		static std::shared_ptr<ModuleInterface> ReplicateModuleInterface(const ModuleInterface& module, std::uint32_t node)
+		{
+			return std::static_pointer_cast<ModuleInterface>(ModuleAllocation<Module>::type::template Replicate<Module>(ModuleManager::Current(), static_cast<const Module&>(module), node));
+		}
+	};
+
+	template<typename Module>
+	std::shared_ptr<Module> ArenaModuleAllocation::Create(ModuleManager& manager)
+	{
+		return std::allocate_shared<Module>(ArenaAllocator<Module>(manager.GetModuleArena()));
+	}
+
+	template<typename Module>
+	std::shared_ptr<Module> TrackedModuleAllocation::Create(ModuleManager& manager)
+	{
+		return std::allocate_shared<Module>(std::pmr::polymorphic_allocator<Module>(&manager.GetModuleMemoryResource<Module>()));
+	}
+
+	template<typename Module>
+	std::shared_ptr<Module> InterleavedModuleAllocation::Create(ModuleManager& manager)
+	{
+		return std::allocate_shared<Module>(ArenaAllocator<Module>(manager.GetInterleavedModuleArena()));
+	}
+
+	template<typename Module>
+	std::shared_ptr<Module> ReplicatedModuleAllocation::Create(ModuleManager& manager)
+	{
+		return std::allocate_shared<Module>(ArenaAllocator<Module>(manager.GetNumaModuleArena(0)));
+	}
+
+	template<typename Module>
+	std::shared_ptr<Module> ReplicatedModuleAllocation::Replicate(ModuleManager& manager, const Module& module, std::uint32_t node)
+	{
+		// Required that the module can be copied onto the other nodes.
+		static_assert(std::is_copy_constructible<Module>::value, "Replicated modules must be copy constructible");
+
+		return std::allocate_shared<Module>(ArenaAllocator<Module>(manager.GetNumaModuleArena(node)), module);
+	}
+
+	/**
+	 * Registers a module during static initialization.
+	 * The factory lives inside the registrant and is linked into the ModuleFactoryTable without allocating or locking.
+	 *
+	 * @tparam Module The module.
+	 * @tparam Phase The startup phase of the module, see ModuleManager::StartupPhases.
+	 */
+	template<typename Module, ModuleStartupPhase Phase = ModuleStartupPhase::kDefault>
+	class StaticallyLinkedModuleRegistrant
+	{
+	public:
+		/**
+		 * Registers the module.
+		 *
+		 * @param name The stable name of the module or an empty name to use the type name. Must have static storage duration.
+		 */
+		explicit StaticallyLinkedModuleRegistrant(std::string_view name = std::string_view())
+			: m_factory(MakeModuleFactory<Module, StaticallyLinkedModuleCreator<Module>, Phase>(name))
+		{
+			// The table is sealed by the first lookup, later registrations go through the ModuleManager.
+			if (!ModuleFactoryTable::Add(m_factory))
+			{
+				if (!name.empty())
+				{
+					LOG(WARNING) << "The module: " << m_factory.info.ModuleName() << " has been registered after the first lookup, it cannot be looked up by the name: " << name;
+				}
+				ModuleManager::Get().RegisterModule<Module>();
+			}
+		}
+
+		StaticallyLinkedModuleRegistrant(const StaticallyLinkedModuleRegistrant&) = delete;
+		StaticallyLinkedModuleRegistrant& operator=(const StaticallyLinkedModuleRegistrant&) = delete;
+
+	private:
+		ModuleFactory m_factory;
+	};
+}
+
+#define FKL_MODULE_INTERFACE public fkleafs::ModuleInterface
+#define FKL_MODULE_MANAGER() fkleafs::ModuleManager::Current()
+#define FKL_REGISTER_MODULE(ModuleType) \
+	namespace \
+	{ \
+		fkleafs::StaticallyLinkedModuleRegistrant<ModuleType> statically_linked_module_registrant_##ModuleType; \
+	}
+#define FKL_REGISTER_MODULE_IN_PHASE(ModuleType, Phase) \
+	namespace \
+	{ \
+		fkleafs::StaticallyLinkedModuleRegistrant<ModuleType, fkleafs::ModuleStartupPhase::Phase> statically_linked_module_registrant_##ModuleType; \
+	}
+#define FKL_REGISTER_NAMED_MODULE(ModuleType, Name) \
+	namespace \
+	{ \
+		fkleafs::StaticallyLinkedModuleRegistrant<ModuleType> statically_linked_module_registrant_##ModuleType(Name); \
+	}
+#define FKL_REGISTER_NAMED_MODULE_IN_PHASE(ModuleType, Name, Phase) \
+	namespace \
+	{ \
+		fkleafs::StaticallyLinkedModuleRegistrant<ModuleType, fkleafs::ModuleStartupPhase::Phase> statically_linked_module_registrant_##ModuleType(Name); \
+	}
+#define FKL_REQUIRE_MODULE(ModuleType) FKL_MODULE_MANAGER().LoadModule<ModuleType>()
+#define FKL_INJECT_MODULE(ModuleType, GetterName) \
+	std::weak_ptr<ModuleType> GetterName() const \
+	{ \
+		return fkleafs::ModuleManager::Of(*this).GetModulePtr<ModuleType>(); \
+	}
+#define FKL_INJECT_MODULE_HANDLE(ModuleType, GetterName) \
+	fkleafs::ModuleHandle<ModuleType> GetterName() const \
+	{ \
+		fkleafs::ModuleManager& manager = fkleafs::ModuleManager::Of(*this); \
+		if (&manager != &fkleafs::ModuleManager::Get()) \
+		{ \
+			return manager.GetModuleHandle<ModuleType>(); \
+		} \
+		static const fkleafs::ModuleHandle<ModuleType> handle = manager.GetModuleHandle<ModuleType>(); \
+		return handle; \
+	}
+#define FKL_INJECT_PINNED_MODULE(ModuleType, GetterName) \
+	fkleafs::PinnedModule<ModuleType> GetterName() const \
+	{ \
+		fkleafs::ModuleManager& manager = fkleafs::ModuleManager::Of(*this); \
+		if (&manager != &fkleafs::ModuleManager::Get()) \
+		{ \
+			return manager.PinModule<ModuleType>(); \
+		} \
+		static const fkleafs::ModuleHandle<ModuleType> handle = manager.GetModuleHandle<ModuleType>(); \
+		fkleafs::PinnedModule<ModuleType> pin = handle.Pin(); \
+		if (pin) \
+		{ \
+			return pin; \
+		} \
+		return manager.PinModule<ModuleType>(); \
+	}
+#define FKL_INJECT_SERVICE(ServiceType, GetterName) \
+	std::weak_ptr<ServiceType> GetterName() const \
 	{ \
-		return FKL_MODULE_MANAGER().GetModulePtr<ModuleType>(); \
+		return fkleafs::ModuleManager::Of(*this).GetService<ServiceType>(); \
 	}
+#define FKL_MODULE_MEMORY_RESOURCE(ModuleType) FKL_MODULE_MANAGER().GetModuleMemoryResource<ModuleType>()
+#define FKL_PIN_MODULE(ModuleType) FKL_MODULE_MANAGER().PinModule<ModuleType>()
 #define FKL_LOAD_MODULE(ModuleType) FKL_MODULE_MANAGER().LoadModule<ModuleType>()
 
 #endif // !FKL_MODULE_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,170 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_MEMORY_H
+#define FKL_MODULE_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+#include "module_info.h"
+
+namespace fkleafs
+{
+	/**
+	 * Memory budget of a module, see ModuleMemoryResource.
+	 * A limit of zero disables the limit.
+	 */
+	struct ModuleMemoryBudget
+	{
+		/**
+		 * Live bytes above which on_soft_limit_exceeded is called.
+		 * Called once per crossing, live bytes have to drop to the limit again before it is called again.
+		 */
+		std::size_t soft_limit = 0;
+
+		/**
+		 * Live bytes an allocation must not exceed, allocations that would are rejected with std::bad_alloc.
+		 */
+		std::size_t hard_limit = 0;
+
+		/**
+		 * Called on the allocating thread, with the live bytes after the allocation.
+		 */
+		std::function<void(const ModuleInfo& info, std::size_t live_bytes)> on_soft_limit_exceeded;
+
+		/**
+		 * Called on the allocating thread before the allocation is rejected, with the size of the rejected allocation.
+		 */
+		std::function<void(const ModuleInfo& info, std::size_t requested_bytes)> on_hard_limit_exceeded;
+	};
+
+	/**
+	 * Memory usage of one module.
+	 */
+	struct ModuleMemoryStatistics
+	{
+		std::size_t live_bytes = 0;
+		std::size_t peak_bytes = 0;
+
+		/**
+		 * Bytes and number of allocations since the resource has been created.
+		 * Divided by tracked_duration, or differenced between two snapshots, they give the allocation rate.
+		 */
+		std::uint64_t allocated_bytes = 0;
+		std::uint64_t allocation_count = 0;
+
+		/**
+		 * Allocations that have been rejected by the hard limit.
+		 */
+		std::uint64_t rejected_allocation_count = 0;
+
+		/**
+		 * Time since the resource has been created.
+		 */
+		absl::Duration tracked_duration = absl::ZeroDuration();
+	};
+
+	/**
+	 * Memory resource that accounts every allocation to a module and enforces its budget.
+	 * Owned by the ModuleManager, see ModuleManager::GetModuleMemoryResource, and kept across reloads of the module.
+	 * Counters are updated with relaxed atomics, allocations never lock unless a budget callback fires.
+	 */
+	class ModuleMemoryResource : public std::pmr::memory_resource
+	{
+	public:
+		/**
+		 * Constructs the resource.
+		 *
+		 * @param info The module info of the module the memory is accounted to.
+		 * @param upstream The resource the memory is taken from.
+		 */
+		explicit ModuleMemoryResource(const ModuleInfo& info, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+			: m_info(info)
+			, m_upstream(upstream)
+			, m_created(absl::Now())
+		{
+		}
+
+		ModuleMemoryResource(const ModuleMemoryResource&) = delete;
+		ModuleMemoryResource& operator=(const ModuleMemoryResource&) = delete;
+
+		/**
+		 * Replaces the budget. Live allocations are not affected, the limits apply to the following allocations.
+		 *
+		 * @param budget The new budget.
+		 */
+		void SetBudget(ModuleMemoryBudget budget);
+
+		/**
+		 * Returns the memory usage of the module.
+		 *
+		 * @return The statistics.
+		 */
+		ModuleMemoryStatistics Statistics() const;
+
+		/**
+		 * Getter for the module the memory is accounted to.
+		 *
+		 * @return The module info.
+		 */
+		const ModuleInfo& Info() const
+		{
+			return m_info;
+		}
+
+	protected:
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+		void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+	private:
+		const ModuleInfo m_info;
+		std::pmr::memory_resource* const m_upstream;
+		const absl::Time m_created;
+
+		std::atomic<std::size_t> m_live_bytes{ 0 };
+		std::atomic<std::size_t> m_peak_bytes{ 0 };
+		std::atomic<std::uint64_t> m_allocated_bytes{ 0 };
+		std::atomic<std::uint64_t> m_allocation_count{ 0 };
+		std::atomic<std::uint64_t> m_rejected_allocation_count{ 0 };
+
+		/**
+		 * Copies of the limits of m_budget, read on every allocation.
+		 */
+		std::atomic<std::size_t> m_soft_limit{ 0 };
+		std::atomic<std::size_t> m_hard_limit{ 0 };
+
+		/**
+		 * Cleared when the soft limit has been reported, set again once live bytes drop to the limit.
+		 */
+		std::atomic<bool> m_soft_limit_armed{ true };
+
+		mutable absl::Mutex m_budget_mutex;
+		ModuleMemoryBudget m_budget;
+	};
+}
+
+#endif // !FKL_MODULE_MEMORY_H
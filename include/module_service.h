@@ -0,0 +1,186 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_SERVICE_H
+#define FKL_MODULE_SERVICE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include "absl/types/span.h"
+
+#include "module_info.h"
+#include "module_interface.h"
+
+namespace fkleafs
+{
+	/**
+	 * Identity of a service interface, computed at compile time from the interface type like a ModuleInfo.
+	 */
+	class ServiceInfo
+	{
+	private:
+		constexpr ServiceInfo(std::string_view service_name, std::size_t service_hash)
+			: m_service_name(service_name)
+			, m_service_hash(service_hash)
+		{}
+
+	public:
+		/**
+		 * Returns the info of a service interface.
+		 *
+		 * @tparam Service The interface type.
+		 * @return The service info.
+		 */
+		template<typename Service>
+		static constexpr ServiceInfo GetServiceInfo()
+		{
+			return ServiceInfo(detail::TypeIdentity<Service>::name, detail::TypeIdentity<Service>::hash);
+		}
+
+		constexpr std::string_view ServiceName() const
+		{
+			return m_service_name;
+		}
+
+		constexpr std::size_t ServiceHash() const
+		{
+			return m_service_hash;
+		}
+
+		struct ServiceInfoHash
+		{
+			constexpr std::size_t operator()(const ServiceInfo& service_info) const
+			{
+				return service_info.ServiceHash();
+			}
+		};
+
+		struct ServiceInfoEqual
+		{
+			constexpr bool operator()(const ServiceInfo& lhs, const ServiceInfo& rhs) const
+			{
+				return lhs.ServiceHash() == rhs.ServiceHash();
+			}
+		};
+
+	private:
+		std::string_view m_service_name;
+		std::size_t m_service_hash;
+	};
+
+	/**
+	 * A service interface a module provides.
+	 */
+	struct ModuleServiceBinding
+	{
+		ServiceInfo info;
+
+		/**
+		 * Converts the module to the interface, the result is a pointer to the interface type.
+		 */
+		void* (*cast)(ModuleInterface* module);
+	};
+
+	/**
+	 * The services a module provides.
+	 * If several loaded modules provide a service, the one with the highest priority is resolved,
+	 * modules with the same priority are ordered by name.
+	 */
+	struct ModuleServiceSettings
+	{
+		std::int32_t priority;
+		absl::Span<const ModuleServiceBinding> services;
+	};
+
+	/**
+	 * Returns the services of a module, or nullptr if the module provides none.
+	 */
+	using ModuleServicesFunction = const ModuleServiceSettings* (*)();
+
+	/**
+	 * Compile time service declaration of a module, see FKL_MODULE_SERVICES.
+	 *
+	 * @tparam Priority The priority of the module among the providers of the same service.
+	 * @tparam Services The interfaces the module implements.
+	 */
+	template<std::int32_t Priority, typename... Services>
+	struct ModuleServiceList
+	{
+	};
+
+	namespace detail
+	{
+		template<typename Module, typename List>
+		struct ModuleServiceBindings;
+
+		template<typename Module, std::int32_t Priority, typename... Services>
+		struct ModuleServiceBindings<Module, ModuleServiceList<Priority, Services...>>
+		{
+			static_assert((std::is_base_of<Services, Module>::value && ...), "A module must derive from every service it provides");
+
+			template<typename Service>
+			static void* Cast(ModuleInterface* module)
+			{
+				return static_cast<Service*>(static_cast<Module*>(module));
+			}
+
+			static constexpr std::array<ModuleServiceBinding, sizeof...(Services)> kBindings{ { { ServiceInfo::GetServiceInfo<Services>(), &Cast<Services> }... } };
+
+			static const ModuleServiceSettings* Settings()
+			{
+				static const ModuleServiceSettings settings{ Priority, absl::MakeConstSpan(kBindings) };
+				return &settings;
+			}
+		};
+	}
+
+	/**
+	 * Trait that yields the services of a module.
+	 * Picks up the declaration made with FKL_MODULE_SERVICES inside the module,
+	 * may also be specialized for modules that cannot be changed.
+	 *
+	 * @tparam Module The module to get the services for.
+	 */
+	template<typename Module, typename = void>
+	struct ModuleServiceTraits
+	{
+		static const ModuleServiceSettings* Settings()
+		{
+			return nullptr;
+		}
+	};
+
+	template<typename Module>
+	struct ModuleServiceTraits<Module, std::void_t<typename Module::FKLModuleServices>>
+	{
+		static const ModuleServiceSettings* Settings()
+		{
+			return detail::ModuleServiceBindings<Module, typename Module::FKLModuleServices>::Settings();
+		}
+	};
+}
+
+/**
+ * Declares the service interfaces a module provides, see ModuleServiceSettings.
+ * Takes the priority of the module followed by the interfaces.
+ */
+#define FKL_MODULE_SERVICES(...) \
+	public: \
+	using FKLModuleServices = fkleafs::ModuleServiceList<__VA_ARGS__>;
+
+#endif // !FKL_MODULE_SERVICE_H
@@ -0,0 +1,381 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_SET_H
+#define FKL_MODULE_SET_H
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+
+#include "epoch_domain.h"
+#include "module_dependencies.h"
+#include "module_info.h"
+#include "module_interface.h"
+#include "module_manager.h"
+
+namespace fkleafs
+{
+	namespace detail
+	{
+		/**
+		 * Startup order of the modules of a ModuleSet, computed at compile time.
+		 *
+		 * @tparam Modules The modules of the set, in declaration order.
+		 */
+		template<typename... Modules>
+		struct ModuleSetOrder
+		{
+			static constexpr std::size_t kCount = sizeof...(Modules);
+
+			static constexpr std::array<ModuleInfo, kCount> kInfos{ { ModuleInfo::GetModuleInfo<Modules>()... } };
+
+			/**
+			 * Index of a module of the set or kCount if the module is not part of the set.
+			 */
+			static constexpr std::size_t IndexOf(const ModuleInfo& info)
+			{
+				for (std::size_t index = 0; index < kCount; ++index)
+				{
+					if (kInfos[index].ModuleHash() == info.ModuleHash())
+					{
+						return index;
+					}
+				}
+				return kCount;
+			}
+
+			struct Order
+			{
+				/**
+				 * Indices into Modules, dependencies first.
+				 */
+				std::array<std::size_t, kCount> indices;
+
+				bool unique;
+				bool acyclic;
+			};
+
+			template<typename Module>
+			static constexpr void AddDependencies(std::array<bool, kCount>& depends_on)
+			{
+				// Dependencies outside of the set do not constrain the order, they are loaded through the ModuleManager.
+				for (const ModuleInfo& dependency : ModuleDependencies<Module>::type::kInfos)
+				{
+					const std::size_t index = IndexOf(dependency);
+					if (index != kCount)
+					{
+						depends_on[index] = true;
+					}
+				}
+			}
+
+			static constexpr Order Compute()
+			{
+				Order order{};
+				order.unique = true;
+				for (std::size_t index = 0; index < kCount; ++index)
+				{
+					order.unique = order.unique && IndexOf(kInfos[index]) == index;
+				}
+
+				std::array<std::array<bool, kCount>, kCount> depends_on{};
+				std::size_t module_index = 0;
+				((AddDependencies<Modules>(depends_on[module_index++])), ...);
+
+				// Kahn's algorithm, always picking the first ready module keeps the declaration order where possible.
+				std::array<bool, kCount> started{};
+				std::size_t started_count = 0;
+				while (started_count < kCount)
+				{
+					std::size_t ready = kCount;
+					for (std::size_t candidate = 0; candidate < kCount && ready == kCount; ++candidate)
+					{
+						if (started[candidate])
+						{
+							continue;
+						}
+						bool dependencies_started = true;
+						for (std::size_t dependency = 0; dependency < kCount; ++dependency)
+						{
+							dependencies_started = dependencies_started && (!depends_on[candidate][dependency] || started[dependency]);
+						}
+						if (dependencies_started)
+						{
+							ready = candidate;
+						}
+					}
+
+					if (ready == kCount)
+					{
+						order.acyclic = false;
+						return order;
+					}
+					started[ready] = true;
+					order.indices[started_count++] = ready;
+				}
+				order.acyclic = true;
+				return order;
+			}
+
+			static constexpr Order kOrder = Compute();
+		};
+	}
+
+	/**
+	 * Fixed set of modules that is composed at compile time.
+	 *
+	 * The modules are stored inline, Get resolves a module without any lookup and the lifecycle functions
+	 * are called non virtually in a dependency order that is computed by the compiler.
+	 * Modules of the set are default constructed together with the set; the set owns them, not the ModuleManager.
+	 *
+	 * When a ModuleManager is passed to Startup, dependencies outside of the set are loaded through the manager
+	 * and every module of the set is attached to the manager once it has been started,
+	 * so the rest of the program can look it up like any other loaded module.
+	 * A set that has been started with a manager must be destroyed before the manager is torn down.
+	 *
+	 * @tparam Modules The modules of the set.
+	 */
+	template<typename... Modules>
+	class ModuleSet
+	{
+	private:
+		// Required that all Modules are derived from ModuleInterface.
+		static_assert((std::is_base_of<ModuleInterface, Modules>::value && ...), "Any Module should be derived from ModuleInterface");
+		static_assert((std::is_default_constructible<Modules>::value && ...), "The modules of a ModuleSet must be default constructible");
+
+		using Order = detail::ModuleSetOrder<Modules...>;
+		static constexpr std::size_t kCount = Order::kCount;
+
+		static_assert(Order::kOrder.unique, "A module may only be part of a ModuleSet once");
+		static_assert(Order::kOrder.acyclic, "The modules of a ModuleSet must not depend on each other cyclically");
+
+	public:
+		ModuleSet() = default;
+
+		/**
+		 * Shuts the modules down if the set is still started and waits until no reader uses an attached module anymore.
+		 */
+		~ModuleSet()
+		{
+			Shutdown();
+			if (m_synchronize_on_destruction)
+			{
+				EpochDomain::Get().Synchronize();
+			}
+		}
+
+		ModuleSet(const ModuleSet&) = delete;
+		ModuleSet& operator=(const ModuleSet&) = delete;
+
+		/**
+		 * Tests whether a module is part of the set.
+		 *
+		 * @tparam Module The module.
+		 * @return True if the module is part of the set, false otherwise.
+		 */
+		template<typename Module>
+		static constexpr bool Contains()
+		{
+			return (std::is_same<Module, Modules>::value || ...);
+		}
+
+		/**
+		 * Getter for a module of the set, resolved at compile time.
+		 *
+		 * @tparam Module The module.
+		 * @return The module.
+		 */
+		template<typename Module>
+		Module& Get()
+		{
+			static_assert(Contains<Module>(), "The module is not part of the ModuleSet");
+			return std::get<Module>(m_modules);
+		}
+
+		template<typename Module>
+		const Module& Get() const
+		{
+			static_assert(Contains<Module>(), "The module is not part of the ModuleSet");
+			return std::get<Module>(m_modules);
+		}
+
+		/**
+		 * Starts all modules of the set, dependencies first.
+		 * If a module cannot be started, the modules started so far are shut down again.
+		 *
+		 * @param manager Optional module manager that provides the dependencies outside of the set
+		 * and that the modules are attached to.
+		 * @return True if all modules have been started, false otherwise.
+		 */
+		bool Startup(ModuleManager* manager = nullptr)
+		{
+			if (m_started_count != 0)
+			{
+				LOG(ERROR) << "The ModuleSet has already been started";
+				return false;
+			}
+
+			m_manager = manager;
+			if (!StartupModules(std::make_index_sequence<kCount>()))
+			{
+				Shutdown();
+				return false;
+			}
+			return true;
+		}
+
+		/**
+		 * Shuts all started modules down, dependents first, and detaches them from the module manager.
+		 * Does nothing if the set has not been started.
+		 */
+		void Shutdown()
+		{
+			ShutdownModules(std::make_index_sequence<kCount>());
+			m_started_count = 0;
+			m_manager = nullptr;
+		}
+
+		/**
+		 * Tests whether all modules of the set have been started.
+		 *
+		 * @return True if the set is started, false otherwise.
+		 */
+		bool IsStarted() const
+		{
+			return kCount != 0 && m_started_count == kCount;
+		}
+
+	private:
+		template<std::size_t... Positions>
+		bool StartupModules(std::index_sequence<Positions...>)
+		{
+			return (StartupModule<Positions>() && ...);
+		}
+
+		template<std::size_t... Positions>
+		void ShutdownModules(std::index_sequence<Positions...>)
+		{
+			(ShutdownModule<kCount - 1 - Positions>(), ...);
+		}
+
+		/**
+		 * Starts the module at a position of the startup order.
+		 */
+		template<std::size_t Position>
+		bool StartupModule()
+		{
+			constexpr std::size_t kIndex = Order::kOrder.indices[Position];
+			using Module = std::tuple_element_t<kIndex, std::tuple<Modules...>>;
+			constexpr ModuleInfo info = ModuleInfo::GetModuleInfo<Module>();
+
+			if (m_manager != nullptr)
+			{
+				for (const ModuleInfo& dependency : ModuleDependencies<Module>::type::kInfos)
+				{
+					if (Order::IndexOf(dependency) == kCount && !m_manager->IsModuleLoaded(dependency) && !m_manager->LoadModule(dependency))
+					{
+						LOG(ERROR) << "Failed to load the dependency: " << dependency.ModuleName() << " of the module: " << info.ModuleName();
+						return false;
+					}
+				}
+			}
+
+			Module& module = std::get<kIndex>(m_modules);
+			if (m_manager != nullptr)
+			{
+				// Lookups and injected modules of the startup resolve against the manager of the set, not the global one.
+				module.m_module_manager = m_manager;
+				const ModuleManagerScope scope(*m_manager);
+				module.Module::OnStartupModule();
+			}
+			else
+			{
+				module.Module::OnStartupModule();
+			}
+			++m_started_count;
+
+			if (m_manager != nullptr)
+			{
+				if (!m_manager->AttachModule(info, module))
+				{
+					LOG(ERROR) << "Failed to attach the module: " << info.ModuleName() << " to the module manager";
+					return false;
+				}
+				m_attached[kIndex] = true;
+				m_synchronize_on_destruction = true;
+			}
+			return true;
+		}
+
+		/**
+		 * Shuts the module at a position of the startup order down, if it has been started.
+		 */
+		template<std::size_t Position>
+		void ShutdownModule()
+		{
+			if (Position >= m_started_count)
+			{
+				return;
+			}
+
+			constexpr std::size_t kIndex = Order::kOrder.indices[Position];
+			using Module = std::tuple_element_t<kIndex, std::tuple<Modules...>>;
+
+			if (m_attached[kIndex])
+			{
+				m_manager->DetachModule(ModuleInfo::GetModuleInfo<Module>());
+				m_attached[kIndex] = false;
+			}
+
+			Module& module = std::get<kIndex>(m_modules);
+			if (m_manager != nullptr)
+			{
+				// Detaching clears the module manager of the module, the scope keeps the shutdown on the manager of the set.
+				const ModuleManagerScope scope(*m_manager);
+				module.Module::OnShutdownModule();
+			}
+			else
+			{
+				module.Module::OnShutdownModule();
+			}
+		}
+
+		std::tuple<Modules...> m_modules;
+
+		ModuleManager* m_manager = nullptr;
+
+		/**
+		 * Number of modules started so far, the started modules are a prefix of the startup order.
+		 */
+		std::size_t m_started_count = 0;
+
+		/**
+		 * Modules that are attached to m_manager, indexed like Modules.
+		 */
+		std::array<bool, kCount> m_attached{};
+
+		/**
+		 * Readers of the module manager may still hold attached modules after they have been detached.
+		 */
+		bool m_synchronize_on_destruction = false;
+	};
+}
+
+#endif // !FKL_MODULE_SET_H
@@ -0,0 +1,120 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_TICK_H
+#define FKL_MODULE_TICK_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "absl/types/span.h"
+
+#include "module_dependencies.h"
+#include "module_info.h"
+
+namespace fkleafs
+{
+	/**
+	 * How a module takes part in ModuleManager::Tick.
+	 *
+	 * Groups are ticked one after another in ascending order.
+	 * Within a group, modules run in parallel unless their accesses conflict:
+	 * a module that writes the state of a module ticks before the modules that read it,
+	 * modules that write the same state tick one after another.
+	 * Every ticking module writes its own state, so reading a module means ticking after it.
+	 */
+	struct ModuleTickSettings
+	{
+		std::uint32_t group;
+
+		/**
+		 * Modules whose state is read during OnTickModule.
+		 */
+		absl::Span<const ModuleInfo> reads;
+
+		/**
+		 * Modules whose state is written during OnTickModule, in addition to the ticking module itself.
+		 */
+		absl::Span<const ModuleInfo> writes;
+	};
+
+	/**
+	 * Returns the tick settings of a module, or nullptr if the module does not tick.
+	 */
+	using ModuleTickFunction = const ModuleTickSettings* (*)();
+
+	/**
+	 * Modules whose state a ticking module reads, see FKL_MODULE_TICK.
+	 */
+	template<typename... Modules>
+	using ModuleTickReads = ModuleDependencyList<Modules...>;
+
+	/**
+	 * Modules whose state a ticking module writes, see FKL_MODULE_TICK.
+	 */
+	template<typename... Modules>
+	using ModuleTickWrites = ModuleDependencyList<Modules...>;
+
+	/**
+	 * Compile time tick declaration of a module.
+	 *
+	 * @tparam Group The tick group of the module.
+	 * @tparam Reads The ModuleTickReads of the module.
+	 * @tparam Writes The ModuleTickWrites of the module.
+	 */
+	template<std::uint32_t Group, typename Reads = ModuleTickReads<>, typename Writes = ModuleTickWrites<>>
+	struct ModuleTick
+	{
+		static const ModuleTickSettings* Settings()
+		{
+			static const ModuleTickSettings settings{ Group, Reads::Infos(), Writes::Infos() };
+			return &settings;
+		}
+	};
+
+	/**
+	 * Trait that yields the tick settings of a module.
+	 * Picks up the declaration made with FKL_MODULE_TICK inside the module,
+	 * may also be specialized for modules that cannot be changed.
+	 *
+	 * @tparam Module The module to get the tick settings for.
+	 */
+	template<typename Module, typename = void>
+	struct ModuleTickTraits
+	{
+		static const ModuleTickSettings* Settings()
+		{
+			return nullptr;
+		}
+	};
+
+	template<typename Module>
+	struct ModuleTickTraits<Module, std::void_t<typename Module::FKLModuleTick>>
+	{
+		static const ModuleTickSettings* Settings()
+		{
+			return Module::FKLModuleTick::Settings();
+		}
+	};
+}
+
+/**
+ * Declares that a module ticks, see ModuleTickSettings.
+ * Takes the tick group and optionally a ModuleTickReads and a ModuleTickWrites list.
+ */
+#define FKL_MODULE_TICK(...) \
+	public: \
+	using FKLModuleTick = fkleafs::ModuleTick<__VA_ARGS__>;
+
+#endif // !FKL_MODULE_TICK_H
@@ -0,0 +1,253 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MODULE_TRACE_H
+#define FKL_MODULE_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+// Tracing is compiled in together with the instrumentation, see FKLEAFS_ENABLE_INSTRUMENTATION,
+// and recorded only between ModuleTracer::Start and ModuleTracer::Stop.
+
+namespace fkleafs
+{
+	/**
+	 * Kinds of events on the timeline of a ModuleManager.
+	 */
+	enum class TraceEventType
+	{
+		kRegistration,
+		kConstruction,
+		kStartup,
+		kShutdown,
+		kMutexWait
+	};
+
+	/**
+	 * One event of the timeline.
+	 * Registrations are instants, all other events are spans.
+	 */
+	struct TraceEvent
+	{
+		/**
+		 * Longest name that is kept, longer names are truncated.
+		 */
+		static constexpr std::size_t kMaxNameLength = 95;
+
+		TraceEventType type = TraceEventType::kRegistration;
+
+		/**
+		 * Start in nanoseconds since the Unix epoch, and duration of the event.
+		 */
+		std::int64_t start_nanoseconds = 0;
+		std::int64_t duration_nanoseconds = 0;
+
+		/**
+		 * Small sequential id of the recording thread, stable for the lifetime of the thread.
+		 */
+		std::uint32_t thread_id = 0;
+
+		/**
+		 * The module name, or the mutex name for mutex waits.
+		 * Copied, so the trace stays valid after a dynamic module has been unloaded.
+		 */
+		std::uint32_t name_length = 0;
+		char name[kMaxNameLength + 1] = {};
+	};
+
+#if defined(FKLEAFS_ENABLE_INSTRUMENTATION)
+	/**
+	 * Records the timeline of a ModuleManager into per thread ring buffers.
+	 *
+	 * Every thread writes into its own single producer, single consumer ring buffer without locking,
+	 * WriteChromeTrace is the only consumer. Events are dropped while a buffer is full,
+	 * see DroppedEventCount, recording never waits for a dump.
+	 */
+	class ModuleTracer
+	{
+	public:
+		/**
+		 * True if tracing is compiled in.
+		 */
+		static constexpr bool kEnabled = true;
+
+		/**
+		 * Number of events a thread can record between two dumps.
+		 */
+		static constexpr std::size_t kBufferCapacity = 16384;
+
+		ModuleTracer();
+
+		ModuleTracer(const ModuleTracer&) = delete;
+		ModuleTracer& operator=(const ModuleTracer&) = delete;
+
+		/**
+		 * Starts recording, timestamps of the following events are relative to this call.
+		 * Events recorded before and not dumped yet are discarded by the next dump.
+		 */
+		void Start();
+
+		/**
+		 * Stops recording, the recorded events can still be dumped.
+		 */
+		void Stop();
+
+		/**
+		 * Tests whether events are recorded.
+		 *
+		 * @return True between Start and Stop, false otherwise.
+		 */
+		bool IsTracing() const
+		{
+			return m_tracing.load(std::memory_order_relaxed);
+		}
+
+		/**
+		 * Records an instant on the calling thread.
+		 *
+		 * @param type The type of the event.
+		 * @param name The module name.
+		 */
+		void RecordInstant(TraceEventType type, std::string_view name)
+		{
+			if (IsTracing())
+			{
+				RecordEvent(type, name, absl::Now(), absl::ZeroDuration());
+			}
+		}
+
+		/**
+		 * Records a span on the calling thread.
+		 *
+		 * @param type The type of the event.
+		 * @param name The module or mutex name.
+		 * @param start The start of the span.
+		 * @param duration The duration of the span.
+		 */
+		void RecordSpan(TraceEventType type, std::string_view name, absl::Time start, absl::Duration duration)
+		{
+			if (IsTracing())
+			{
+				RecordEvent(type, name, start, duration);
+			}
+		}
+
+		/**
+		 * Takes all events recorded since the last dump out of the buffers
+		 * and writes them to a file in the Chrome trace event format, which Perfetto and chrome://tracing open.
+		 *
+		 * @param path The path of the file.
+		 * @return True if the file has been written, false otherwise.
+		 */
+		bool WriteChromeTrace(const std::string& path);
+
+		/**
+		 * Returns the number of events that have been dropped because a buffer was full.
+		 *
+		 * @return The dropped event count.
+		 */
+		std::uint64_t DroppedEventCount() const
+		{
+			return m_dropped_events.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/**
+		 * Ring buffer of one thread.
+		 * head is only advanced by its thread, tail only by the dump.
+		 */
+		struct TraceBuffer
+		{
+			std::unique_ptr<TraceEvent[]> events{ new TraceEvent[kBufferCapacity] };
+			std::uint32_t thread_id = 0;
+			std::atomic<std::size_t> head{ 0 };
+			std::atomic<std::size_t> tail{ 0 };
+		};
+
+		void RecordEvent(TraceEventType type, std::string_view name, absl::Time start, absl::Duration duration);
+
+		/**
+		 * Returns the buffer of the calling thread, creating it on first use.
+		 *
+		 * @return The buffer.
+		 */
+		TraceBuffer& GetBuffer();
+
+		/**
+		 * Identifies the tracer in the thread local caches, addresses could be reused.
+		 */
+		const std::uint64_t m_id;
+
+		std::atomic<bool> m_tracing{ false };
+		std::atomic<std::int64_t> m_start_nanoseconds{ 0 };
+		std::atomic<std::uint64_t> m_dropped_events{ 0 };
+
+		/**
+		 * Buffers of all threads that ever recorded an event, they outlive their threads so no event is lost.
+		 * The mutex also serializes the dumps.
+		 */
+		absl::Mutex m_buffers_mutex;
+		std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+	};
+#else
+	/**
+	 * Empty stand in while instrumentation is compiled out, WriteChromeTrace always fails.
+	 */
+	class ModuleTracer
+	{
+	public:
+		static constexpr bool kEnabled = false;
+
+		void Start()
+		{
+		}
+
+		void Stop()
+		{
+		}
+
+		bool IsTracing() const
+		{
+			return false;
+		}
+
+		void RecordInstant(TraceEventType, std::string_view)
+		{
+		}
+
+		void RecordSpan(TraceEventType, std::string_view, absl::Time, absl::Duration)
+		{
+		}
+
+		bool WriteChromeTrace(const std::string& path);
+
+		std::uint64_t DroppedEventCount() const
+		{
+			return 0;
+		}
+	};
+#endif
+}
+
+#endif // !FKL_MODULE_TRACE_H
@@ -0,0 +1,180 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_MPMC_QUEUE_H
+#define FKL_MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace fkleafs
+{
+	/**
+	 * Bounded lock free multi producer multi consumer queue.
+	 *
+	 * Every cell carries a sequence number that tells producers and consumers whose turn it is,
+	 * so a push or pop is a single compare and swap on the shared position plus one store to the cell.
+	 * The capacity is rounded up to a power of two.
+	 *
+	 * @tparam T The element type, must be move constructible.
+	 */
+	template<typename T>
+	class MpmcQueue
+	{
+	private:
+		static_assert(std::is_move_constructible<T>::value, "The elements of a MpmcQueue must be move constructible");
+
+	public:
+		/**
+		 * Constructs an empty queue.
+		 *
+		 * @param capacity The minimal number of elements the queue can hold, at least one.
+		 */
+		explicit MpmcQueue(std::size_t capacity)
+			: m_mask(RoundUpToPowerOfTwo(capacity) - 1)
+			, m_cells(std::make_unique<Cell[]>(m_mask + 1))
+		{
+			for (std::size_t index = 0; index <= m_mask; ++index)
+			{
+				m_cells[index].sequence.store(index, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * Destroys the elements that have not been popped.
+		 */
+		~MpmcQueue()
+		{
+			while (TryPop().has_value())
+			{
+			}
+		}
+
+		MpmcQueue(const MpmcQueue&) = delete;
+		MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+		/**
+		 * Pushes an element.
+		 *
+		 * @param value The element.
+		 * @return True if the element has been pushed, false if the queue is full.
+		 */
+		bool TryPush(T value)
+		{
+			std::size_t position = m_push_position.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = m_cells[position & m_mask];
+				const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+				if (difference == 0)
+				{
+					if (m_push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						new (&cell.storage) T(std::move(value));
+						cell.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+				{
+					// The consumer of the previous lap has not taken the element yet.
+					return false;
+				}
+				else
+				{
+					position = m_push_position.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/**
+		 * Pops the oldest element.
+		 *
+		 * @return The element or nullopt if the queue is empty.
+		 */
+		std::optional<T> TryPop()
+		{
+			std::size_t position = m_pop_position.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = m_cells[position & m_mask];
+				const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+				if (difference == 0)
+				{
+					if (m_pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						T* element = std::launder(reinterpret_cast<T*>(&cell.storage));
+						std::optional<T> value(std::move(*element));
+						element->~T();
+						cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+						return value;
+					}
+				}
+				else if (difference < 0)
+				{
+					return std::nullopt;
+				}
+				else
+				{
+					position = m_pop_position.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/**
+		 * Getter for the capacity.
+		 *
+		 * @return The number of elements the queue can hold.
+		 */
+		std::size_t Capacity() const
+		{
+			return m_mask + 1;
+		}
+
+	private:
+		struct Cell
+		{
+			std::atomic<std::size_t> sequence;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		static std::size_t RoundUpToPowerOfTwo(std::size_t value)
+		{
+			std::size_t result = 1;
+			while (result < value)
+			{
+				result <<= 1;
+			}
+			return result;
+		}
+
+		const std::size_t m_mask;
+		const std::unique_ptr<Cell[]> m_cells;
+
+		/**
+		 * Producers and consumers work on separate cache lines.
+		 */
+		alignas(64) std::atomic<std::size_t> m_push_position{ 0 };
+		alignas(64) std::atomic<std::size_t> m_pop_position{ 0 };
+	};
+}
+
+#endif // !FKL_MPMC_QUEUE_H
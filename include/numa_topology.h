@@ -0,0 +1,70 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_NUMA_TOPOLOGY_H
+#define FKL_NUMA_TOPOLOGY_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fkleafs
+{
+	/**
+	 * NUMA nodes of the machine, queried from the operating system without libnuma.
+	 * Systems without NUMA support, and macOS, report a single node.
+	 */
+	class NumaTopology
+	{
+	public:
+		NumaTopology() = delete;
+
+		/**
+		 * Returns the number of NUMA nodes, queried once.
+		 *
+		 * @return The node count, at least 1.
+		 */
+		static std::uint32_t NodeCount();
+
+		/**
+		 * Returns the node of the processor the calling thread runs on.
+		 * The node is cached per thread and refreshed periodically, a thread that has just migrated
+		 * may see its previous node for a short while.
+		 *
+		 * @return The node, less than NodeCount.
+		 */
+		static std::uint32_t CurrentNode();
+
+		/**
+		 * Asks the system to place memory that has not been touched yet on a node.
+		 * Only a preference, the memory is placed elsewhere if the node runs out of memory.
+		 *
+		 * @param memory The page aligned memory.
+		 * @param size The size of the memory.
+		 * @param node The node.
+		 * @return True if the preference has been applied, false otherwise.
+		 */
+		static bool PreferNode(void* memory, std::size_t size, std::uint32_t node);
+
+		/**
+		 * Asks the system to interleave the pages of memory that has not been touched yet across all nodes.
+		 *
+		 * @param memory The page aligned memory.
+		 * @param size The size of the memory.
+		 * @return True if the policy has been applied, false otherwise.
+		 */
+		static bool Interleave(void* memory, std::size_t size);
+	};
+}
+
+#endif // !FKL_NUMA_TOPOLOGY_H
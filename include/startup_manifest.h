@@ -0,0 +1,102 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_STARTUP_MANIFEST_H
+#define FKL_STARTUP_MANIFEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/time/time.h"
+
+namespace fkleafs
+{
+	/**
+	 * A module of a startup manifest.
+	 */
+	struct StartupManifestModule
+	{
+		std::string module_name;
+		std::size_t module_hash;
+
+		/**
+		 * Indices of the modules that have to be started before this module, declared and observed.
+		 * Always smaller than the index of the module itself.
+		 */
+		std::vector<std::size_t> dependencies;
+
+		/**
+		 * Parallelization level, modules of the same level do not depend on each other.
+		 * Zero for modules without dependencies, otherwise one more than the highest level of the dependencies.
+		 */
+		std::size_t level;
+
+		/**
+		 * Time the construction and OnStartupModule of the module took.
+		 */
+		absl::Duration startup_cost;
+	};
+
+	/**
+	 * Result of a successful boot, see ModuleManager::WriteStartupManifest and ModuleManager::BootModules.
+	 * Stored as a small line based text file, so it can be inspected and diffed.
+	 */
+	struct StartupManifest
+	{
+		/**
+		 * Incremented whenever the file format changes.
+		 */
+		static constexpr std::uint32_t kVersion = 1;
+
+		/**
+		 * Fingerprint of the registered modules and their declared dependencies at the time the manifest was created.
+		 * A manifest is only valid as long as the fingerprint of the registry does not change.
+		 */
+		std::uint64_t registry_fingerprint = 0;
+
+		/**
+		 * The started modules in topological order.
+		 */
+		std::vector<StartupManifestModule> modules;
+
+		/**
+		 * Writes the manifest to a file, replacing the file atomically.
+		 *
+		 * @param path The path of the file.
+		 * @return True if the manifest has been written, false otherwise.
+		 */
+		bool Write(const std::string& path) const;
+
+		/**
+		 * Reads a manifest from a file.
+		 *
+		 * @param path The path of the file.
+		 * @param manifest Receives the manifest.
+		 * @return True if the file contains a valid manifest of the current version, false otherwise.
+		 */
+		static bool Read(const std::string& path, StartupManifest& manifest);
+
+		/**
+		 * Returns the length of the critical path starting at every module,
+		 * its own startup cost plus the longest chain of startup costs of the modules that depend on it.
+		 *
+		 * @return The critical path lengths, indexed like modules.
+		 */
+		std::vector<absl::Duration> CriticalPathCosts() const;
+	};
+}
+
+#endif // !FKL_STARTUP_MANIFEST_H
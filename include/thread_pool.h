@@ -0,0 +1,148 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FKL_THREAD_POOL_H
+#define FKL_THREAD_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace fkleafs
+{
+	/**
+	 * Scheduling priority of the workers of a ThreadPool.
+	 */
+	enum class ThreadPriority
+	{
+		kNormal,
+
+		/**
+		 * Below normal, so the workers yield to the other threads of the process. Only a hint on platforms without support.
+		 */
+		kLow
+	};
+
+	/**
+	 * Work stealing thread pool.
+	 * Every worker owns a queue. Tasks scheduled from a worker go to the back of its own queue
+	 * and are taken from the back again, idle workers steal from the front of the other queues.
+	 */
+	class ThreadPool
+	{
+	public:
+		/**
+		 * Constructs the pool and starts its workers.
+		 *
+		 * @param thread_count The number of workers, 0 uses one worker per hardware thread.
+		 * @param priority The scheduling priority of the workers.
+		 */
+		explicit ThreadPool(std::size_t thread_count = 0, ThreadPriority priority = ThreadPriority::kNormal);
+
+		/**
+		 * Runs all remaining tasks and joins the workers.
+		 */
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		/**
+		 * Schedules a task.
+		 *
+		 * @param task The task to run on one of the workers.
+		 */
+		void Schedule(std::function<void()> task);
+
+		/**
+		 * Runs one pending task on the calling thread.
+		 * Threads that wait for tasks of this pool should call this to avoid starving the pool.
+		 *
+		 * @return True if a task has been run, false if no task was pending.
+		 */
+		bool TryRunPendingTask();
+
+		/**
+		 * Getter for the number of workers.
+		 *
+		 * @return The number of workers.
+		 */
+		std::size_t ThreadCount() const
+		{
+			return m_threads.size();
+		}
+
+		/**
+		 * Tests whether the calling thread is a worker of this pool.
+		 *
+		 * @return True if the calling thread is a worker of this pool, false otherwise.
+		 */
+		bool IsWorkerThread() const;
+
+	private:
+		/**
+		 * Task queue of a worker.
+		 */
+		struct WorkerQueue
+		{
+			absl::Mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		/**
+		 * Main loop of a worker.
+		 *
+		 * @param index The index of the worker.
+		 * @param priority The scheduling priority of the worker.
+		 */
+		void WorkerLoop(std::size_t index, ThreadPriority priority);
+
+		/**
+		 * Takes a task, preferring the back of the own queue and stealing from the front of other queues.
+		 *
+		 * @param index The index of the queue to start with.
+		 * @param task Receives the task.
+		 * @return True if a task has been taken, false otherwise.
+		 */
+		bool PopTask(std::size_t index, std::function<void()>& task);
+
+		std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+		std::vector<std::thread> m_threads;
+
+		/**
+		 * Number of scheduled tasks that have not been taken yet.
+		 */
+		std::atomic<std::size_t> m_pending_tasks{ 0 };
+
+		/**
+		 * Round robin counter for tasks scheduled from outside the pool.
+		 */
+		std::atomic<std::size_t> m_next_queue{ 0 };
+
+		/**
+		 * Mutex used to park idle workers.
+		 */
+		absl::Mutex m_idle_mutex;
+		absl::CondVar m_idle_condition;
+		bool m_stopping = false;
+	};
+}
+
+#endif // !FKL_THREAD_POOL_H
@@ -0,0 +1,189 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "dynamic_module.h"
+
+#include <atomic>
+#include <filesystem>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * Distinguishes the private copies of a library opened by this process.
+		 */
+		std::atomic<std::uint64_t> g_next_copy_id{ 0 };
+
+		/**
+		 * Returns the path of a new private copy of a library.
+		 *
+		 * @param library_path The path of the library.
+		 * @return The path of the copy.
+		 */
+		std::string CopyPath(const std::string& library_path)
+		{
+#if defined(_WIN32)
+			const unsigned long process_id = GetCurrentProcessId();
+#else
+			const long process_id = static_cast<long>(getpid());
+#endif
+			return library_path + ".fkleafs-" + std::to_string(process_id) + "-" + std::to_string(g_next_copy_id.fetch_add(1, std::memory_order_relaxed));
+		}
+	}
+
+	std::shared_ptr<DynamicLibrary> DynamicLibrary::Open(const std::string& library_path)
+	{
+#if defined(_WIN32)
+		void* handle = static_cast<void*>(LoadLibraryA(library_path.c_str()));
+		if (handle == nullptr)
+		{
+			LOG(ERROR) << "Failed to open library: " << library_path << ". Error code: " << GetLastError();
+			return nullptr;
+		}
+#else
+		void* handle = dlopen(library_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (handle == nullptr)
+		{
+			LOG(ERROR) << "Failed to open library: " << library_path << ". " << dlerror();
+			return nullptr;
+		}
+#endif
+		return std::shared_ptr<DynamicLibrary>(new DynamicLibrary(handle, library_path));
+	}
+
+	std::shared_ptr<DynamicLibrary> DynamicLibrary::OpenCopy(const std::string& library_path)
+	{
+		const std::string copy_path = CopyPath(library_path);
+		std::error_code error;
+		if (!std::filesystem::copy_file(library_path, copy_path, std::filesystem::copy_options::overwrite_existing, error))
+		{
+			LOG(ERROR) << "Failed to copy library: " << library_path << " to: " << copy_path << ". " << error.message();
+			return nullptr;
+		}
+
+		std::shared_ptr<DynamicLibrary> library = Open(copy_path);
+		if (library == nullptr)
+		{
+			std::filesystem::remove(copy_path, error);
+			return nullptr;
+		}
+		library->m_library_path = library_path;
+
+#if defined(_WIN32)
+		// A loaded library cannot be deleted on Windows, the copy is deleted once it has been closed.
+		library->m_copy_path = copy_path;
+#else
+		// The mapping stays valid after the file has been unlinked.
+		std::filesystem::remove(copy_path, error);
+#endif
+		return library;
+	}
+
+	bool DynamicLibrary::IsOpen(const std::string& library_path)
+	{
+#if defined(_WIN32)
+		return GetModuleHandleA(library_path.c_str()) != nullptr;
+#else
+		void* handle = dlopen(library_path.c_str(), RTLD_NOW | RTLD_NOLOAD);
+		if (handle == nullptr)
+		{
+			return false;
+		}
+		dlclose(handle);
+		return true;
+#endif
+	}
+
+	DynamicLibrary::~DynamicLibrary()
+	{
+#if defined(_WIN32)
+		FreeLibrary(static_cast<HMODULE>(m_handle));
+#else
+		dlclose(m_handle);
+#endif
+
+		if (!m_copy_path.empty())
+		{
+			std::error_code error;
+			std::filesystem::remove(m_copy_path, error);
+		}
+	}
+
+	void* DynamicLibrary::FindSymbol(const char* symbol_name) const
+	{
+#if defined(_WIN32)
+		return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(m_handle), symbol_name));
+#else
+		return dlsym(m_handle, symbol_name);
+#endif
+	}
+
+	std::shared_ptr<ModuleInterface> DynamicallyLinkedModule::CreateModuleInterface() const
+	{
+		// A library that is still open would be returned as is by the dynamic loader, even if it has been replaced on disk.
+		std::shared_ptr<DynamicLibrary> library = DynamicLibrary::IsOpen(m_library_path) ? DynamicLibrary::OpenCopy(m_library_path) : DynamicLibrary::Open(m_library_path);
+		if (library == nullptr)
+		{
+			return nullptr;
+		}
+
+		const DynamicModuleExportFunction export_function = reinterpret_cast<DynamicModuleExportFunction>(library->FindSymbol(FKL_DYNAMIC_MODULE_EXPORT_SYMBOL));
+		if (export_function == nullptr)
+		{
+			LOG(ERROR) << "The library: " << m_library_path << " does not export " << FKL_DYNAMIC_MODULE_EXPORT_SYMBOL;
+			return nullptr;
+		}
+
+		const DynamicModuleExport* module_export = export_function();
+		if (module_export == nullptr || module_export->abi_version != DynamicModuleExport::kAbiVersion)
+		{
+			LOG(ERROR) << "The library: " << m_library_path << " was built against an incompatible version of fkleafs";
+			return nullptr;
+		}
+
+		if (module_export->module_hash != m_info.ModuleHash())
+		{
+			LOG(ERROR) << "The library: " << m_library_path << " exports the module: " << std::string(module_export->module_name, module_export->module_name_length)
+				<< " instead of: " << m_info.ModuleName();
+			return nullptr;
+		}
+
+		ModuleInterface* module = module_export->create();
+		if (module == nullptr)
+		{
+			LOG(ERROR) << "The library: " << m_library_path << " failed to create the module: " << m_info.ModuleName();
+			return nullptr;
+		}
+
+		// The deleter owns the library, so the library is closed right after the module has been destroyed.
+		void (*destroy)(ModuleInterface*) = module_export->destroy;
+		return std::shared_ptr<ModuleInterface>(module, [destroy, library](ModuleInterface* module_to_destroy) mutable
+			{
+				destroy(module_to_destroy);
+				library.reset();
+			});
+	}
+}
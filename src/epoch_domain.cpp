@@ -0,0 +1,153 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "epoch_domain.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace fkleafs
+{
+	EpochDomain& EpochDomain::Get()
+	{
+		// Intentionally leaked, threads and static destructors may still retire objects during shutdown.
+		static EpochDomain* const instance = new EpochDomain();
+		return *instance;
+	}
+
+	EpochDomain::ThreadRecord& EpochDomain::LocalRecord() const
+	{
+		struct LocalRecordHolder
+		{
+			ThreadRecord* record = nullptr;
+
+			~LocalRecordHolder()
+			{
+				if (record != nullptr)
+				{
+					record->nesting = 0;
+					record->epoch.store(kInactive, std::memory_order_seq_cst);
+					record->in_use.store(false, std::memory_order_release);
+				}
+			}
+		};
+		thread_local LocalRecordHolder holder;
+
+		if (holder.record != nullptr)
+		{
+			return *holder.record;
+		}
+
+		// Reuse the record of an exited thread if possible.
+		for (ThreadRecord* record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+		{
+			bool expected = false;
+			if (!record->in_use.load(std::memory_order_relaxed) && record->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			{
+				holder.record = record;
+				return *record;
+			}
+		}
+
+		ThreadRecord* record = new ThreadRecord();
+		record->in_use.store(true, std::memory_order_relaxed);
+		ThreadRecord* head = m_records.load(std::memory_order_relaxed);
+		do
+		{
+			record->next = head;
+		} while (!m_records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+		holder.record = record;
+		return *record;
+	}
+
+	void EpochDomain::Enter()
+	{
+		ThreadRecord& record = LocalRecord();
+		if (record.nesting++ == 0)
+		{
+			// Sequentially consistent so that the epoch is visible to writers
+			// before this thread loads any protected pointer.
+			record.epoch.store(m_global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+		}
+	}
+
+	void EpochDomain::Leave()
+	{
+		ThreadRecord& record = LocalRecord();
+		if (--record.nesting == 0)
+		{
+			record.epoch.store(kInactive, std::memory_order_release);
+		}
+	}
+
+	bool EpochDomain::InCriticalSection() const
+	{
+		return LocalRecord().nesting != 0;
+	}
+
+	std::uint64_t EpochDomain::MinimumActiveEpoch() const
+	{
+		std::uint64_t minimum = kInactive;
+		for (ThreadRecord* record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+		{
+			minimum = std::min(minimum, record->epoch.load(std::memory_order_seq_cst));
+		}
+		return minimum;
+	}
+
+	void EpochDomain::Retire(std::function<void()> deleter)
+	{
+		// The object has been unlinked before, so every reader that enters at the new epoch cannot observe it.
+		const std::uint64_t epoch = m_global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+		m_retired_mutex.Lock();
+		m_retired.push_back(RetiredObject{ epoch, std::move(deleter) });
+		m_retired_mutex.Unlock();
+	}
+
+	void EpochDomain::Reclaim()
+	{
+		const std::uint64_t minimum_active_epoch = MinimumActiveEpoch();
+
+		std::vector<RetiredObject> reclaimable;
+		m_retired_mutex.Lock();
+		const auto first_reclaimable = std::stable_partition(m_retired.begin(), m_retired.end(), [minimum_active_epoch](const RetiredObject& object)
+			{
+				return object.epoch > minimum_active_epoch;
+			});
+		reclaimable.assign(std::make_move_iterator(first_reclaimable), std::make_move_iterator(m_retired.end()));
+		m_retired.erase(first_reclaimable, m_retired.end());
+		m_retired_mutex.Unlock();
+
+		// Deleters run without holding the lock, they may destroy modules that retire objects themselves.
+		for (RetiredObject& object : reclaimable)
+		{
+			object.deleter();
+		}
+	}
+
+	void EpochDomain::Synchronize()
+	{
+		if (!InCriticalSection())
+		{
+			const std::uint64_t target_epoch = m_global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+			while (MinimumActiveEpoch() < target_epoch)
+			{
+				std::this_thread::yield();
+			}
+		}
+		Reclaim();
+	}
+}
@@ -0,0 +1,101 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "event_bus.h"
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * The bus the calling thread is dispatching, so handlers can unsubscribe without waiting for themselves.
+		 */
+		thread_local const EventBus* t_dispatching_bus = nullptr;
+	}
+
+	EventBus::EventBus()
+		: m_channels(new ChannelMap())
+	{
+	}
+
+	EventBus::~EventBus()
+	{
+		delete m_channels.load(std::memory_order_relaxed);
+	}
+
+	void EventBus::Unsubscribe(const ModuleInterface& subscriber)
+	{
+		for (Channel* channel : Channels())
+		{
+			channel->Unsubscribe(subscriber);
+		}
+
+		// A dispatch on another thread may still be inside a handler of the module.
+		if (t_dispatching_bus != this)
+		{
+			m_dispatch_mutex.Lock();
+			m_dispatch_mutex.Unlock();
+		}
+	}
+
+	std::size_t EventBus::Dispatch()
+	{
+		absl::MutexLock lock(&m_dispatch_mutex);
+
+		// Handlers may publish to new channels, those are dispatched next time.
+		const std::vector<Channel*> channels = Channels();
+
+		const EventBus* parent_bus = t_dispatching_bus;
+		t_dispatching_bus = this;
+		std::size_t event_count = 0;
+		for (Channel* channel : channels)
+		{
+			event_count += channel->Dispatch();
+		}
+		t_dispatching_bus = parent_bus;
+		return event_count;
+	}
+
+	std::vector<EventBus::Channel*> EventBus::Channels()
+	{
+		absl::MutexLock lock(&m_channels_mutex);
+		std::vector<Channel*> channels;
+		channels.reserve(m_channel_storage.size());
+		for (const std::unique_ptr<Channel>& channel : m_channel_storage)
+		{
+			channels.push_back(channel.get());
+		}
+		return channels;
+	}
+
+	EventBus::Channel* EventBus::AddChannel(const ChannelInfo& info, std::unique_ptr<Channel> channel, bool& created)
+	{
+		absl::MutexLock lock(&m_channels_mutex);
+		const ChannelMap* channels = m_channels.load(std::memory_order_relaxed);
+		const auto iterator = channels->find(info);
+		if (iterator != channels->end())
+		{
+			return iterator->second;
+		}
+
+		ChannelMap* new_channels = new ChannelMap(*channels);
+		Channel* added_channel = channel.get();
+		new_channels->emplace(info, added_channel);
+		m_channel_storage.push_back(std::move(channel));
+		m_channels.store(new_channels, std::memory_order_release);
+		EpochDomain::Get().Retire(channels);
+		created = true;
+		return added_channel;
+	}
+}
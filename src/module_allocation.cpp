@@ -0,0 +1,219 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_allocation.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "numa_topology.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fkleafs
+{
+	namespace
+	{
+		constexpr std::size_t kHugePageSize = 2 * 1024 * 1024;
+
+		std::size_t AlignUp(std::size_t value, std::size_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	ModuleArena::~ModuleArena()
+	{
+		// Modules that outlive the arena still use its memory, leaking the blocks is the only safe option.
+		if (LiveAllocations() != 0)
+		{
+			return;
+		}
+		for (const Block& block : m_blocks)
+		{
+			UnmapBlock(block);
+		}
+	}
+
+	bool ModuleArena::Configure(const ModuleArenaOptions& options)
+	{
+		m_mutex.Lock();
+		const bool configured = m_blocks.empty();
+		if (configured)
+		{
+			m_options = options;
+		}
+		m_mutex.Unlock();
+		return configured;
+	}
+
+	void* ModuleArena::Allocate(std::size_t size, std::size_t alignment)
+	{
+		alignment = std::max(alignment, kCacheLineSize);
+		size = AlignUp(std::max<std::size_t>(size, 1), kCacheLineSize);
+
+		m_mutex.Lock();
+		char* memory = reinterpret_cast<char*>(AlignUp(reinterpret_cast<std::uintptr_t>(m_current), alignment));
+		if (m_current == nullptr || memory > m_end || static_cast<std::size_t>(m_end - memory) < size)
+		{
+			const Block block = MapBlock(std::max(m_options.block_size, size + alignment));
+			if (block.memory == nullptr)
+			{
+				m_mutex.Unlock();
+				return nullptr;
+			}
+			m_blocks.push_back(block);
+			m_end = block.memory + block.size;
+			memory = reinterpret_cast<char*>(AlignUp(reinterpret_cast<std::uintptr_t>(block.memory), alignment));
+		}
+		m_current = memory + size;
+		m_live_allocations.fetch_add(1, std::memory_order_relaxed);
+		m_mutex.Unlock();
+		return memory;
+	}
+
+	bool ModuleArena::Release()
+	{
+		m_mutex.Lock();
+		if (LiveAllocations() != 0)
+		{
+			m_mutex.Unlock();
+			return false;
+		}
+
+		for (const Block& block : m_blocks)
+		{
+			UnmapBlock(block);
+		}
+		m_blocks.clear();
+		m_current = nullptr;
+		m_end = nullptr;
+		m_mutex.Unlock();
+		return true;
+	}
+
+	std::size_t ModuleArena::ReservedBytes() const
+	{
+		std::size_t reserved_bytes = 0;
+		m_mutex.ReaderLock();
+		for (const Block& block : m_blocks)
+		{
+			reserved_bytes += block.size;
+		}
+		m_mutex.ReaderUnlock();
+		return reserved_bytes;
+	}
+
+	ModuleArena::Block ModuleArena::MapBlock(std::size_t size) const
+	{
+#if defined(_WIN32)
+		if (m_options.use_huge_pages)
+		{
+			// Large pages require the SeLockMemoryPrivilege, without it the allocation fails and regular pages are used.
+			const std::size_t large_page_size = GetLargePageMinimum();
+			if (large_page_size != 0)
+			{
+				const std::size_t large_size = AlignUp(size, large_page_size);
+				void* memory = AllocateVirtualMemory(large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES);
+				if (memory != nullptr)
+				{
+					return Block{ static_cast<char*>(memory), large_size };
+				}
+			}
+		}
+
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		size = AlignUp(size, system_info.dwPageSize);
+		void* memory = AllocateVirtualMemory(size, MEM_RESERVE | MEM_COMMIT);
+		return Block{ static_cast<char*>(memory), size };
+#else
+		size = AlignUp(size, m_options.use_huge_pages ? kHugePageSize : static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+
+#if defined(MAP_HUGETLB)
+		if (m_options.use_huge_pages)
+		{
+			void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (memory != MAP_FAILED)
+			{
+				ApplyNumaPlacement(memory, size);
+				return Block{ static_cast<char*>(memory), size };
+			}
+		}
+#endif
+
+		void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+		{
+			return Block{ nullptr, 0 };
+		}
+
+#if defined(MADV_HUGEPAGE)
+		// No huge pages are reserved, ask for transparent huge pages instead.
+		if (m_options.use_huge_pages)
+		{
+			madvise(memory, size, MADV_HUGEPAGE);
+		}
+#endif
+		ApplyNumaPlacement(memory, size);
+		return Block{ static_cast<char*>(memory), size };
+#endif
+	}
+
+#if defined(_WIN32)
+	void* ModuleArena::AllocateVirtualMemory(std::size_t size, unsigned long allocation_type) const
+	{
+		// Windows picks the node when the memory is allocated, interleaving is not offered.
+		if (m_options.numa_placement == NumaPlacement::kNode && NumaTopology::NodeCount() > 1)
+		{
+			void* memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, allocation_type, PAGE_READWRITE, m_options.numa_node);
+			if (memory != nullptr)
+			{
+				return memory;
+			}
+		}
+		return VirtualAlloc(nullptr, size, allocation_type, PAGE_READWRITE);
+	}
+#else
+	void ModuleArena::ApplyNumaPlacement(void* memory, std::size_t size) const
+	{
+		// The pages have not been touched yet, so the policy decides where they are faulted in.
+		switch (m_options.numa_placement)
+		{
+		case NumaPlacement::kDefault:
+			break;
+		case NumaPlacement::kInterleave:
+			NumaTopology::Interleave(memory, size);
+			break;
+		case NumaPlacement::kNode:
+			NumaTopology::PreferNode(memory, size, m_options.numa_node);
+			break;
+		}
+	}
+#endif
+
+	void ModuleArena::UnmapBlock(const Block& block)
+	{
+#if defined(_WIN32)
+		VirtualFree(block.memory, 0, MEM_RELEASE);
+#else
+		munmap(block.memory, block.size);
+#endif
+	}
+}
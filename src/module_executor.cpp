@@ -0,0 +1,257 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_executor.h"
+
+#include <limits>
+#include <utility>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * The executor whose tasks the calling thread is running.
+		 */
+		thread_local const ModuleExecutor* t_current_executor = nullptr;
+
+		/**
+		 * Set by the destructor of an executor that runs on the executor's own thread,
+		 * tells the thread loop to return without touching the destroyed executor.
+		 */
+		thread_local bool t_destroyed_on_own_thread = false;
+
+		/**
+		 * Pins the calling thread to a processor.
+		 *
+		 * @param processor The processor.
+		 * @return True if the thread has been pinned, false otherwise.
+		 */
+		bool PinCurrentThread(int processor)
+		{
+#if defined(_WIN32)
+			if (processor >= static_cast<int>(8 * sizeof(DWORD_PTR)))
+			{
+				return false;
+			}
+			return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << processor) != 0;
+#elif defined(__linux__)
+			if (processor >= CPU_SETSIZE)
+			{
+				return false;
+			}
+			cpu_set_t processors;
+			CPU_ZERO(&processors);
+			CPU_SET(processor, &processors);
+			return pthread_setaffinity_np(pthread_self(), sizeof(processors), &processors) == 0;
+#else
+			// macOS only offers affinity tags, not a binding to a processor.
+			return false;
+#endif
+		}
+	}
+
+	std::shared_ptr<ModuleExecutor> ModuleExecutor::Create(const ModuleExecutorOptions& options, ThreadPool& pool)
+	{
+		std::shared_ptr<ModuleExecutor> executor(new ModuleExecutor(options, pool));
+		if (options.kind == ModuleExecutorKind::kPinnedThread)
+		{
+			executor->m_thread = std::thread(&ModuleExecutor::ThreadLoop, executor.get(), std::weak_ptr<ModuleExecutor>(executor));
+		}
+		return executor;
+	}
+
+	ModuleExecutor::ModuleExecutor(const ModuleExecutorOptions& options, ThreadPool& pool)
+		: m_options(options), m_pool(pool)
+	{
+	}
+
+	ModuleExecutor::~ModuleExecutor()
+	{
+		if (m_thread.joinable() && m_thread.get_id() == std::this_thread::get_id())
+		{
+			// A task has released the last reference, the thread cannot join itself.
+			t_destroyed_on_own_thread = true;
+			m_thread.detach();
+			return;
+		}
+		Stop();
+	}
+
+	bool ModuleExecutor::Post(std::function<void()> task)
+	{
+		bool schedule = false;
+		{
+			absl::MutexLock lock(&m_mutex);
+			if (m_stopping)
+			{
+				return false;
+			}
+			m_tasks.push_back(std::move(task));
+			if (m_options.kind == ModuleExecutorKind::kStrand && !m_running)
+			{
+				m_running = true;
+				schedule = true;
+			}
+		}
+
+		if (schedule)
+		{
+			ScheduleStrand();
+		}
+		return true;
+	}
+
+	bool ModuleExecutor::IsCurrent() const
+	{
+		return t_current_executor == this;
+	}
+
+	void ModuleExecutor::Stop()
+	{
+		{
+			absl::MutexLock lock(&m_mutex);
+			m_stopping = true;
+		}
+
+		if (IsCurrent())
+		{
+			return;
+		}
+
+		if (m_options.kind == ModuleExecutorKind::kPinnedThread)
+		{
+			if (m_thread.joinable())
+			{
+				m_thread.join();
+			}
+			return;
+		}
+
+		// The strand may be queued behind the calling worker, so help the pool instead of blocking it.
+		while (true)
+		{
+			{
+				absl::MutexLock lock(&m_mutex);
+				if (!m_running)
+				{
+					return;
+				}
+			}
+
+			if (!m_pool.TryRunPendingTask())
+			{
+				absl::MutexLock lock(&m_mutex);
+				m_mutex.AwaitWithTimeout(absl::Condition(+[](bool* running) { return !*running; }, &m_running), absl::Milliseconds(1));
+			}
+		}
+	}
+
+	bool ModuleExecutor::RunBatches(std::size_t max_tasks)
+	{
+		std::vector<std::function<void()>> batch;
+		std::size_t executed_tasks = 0;
+		while (true)
+		{
+			{
+				absl::MutexLock lock(&m_mutex);
+				if (m_tasks.empty())
+				{
+					m_running = false;
+					return true;
+				}
+				if (executed_tasks >= max_tasks)
+				{
+					return false;
+				}
+				batch.swap(m_tasks);
+			}
+
+			for (std::function<void()>& task : batch)
+			{
+				task();
+			}
+			executed_tasks += batch.size();
+			batch.clear();
+		}
+	}
+
+	void ModuleExecutor::ScheduleStrand()
+	{
+		m_pool.Schedule([self = shared_from_this()]()
+		{
+			const ModuleExecutor* previous_executor = t_current_executor;
+			t_current_executor = self.get();
+			const bool drained = self->RunBatches(self->m_options.max_batch_size == 0 ? std::numeric_limits<std::size_t>::max() : self->m_options.max_batch_size);
+			t_current_executor = previous_executor;
+
+			if (!drained)
+			{
+				self->ScheduleStrand();
+			}
+		});
+	}
+
+	void ModuleExecutor::ThreadLoop(std::weak_ptr<ModuleExecutor> self)
+	{
+		if (m_options.processor >= 0 && !PinCurrentThread(m_options.processor))
+		{
+			LOG(WARNING) << "Module executor thread could not be pinned to processor " << m_options.processor << ".";
+		}
+
+		t_current_executor = this;
+		std::vector<std::function<void()>> batch;
+		while (true)
+		{
+			std::shared_ptr<ModuleExecutor> owner;
+			{
+				absl::MutexLock lock(&m_mutex);
+				m_mutex.Await(absl::Condition(+[](ModuleExecutor* executor) { return !executor->m_tasks.empty() || executor->m_stopping; }, this));
+				if (m_tasks.empty())
+				{
+					return;
+				}
+				batch.swap(m_tasks);
+				owner = self.lock();
+			}
+
+			for (std::function<void()>& task : batch)
+			{
+				task();
+			}
+			batch.clear();
+
+			// Without an owner the destructor is already joining this thread on another thread.
+			if (owner != nullptr)
+			{
+				t_destroyed_on_own_thread = false;
+				owner.reset();
+				if (t_destroyed_on_own_thread)
+				{
+					return;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,227 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_factory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * Head of the registration list.
+		 * Constant initialized, so it is usable before any dynamic initializer runs.
+		 */
+		std::atomic<ModuleFactory*> g_factory_list{ nullptr };
+
+		/**
+		 * Marks the registration list as sealed, only its address is used.
+		 */
+		alignas(ModuleFactory) char g_sealed_marker[sizeof(ModuleFactory)];
+
+		ModuleFactory* SealedMarker()
+		{
+			return reinterpret_cast<ModuleFactory*>(g_sealed_marker);
+		}
+	}
+
+	ModuleFactoryTable::ModuleFactoryTable()
+	{
+		ModuleFactory* factory = g_factory_list.exchange(SealedMarker(), std::memory_order_acq_rel);
+		for (; factory != nullptr; factory = factory->next)
+		{
+			m_factories.push_back(factory);
+		}
+
+		std::sort(m_factories.begin(), m_factories.end(), [](const ModuleFactory* lhs, const ModuleFactory* rhs)
+			{
+				return lhs->info.ModuleHash() < rhs->info.ModuleHash();
+			});
+
+		// The same module may be registered by several translation units, only one of the registrations is kept.
+		const auto duplicate = [](const ModuleFactory* lhs, const ModuleFactory* rhs)
+			{
+				if (lhs->info.ModuleHash() != rhs->info.ModuleHash())
+				{
+					return false;
+				}
+				LOG(ERROR) << "The module: " << rhs->info.ModuleName() << " is registered more than once";
+				return true;
+			};
+		m_factories.erase(std::unique(m_factories.begin(), m_factories.end(), duplicate), m_factories.end());
+
+		BuildNameTable();
+	}
+
+	void ModuleFactoryTable::BuildNameTable()
+	{
+		std::vector<std::pair<std::uint64_t, const ModuleFactory*>> names;
+		names.reserve(m_factories.size());
+		for (const ModuleFactory* factory : m_factories)
+		{
+			names.emplace_back(detail::HashModuleName(factory->name), factory);
+		}
+		std::sort(names.begin(), names.end(), [](const auto& lhs, const auto& rhs)
+			{
+				return lhs.first < rhs.first || (lhs.first == rhs.first && lhs.second->name < rhs.second->name);
+			});
+		// Names with the same hash can never be told apart by a displacement, colliding names are dropped as well.
+		const auto duplicate = [](const auto& lhs, const auto& rhs)
+			{
+				if (lhs.first != rhs.first)
+				{
+					return false;
+				}
+				LOG(ERROR) << "The modules: " << lhs.second->info.ModuleName() << " and " << rhs.second->info.ModuleName()
+					<< " are registered under the same name or names with the same hash: " << rhs.second->name << ", the name refers to the first one";
+				return true;
+			};
+		names.erase(std::unique(names.begin(), names.end(), duplicate), names.end());
+		if (names.empty())
+		{
+			return;
+		}
+
+		// Buckets of about two names each, placed into a table with a load factor of 0.8.
+		// Buckets are placed largest first, each one searches for a displacement that moves all its names into free slots.
+		const std::size_t bucket_count = names.size() / 2 + 1;
+		std::size_t slot_count = names.size() + names.size() / 4 + 1;
+		std::vector<std::vector<std::size_t>> buckets(bucket_count);
+		for (std::size_t index = 0; index < names.size(); ++index)
+		{
+			buckets[names[index].first % bucket_count].push_back(index);
+		}
+		std::vector<std::size_t> bucket_order(bucket_count);
+		for (std::size_t bucket = 0; bucket < bucket_count; ++bucket)
+		{
+			bucket_order[bucket] = bucket;
+		}
+		std::stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](std::size_t lhs, std::size_t rhs)
+			{
+				return buckets[lhs].size() > buckets[rhs].size();
+			});
+
+		constexpr std::uint32_t kMaxDisplacement = 1u << 16;
+		std::vector<std::size_t> bucket_slots;
+		bool placed = false;
+		while (!placed)
+		{
+			m_name_displacements.assign(bucket_count, 0);
+			m_name_slots.assign(slot_count, nullptr);
+			placed = true;
+			for (const std::size_t bucket : bucket_order)
+			{
+				if (buckets[bucket].empty())
+				{
+					break;
+				}
+
+				std::uint32_t displacement = 0;
+				for (; displacement < kMaxDisplacement; ++displacement)
+				{
+					bucket_slots.clear();
+					bool fits = true;
+					for (const std::size_t index : buckets[bucket])
+					{
+						const std::size_t slot = NameSlot(names[index].first, displacement, slot_count);
+						if (m_name_slots[slot] != nullptr || std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end())
+						{
+							fits = false;
+							break;
+						}
+						bucket_slots.push_back(slot);
+					}
+					if (fits)
+					{
+						break;
+					}
+				}
+
+				// Practically unreachable, a larger table always fits eventually.
+				if (displacement == kMaxDisplacement)
+				{
+					slot_count *= 2;
+					placed = false;
+					break;
+				}
+
+				m_name_displacements[bucket] = displacement;
+				for (std::size_t position = 0; position < bucket_slots.size(); ++position)
+				{
+					m_name_slots[bucket_slots[position]] = names[buckets[bucket][position]].second;
+				}
+			}
+		}
+	}
+
+	const ModuleFactoryTable& ModuleFactoryTable::Get()
+	{
+		// Intentionally leaked, modules may be loaded from static destructors.
+		static const ModuleFactoryTable* table = new ModuleFactoryTable();
+		return *table;
+	}
+
+	bool ModuleFactoryTable::Add(ModuleFactory& factory)
+	{
+		ModuleFactory* head = g_factory_list.load(std::memory_order_acquire);
+		do
+		{
+			if (head == SealedMarker())
+			{
+				return false;
+			}
+			factory.next = head;
+		} while (!g_factory_list.compare_exchange_weak(head, &factory, std::memory_order_acq_rel, std::memory_order_acquire));
+		return true;
+	}
+
+	bool ModuleFactoryTable::IsRegistered(const ModuleInfo& info)
+	{
+		ModuleFactory* factory = g_factory_list.load(std::memory_order_acquire);
+		if (factory == SealedMarker())
+		{
+			return Get().Find(info) != nullptr;
+		}
+
+		// Factories are fully written before they are linked and never unlinked, walking the list needs no lock.
+		for (; factory != nullptr; factory = factory->next)
+		{
+			if (factory->info.ModuleHash() == info.ModuleHash())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const ModuleFactory* ModuleFactoryTable::Find(const ModuleInfo& info) const
+	{
+		const auto iterator = std::lower_bound(m_factories.begin(), m_factories.end(), info.ModuleHash(), [](const ModuleFactory* factory, std::size_t hash)
+			{
+				return factory->info.ModuleHash() < hash;
+			});
+		if (iterator == m_factories.end() || (*iterator)->info.ModuleHash() != info.ModuleHash())
+		{
+			return nullptr;
+		}
+		return *iterator;
+	}
+}
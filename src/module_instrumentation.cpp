@@ -0,0 +1,122 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_instrumentation.h"
+
+#include <algorithm>
+
+#if defined(FKLEAFS_ENABLE_INSTRUMENTATION)
+
+namespace fkleafs
+{
+	namespace
+	{
+		std::atomic<std::uint64_t> g_next_instrumentation_id{ 1 };
+
+		/**
+		 * Lookup record of the calling thread and the instrumentation it belongs to.
+		 * Caches the last instrumentation only, in practice a thread looks up modules of a single manager.
+		 */
+		thread_local std::uint64_t t_lookup_record_owner = 0;
+		thread_local void* t_lookup_record = nullptr;
+	}
+
+	ModuleInstrumentation::ModuleInstrumentation()
+		: m_id(g_next_instrumentation_id.fetch_add(1, std::memory_order_relaxed))
+	{
+	}
+
+	void ModuleInstrumentation::RecordPhase(const ModuleInfo& info, ModulePhase phase, absl::Duration duration)
+	{
+		m_statistics_mutex.Lock();
+		ModuleStatistics& statistics = m_statistics.try_emplace(info, ModuleStatistics{ info }).first->second;
+		switch (phase)
+		{
+		case ModulePhase::kConstruction:
+			statistics.construction_duration += duration;
+			break;
+		case ModulePhase::kStartup:
+			statistics.startup_duration += duration;
+			++statistics.load_count;
+			break;
+		case ModulePhase::kShutdown:
+			statistics.shutdown_duration += duration;
+			++statistics.unload_count;
+			break;
+		case ModulePhase::kTick:
+			statistics.tick_duration += duration;
+			statistics.max_tick_duration = std::max(statistics.max_tick_duration, duration);
+			++statistics.tick_count;
+			break;
+		}
+		m_statistics_mutex.Unlock();
+	}
+
+	void ModuleInstrumentation::RecordLookup(const ModuleInfo& info)
+	{
+		LookupRecord& record = GetLookupRecord();
+		record.mutex.Lock();
+		++record.lookup_counts[info];
+		record.mutex.Unlock();
+	}
+
+	InstrumentationSnapshot ModuleInstrumentation::Snapshot() const
+	{
+		absl::flat_hash_map<ModuleInfo, ModuleStatistics, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> statistics;
+		m_statistics_mutex.Lock();
+		statistics = m_statistics;
+		m_statistics_mutex.Unlock();
+
+		m_lookup_records_mutex.Lock();
+		for (const std::unique_ptr<LookupRecord>& record : m_lookup_records)
+		{
+			record->mutex.Lock();
+			for (const auto& iterator : record->lookup_counts)
+			{
+				statistics.try_emplace(iterator.first, ModuleStatistics{ iterator.first }).first->second.lookup_count += iterator.second;
+			}
+			record->mutex.Unlock();
+		}
+		m_lookup_records_mutex.Unlock();
+
+		InstrumentationSnapshot snapshot;
+		snapshot.modules.reserve(statistics.size());
+		for (const auto& iterator : statistics)
+		{
+			snapshot.modules.push_back(iterator.second);
+		}
+		return snapshot;
+	}
+
+	ModuleInstrumentation::LookupRecord& ModuleInstrumentation::GetLookupRecord()
+	{
+		if (t_lookup_record_owner == m_id)
+		{
+			return *static_cast<LookupRecord*>(t_lookup_record);
+		}
+
+		// Records are never removed, a thread that switches between instrumentations gets a new record each time.
+		// The counts are summed up in the snapshot, so no lookup is lost.
+		m_lookup_records_mutex.Lock();
+		m_lookup_records.push_back(std::make_unique<LookupRecord>());
+		LookupRecord* record = m_lookup_records.back().get();
+		m_lookup_records_mutex.Unlock();
+
+		t_lookup_record_owner = m_id;
+		t_lookup_record = record;
+		return *record;
+	}
+}
+
+#endif
@@ -14,11 +14,2444 @@
 
 #include "module_manager.h"
 
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
 namespace fkleafs
 {
+	namespace
+	{
+		/**
+		 * The module manager of the innermost ModuleManagerScope of the calling thread.
+		 * The starting module and the batch below belong to it.
+		 */
+		thread_local ModuleManager* t_current_manager = nullptr;
+
+		/**
+		 * The module whose OnStartupModule is running on the calling thread.
+		 * Modules loaded while it is set are recorded as its dependencies.
+		 */
+		thread_local const ModuleInfo* t_starting_module = nullptr;
+
+		/**
+		 * The batch whose module is being created or started on the calling thread.
+		 */
+		thread_local ModuleBatch* t_module_batch = nullptr;
+
+		/**
+		 * Adds a value to a 64 bit FNV-1a fingerprint.
+		 *
+		 * @param fingerprint The fingerprint so far.
+		 * @param value The value to add.
+		 * @return The new fingerprint.
+		 */
+		std::uint64_t AddToFingerprint(std::uint64_t fingerprint, std::uint64_t value)
+		{
+			for (int byte = 0; byte < 8; ++byte)
+			{
+				fingerprint ^= (value >> (byte * 8)) & 0xff;
+				fingerprint *= 1099511628211ull;
+			}
+			return fingerprint;
+		}
+	}
+
+	/**
+	 * Modules that are loaded as a single transaction by ModuleManager::LoadModules.
+	 * The batch owns the load latches of all its modules until it is published or rolled back.
+	 */
+	struct ModuleBatch
+	{
+		struct StagedModule
+		{
+			ModuleInfo info;
+			ModuleSlot* slot;
+
+			/**
+			 * Set once the module has been started.
+			 */
+			std::shared_ptr<ModuleInterface> module;
+		};
+
+		/**
+		 * Stages a started module.
+		 *
+		 * @param info The module info of the module.
+		 * @param module The started module.
+		 */
+		void Stage(const ModuleInfo& info, std::shared_ptr<ModuleInterface> module)
+		{
+			mutex.Lock();
+			modules[indices.find(info)->second].module = std::move(module);
+			mutex.Unlock();
+		}
+
+		/**
+		 * Guards the modules while the batch is being started.
+		 */
+		absl::Mutex mutex;
+
+		/**
+		 * Modules in topological order.
+		 */
+		std::vector<StagedModule> modules;
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> indices;
+	};
+
+	ModuleManagerScope::ModuleManagerScope(ModuleManager& manager)
+		: m_previous_manager(t_current_manager)
+		, m_previous_starting_module(t_starting_module)
+		, m_previous_batch(t_module_batch)
+	{
+		// Another module manager does not see the starting module and the batch of the previous one.
+		if (t_current_manager != &manager)
+		{
+			t_current_manager = &manager;
+			t_starting_module = nullptr;
+			t_module_batch = nullptr;
+		}
+	}
+
+	ModuleManagerScope::~ModuleManagerScope()
+	{
+		t_current_manager = m_previous_manager;
+		t_starting_module = m_previous_starting_module;
+		t_module_batch = m_previous_batch;
+	}
+
 	ModuleManager& ModuleManager::Get()
 	{
 		static ModuleManager instance;
 		return instance;
 	}
-}
\ No newline at end of file
+
+	ModuleManager& ModuleManager::Current()
+	{
+		return t_current_manager != nullptr ? *t_current_manager : Get();
+	}
+
+	TearDownReport ModuleManager::TearDown(const TearDownOptions& options)
+	{
+		// No module of a background phase is loaded while the others are shut down.
+		StopPhasedStartup();
+
+		const absl::Time start = absl::Now();
+		const absl::Time deadline = options.deadline == absl::InfiniteDuration() ? absl::InfiniteFuture() : start + options.deadline;
+		TearDownReport report;
+
+		/**
+		 * A module that is part of the teardown.
+		 */
+		struct ShutdownNode
+		{
+			ModuleInfo info;
+			std::shared_ptr<ModuleInterface> module;
+
+			/**
+			 * Indices of the nodes this node depends on, they are shut down after this node.
+			 */
+			std::vector<std::size_t> dependencies;
+
+			/**
+			 * Number of nodes that depend on this node.
+			 */
+			std::size_t dependent_count;
+
+			/**
+			 * Attached modules are only detached, their owner shuts them down.
+			 */
+			bool attached;
+
+			bool started;
+			bool finished;
+			absl::Time started_at;
+			absl::Duration elapsed;
+		};
+
+		// The teardown owns the unload latch of every module it shuts down, like UnloadModule does,
+		// so no UnloadModule, ReloadModule or DetachModule shuts the same module down concurrently.
+		// Loads and unloads in flight are waited out, modules they load meanwhile are picked up by the next pass.
+		absl::flat_hash_map<ModuleInfo, std::uint32_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> latched_modules;
+		absl::flat_hash_set<ModuleInfo, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> skipped_modules;
+		bool latched_module = true;
+		while (latched_module)
+		{
+			latched_module = false;
+			std::vector<std::pair<ModuleInfo, std::uint32_t>> slots;
+			for (RegistryShard& shard : m_shards)
+			{
+				shard.mutex.Lock();
+				slots.insert(slots.end(), shard.module_slot_indices.begin(), shard.module_slot_indices.end());
+				shard.mutex.Unlock();
+			}
+
+			for (const std::pair<ModuleInfo, std::uint32_t>& slot : slots)
+			{
+				if (latched_modules.contains(slot.first) || skipped_modules.contains(slot.first))
+				{
+					continue;
+				}
+				switch (AcquireUnloadLatch(m_module_slots[slot.second]))
+				{
+				case ModuleLatchResult::kAcquired:
+					latched_modules.insert(slot);
+					latched_module = true;
+					break;
+				case ModuleLatchResult::kRecursive:
+					LOG(ERROR) << "The module: " << slot.first.ModuleName() << " is being loaded or unloaded on the same thread and is not shut down by the teardown";
+					skipped_modules.insert(slot.first);
+					break;
+				case ModuleLatchResult::kAlreadyDone:
+					break;
+				}
+			}
+		}
+
+		std::vector<ShutdownNode> nodes;
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> node_indices;
+		absl::flat_hash_map<ModuleInfo, std::vector<ModuleInfo>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> observed_dependencies;
+
+		// All shards are locked at once, so the teardown sees one consistent registry.
+		for (RegistryShard& shard : m_shards)
+		{
+			shard.mutex.Lock();
+		}
+		for (const RegistryShard& shard : m_shards)
+		{
+			const ModuleMap* modules = shard.modules.load(std::memory_order_relaxed);
+			nodes.reserve(nodes.size() + modules->size());
+			for (const auto& iterator : *modules)
+			{
+				// Modules loaded after the latches have been taken are not part of the teardown.
+				if (!latched_modules.contains(iterator.first))
+				{
+					continue;
+				}
+				node_indices.emplace(iterator.first, nodes.size());
+				nodes.push_back(ShutdownNode{ iterator.first, iterator.second, {}, 0, shard.attached_modules.contains(iterator.first), false, false, absl::InfinitePast(), absl::ZeroDuration() });
+			}
+			observed_dependencies.insert(shard.observed_dependencies.begin(), shard.observed_dependencies.end());
+		}
+		for (auto iterator = m_shards.rbegin(); iterator != m_shards.rend(); ++iterator)
+		{
+			iterator->mutex.Unlock();
+		}
+
+		// A loaded slot is always published, hand back a latch that has no module anyway instead of blocking the slot forever.
+		for (const auto& iterator : latched_modules)
+		{
+			if (!node_indices.contains(iterator.first))
+			{
+				ReleaseLatch(m_module_slots[iterator.second], ModuleSlotState::kUnloaded);
+			}
+		}
+
+		if (nodes.empty())
+		{
+			report.duration = absl::Now() - start;
+			return report;
+		}
+
+		// Wire up declared and observed dependencies between the loaded modules.
+		const auto add_dependency = [&nodes, &node_indices](std::size_t index, const ModuleInfo& dependency)
+			{
+				const auto iterator = node_indices.find(dependency);
+				if (iterator == node_indices.end() || iterator->second == index)
+				{
+					return;
+				}
+				std::vector<std::size_t>& dependencies = nodes[index].dependencies;
+				if (std::find(dependencies.begin(), dependencies.end(), iterator->second) == dependencies.end())
+				{
+					dependencies.push_back(iterator->second);
+					++nodes[iterator->second].dependent_count;
+				}
+			};
+
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			RegisteredModule registration;
+			if (FindRegisteredModule(nodes[index].info, registration))
+			{
+				for (const ModuleInfo& dependency : registration.dependencies)
+				{
+					add_dependency(index, dependency);
+				}
+			}
+		}
+
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			const auto iterator = observed_dependencies.find(nodes[index].info);
+			if (iterator != observed_dependencies.end())
+			{
+				for (const ModuleInfo& dependency : iterator->second)
+				{
+					add_dependency(index, dependency);
+				}
+			}
+		}
+
+		// Modules on a dependency cycle cannot be ordered, they are shut down without ordering constraints among each other.
+		std::vector<std::size_t> remaining_dependents(nodes.size());
+		std::vector<std::size_t> ready;
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			remaining_dependents[index] = nodes[index].dependent_count;
+			if (remaining_dependents[index] == 0)
+			{
+				ready.push_back(index);
+			}
+		}
+		for (std::size_t position = 0; position < ready.size(); ++position)
+		{
+			for (const std::size_t dependency : nodes[ready[position]].dependencies)
+			{
+				if (--remaining_dependents[dependency] == 0)
+				{
+					ready.push_back(dependency);
+				}
+			}
+		}
+		if (ready.size() != nodes.size())
+		{
+			for (std::size_t index = 0; index < nodes.size(); ++index)
+			{
+				if (remaining_dependents[index] != 0)
+				{
+					LOG(WARNING) << "The module: " << nodes[index].info.ModuleName() << " is part of a dependency cycle, its shutdown order is unspecified";
+					nodes[index].dependencies.clear();
+					nodes[index].dependent_count = 0;
+				}
+			}
+		}
+
+		/**
+		 * State shared by all shutdown tasks.
+		 * Owned by the tasks, tasks that overrun the global deadline keep it alive after TearDown returned.
+		 * Such tasks still finish the shutdown they have started, which touches the event bus, the instrumentation
+		 * and the arena of the module. The destructor of the module manager joins the pool before any of them is destroyed.
+		 */
+		struct ShutdownExecution : std::enable_shared_from_this<ShutdownExecution>
+		{
+			ModuleManager* manager = nullptr;
+			ThreadPool* pool = nullptr;
+			std::unique_ptr<std::atomic<std::size_t>[]> remaining_dependents;
+
+			/**
+			 * Guards nodes, unfinished_nodes and abandoned.
+			 */
+			absl::Mutex mutex;
+			std::vector<ShutdownNode> nodes;
+			std::size_t unfinished_nodes = 0;
+
+			/**
+			 * Set once TearDown gave up waiting, tasks must not touch the manager afterwards.
+			 */
+			bool abandoned = false;
+
+			void Schedule(std::size_t index)
+			{
+				std::shared_ptr<ShutdownExecution> self = shared_from_this();
+				pool->Schedule([self, index]()
+					{
+						self->Run(index);
+					});
+			}
+
+			void Run(std::size_t index)
+			{
+				mutex.Lock();
+				if (abandoned)
+				{
+					mutex.Unlock();
+					return;
+				}
+				ShutdownNode& node = nodes[index];
+				node.started = true;
+				node.started_at = absl::Now();
+				std::shared_ptr<ModuleInterface> module = std::move(node.module);
+				mutex.Unlock();
+
+				manager->m_event_bus.Unsubscribe(*module);
+				StopModuleExecutor(*module);
+				if (!node.attached)
+				{
+					const ModuleManagerScope scope(*manager);
+					ModuleInstrumentation::ScopedPhase phase(manager->m_instrumentation, node.info, ModulePhase::kShutdown);
+					module->OnShutdownModule();
+				}
+				const absl::Time finished_at = absl::Now();
+
+				// The registry holds the last reference, the module is destroyed once it has been unpublished.
+				module.reset();
+
+				mutex.Lock();
+				node.finished = true;
+				node.elapsed = finished_at - node.started_at;
+				const bool publish = !abandoned;
+				if (publish)
+				{
+					// Dependencies stay visible until all their dependents have been shut down.
+					manager->UnpublishModule(node.info);
+					--unfinished_nodes;
+				}
+				const std::vector<std::size_t> dependencies = node.dependencies;
+				mutex.Unlock();
+
+				if (publish)
+				{
+					for (const std::size_t dependency : dependencies)
+					{
+						if (remaining_dependents[dependency].fetch_sub(1, std::memory_order_acq_rel) == 1)
+						{
+							Schedule(dependency);
+						}
+					}
+				}
+			}
+		};
+
+		ThreadPool& pool = GetThreadPool();
+		std::shared_ptr<ShutdownExecution> execution = std::make_shared<ShutdownExecution>();
+		execution->manager = this;
+		execution->pool = &pool;
+		execution->remaining_dependents = std::make_unique<std::atomic<std::size_t>[]>(nodes.size());
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			execution->remaining_dependents[index].store(nodes[index].dependent_count, std::memory_order_relaxed);
+		}
+		execution->unfinished_nodes = nodes.size();
+		execution->nodes = std::move(nodes);
+
+		execution->mutex.Lock();
+		for (std::size_t index = 0; index < execution->nodes.size(); ++index)
+		{
+			if (execution->nodes[index].dependent_count == 0)
+			{
+				execution->Schedule(index);
+			}
+		}
+
+		const absl::Condition finished(+[](std::size_t* unfinished_nodes) { return *unfinished_nodes == 0; }, &execution->unfinished_nodes);
+		while (execution->unfinished_nodes != 0)
+		{
+			// A worker of the pool must help, otherwise the teardown could wait for its own thread.
+			if (pool.IsWorkerThread())
+			{
+				execution->mutex.Unlock();
+				const bool ran_task = pool.TryRunPendingTask();
+				execution->mutex.Lock();
+				if (ran_task)
+				{
+					continue;
+				}
+			}
+
+			const absl::Time wait_until = pool.IsWorkerThread() ? std::min(deadline, absl::Now() + absl::Milliseconds(1)) : deadline;
+			if (!execution->mutex.AwaitWithDeadline(finished, wait_until) && absl::Now() >= deadline)
+			{
+				break;
+			}
+		}
+
+		const absl::Time now = absl::Now();
+		std::vector<ModuleInfo> abandoned_modules;
+		if (execution->unfinished_nodes != 0)
+		{
+			execution->abandoned = true;
+		}
+		for (ShutdownNode& node : execution->nodes)
+		{
+			const absl::Duration elapsed = node.finished ? node.elapsed : (node.started ? now - node.started_at : absl::ZeroDuration());
+			if (elapsed > options.module_deadline)
+			{
+				report.overran_modules.push_back(node.info);
+			}
+			if (!node.finished)
+			{
+				report.unfinished_modules.push_back(node.info);
+				abandoned_modules.push_back(node.info);
+				node.module.reset();
+			}
+		}
+		execution->mutex.Unlock();
+
+		for (const ModuleInfo& info : abandoned_modules)
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " did not shut down before the teardown deadline";
+			UnpublishModule(info);
+		}
+
+		// Wait for in-flight lookups, so that all modules are destroyed when TearDown returns.
+		EpochDomain::Get().Synchronize();
+
+		// Modules that are still referenced or still shutting down in the background keep the arenas alive.
+		m_module_arena.Release();
+		m_interleaved_module_arena.Release();
+		if (m_numa_module_arenas != nullptr)
+		{
+			for (std::uint32_t node = 0; node < NumaTopology::NodeCount(); ++node)
+			{
+				m_numa_module_arenas[node].Release();
+			}
+		}
+
+		report.duration = absl::Now() - start;
+		return report;
+	}
+
+	bool ModuleManager::LoadModulesByName(absl::Span<const std::string_view> names)
+	{
+		std::vector<ModuleInfo> infos(names.size(), ModuleInfo::FromName(std::string_view()));
+		for (std::size_t index = 0; index < names.size(); ++index)
+		{
+			if (!FindModuleInfo(names[index], infos[index]))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "No module is registered under the name: " << names[index] << ", no module of the batch is loaded";
+				return false;
+			}
+		}
+		return LoadModules(infos);
+	}
+
+	bool ModuleManager::LoadModulesParallel(absl::Span<const ModuleInfo> infos, ThreadPool& pool)
+	{
+		std::vector<StartupNode> nodes;
+		if (!BuildStartupGraph(infos, nodes))
+		{
+			return false;
+		}
+		return RunStartupGraph(std::move(nodes), &pool);
+	}
+
+	std::future<ModuleHandle<ModuleInterface>> ModuleManager::LoadModuleAsync(const ModuleInfo& info, ThreadPool& pool)
+	{
+		return LoadModuleAsync<ModuleInterface>(pool, info);
+	}
+
+	bool ModuleManager::LoadModules(absl::Span<const ModuleInfo> infos, ThreadPool& pool)
+	{
+		std::vector<StartupNode> nodes;
+		std::vector<ModuleSlot*> slots;
+		while (true)
+		{
+			if (!BuildStartupGraph(infos, nodes))
+			{
+				return false;
+			}
+			if (nodes.empty())
+			{
+				return true;
+			}
+
+			// Latches are acquired in hash order, so that overlapping batches cannot dead lock each other.
+			std::vector<std::size_t> order(nodes.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&nodes](std::size_t lhs, std::size_t rhs)
+				{
+					return nodes[lhs].info.ModuleHash() < nodes[rhs].info.ModuleHash();
+				});
+
+			slots.assign(nodes.size(), nullptr);
+			ModuleLatchResult latch_result = ModuleLatchResult::kAcquired;
+			for (const std::size_t index : order)
+			{
+				ModuleSlot* slot = GetModuleSlot(nodes[index].info);
+				latch_result = slot != nullptr ? AcquireLoadLatch(*slot) : ModuleLatchResult::kRecursive;
+				if (latch_result != ModuleLatchResult::kAcquired)
+				{
+					if (slot != nullptr && latch_result == ModuleLatchResult::kRecursive)
+					{
+						LOG(ERROR) << "The module: " << nodes[index].info.ModuleName() << " is already being loaded or unloaded on the calling thread";
+					}
+					break;
+				}
+				slots[index] = slot;
+			}
+			if (latch_result == ModuleLatchResult::kAcquired)
+			{
+				break;
+			}
+
+			for (ModuleSlot* slot : slots)
+			{
+				if (slot != nullptr)
+				{
+					ReleaseLatch(*slot, ModuleSlotState::kUnloaded);
+				}
+			}
+			if (latch_result == ModuleLatchResult::kRecursive)
+			{
+				return false;
+			}
+			// A module has been loaded by another thread in the meantime, it is no longer part of the batch.
+		}
+
+		ModuleBatch batch;
+		batch.modules.reserve(nodes.size());
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			batch.indices.emplace(nodes[index].info, index);
+			batch.modules.push_back(ModuleBatch::StagedModule{ nodes[index].info, slots[index], nullptr });
+		}
+
+		if (!RunStartupGraph(std::move(nodes), &pool, &batch))
+		{
+			LOG(ERROR) << "Failed to load a batch of " << batch.modules.size() << " modules, no module of the batch has been loaded";
+			RollbackBatch(batch);
+			return false;
+		}
+
+		PublishBatch(batch);
+		return true;
+	}
+
+	std::shared_ptr<ModuleInterface> ModuleManager::FindStagedModule(const ModuleInfo& info, bool& staged)
+	{
+		staged = false;
+		ModuleBatch* batch = t_current_manager == this ? t_module_batch : nullptr;
+		if (batch == nullptr)
+		{
+			return nullptr;
+		}
+
+		batch->mutex.Lock();
+		const auto iterator = batch->indices.find(info);
+		if (iterator == batch->indices.end())
+		{
+			batch->mutex.Unlock();
+			return nullptr;
+		}
+		std::shared_ptr<ModuleInterface> module = batch->modules[iterator->second].module;
+		batch->mutex.Unlock();
+
+		staged = true;
+		if (module == nullptr)
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " is part of the batch being loaded and has not been started yet, it has to be declared as a dependency";
+			return nullptr;
+		}
+
+		if (t_starting_module != nullptr)
+		{
+			RecordObservedDependency(*t_starting_module, info);
+		}
+		return module;
+	}
+
+	void ModuleManager::PublishBatch(ModuleBatch& batch)
+	{
+		// Every shard is copied once for the whole batch.
+		std::array<std::vector<const ModuleBatch::StagedModule*>, kRegistryShardCount> shard_modules;
+		for (const ModuleBatch::StagedModule& staged_module : batch.modules)
+		{
+			shard_modules[staged_module.info.ModuleHash() % kRegistryShardCount].push_back(&staged_module);
+		}
+
+		for (std::size_t shard_index = 0; shard_index < kRegistryShardCount; ++shard_index)
+		{
+			if (shard_modules[shard_index].empty())
+			{
+				continue;
+			}
+
+			RegistryShard& shard = m_shards[shard_index];
+			shard.mutex.Lock();
+			ModuleMap* modules = new ModuleMap(*shard.modules.load(std::memory_order_relaxed));
+			modules->reserve(modules->size() + shard_modules[shard_index].size());
+			for (const ModuleBatch::StagedModule* staged_module : shard_modules[shard_index])
+			{
+				if (modules->emplace(staged_module->info, staged_module->module).second)
+				{
+					UpdateModuleSlot(shard, staged_module->info, staged_module->module.get());
+					UpdateServices(staged_module->info, nullptr, staged_module->module);
+				}
+			}
+			PublishModules(shard, modules);
+			shard.mutex.Unlock();
+		}
+
+		// Threads waiting on a latch find the modules in the registry as soon as they wake up.
+		for (const ModuleBatch::StagedModule& staged_module : batch.modules)
+		{
+			ReleaseLatch(*staged_module.slot, ModuleSlotState::kLoaded);
+		}
+
+		EpochDomain::Get().Reclaim();
+	}
+
+	void ModuleManager::RollbackBatch(ModuleBatch& batch)
+	{
+		const ModuleManagerScope scope(*this);
+
+		// Dependents are shut down first, their dependencies of the batch stay visible to them meanwhile.
+		ModuleBatch* parent_batch = t_module_batch;
+		t_module_batch = &batch;
+		for (auto iterator = batch.modules.rbegin(); iterator != batch.modules.rend(); ++iterator)
+		{
+			std::shared_ptr<ModuleInterface> module_ptr = iterator->module;
+			if (module_ptr != nullptr)
+			{
+				m_event_bus.Unsubscribe(*module_ptr);
+				StopModuleExecutor(*module_ptr);
+				ModuleInstrumentation::ScopedPhase phase(m_instrumentation, iterator->info, ModulePhase::kShutdown);
+				module_ptr->OnShutdownModule();
+				batch.Stage(iterator->info, nullptr);
+			}
+		}
+		t_module_batch = parent_batch;
+
+		for (const ModuleBatch::StagedModule& staged_module : batch.modules)
+		{
+			RegistryShard& shard = GetShard(staged_module.info);
+			shard.mutex.Lock();
+			shard.observed_dependencies.erase(staged_module.info);
+			ReleaseLatch(*staged_module.slot, ModuleSlotState::kUnloaded);
+			shard.mutex.Unlock();
+		}
+	}
+
+	bool ModuleManager::LoadAllModulesParallel()
+	{
+		return LoadModulesParallel(RegisteredModuleInfos());
+	}
+
+	bool ModuleManager::StartupPhases(ThreadPool& pool, const PhasedStartupOptions& options)
+	{
+		std::array<std::vector<ModuleInfo>, 3> phases;
+		for (const ModuleFactory* factory : ModuleFactoryTable::Get().Factories())
+		{
+			phases[static_cast<std::size_t>(factory->phase)].push_back(factory->info);
+		}
+		for (const RegistryShard& shard : m_shards)
+		{
+			shard.registered_modules_mutex.ReaderLock();
+			for (const auto& iterator : shard.registered_modules)
+			{
+				phases[static_cast<std::size_t>(ModuleStartupPhase::kDefault)].push_back(iterator.first);
+			}
+			shard.registered_modules_mutex.ReaderUnlock();
+		}
+
+		PhasedStartup& startup = m_phased_startup;
+		startup.mutex.Lock();
+		if (startup.pool != nullptr && !startup.complete.load(std::memory_order_relaxed))
+		{
+			startup.mutex.Unlock();
+			LOG(ERROR) << "The phased startup is already running";
+			return false;
+		}
+		std::unique_ptr<ThreadPool> previous_pool = std::move(startup.pool);
+		// Queued before the critical phase, so lookups during the critical phase already load them on demand.
+		startup.queue.clear();
+		startup.modules.clear();
+		for (const std::size_t phase : { static_cast<std::size_t>(ModuleStartupPhase::kDefault), static_cast<std::size_t>(ModuleStartupPhase::kBackground) })
+		{
+			for (const ModuleInfo& info : phases[phase])
+			{
+				if (startup.modules.emplace(info, true).second)
+				{
+					startup.queue.push_back(info);
+				}
+			}
+		}
+		startup.failed = false;
+		startup.stopping = false;
+		startup.ready.store(false, std::memory_order_release);
+		startup.complete.store(false, std::memory_order_release);
+		startup.mutex.Unlock();
+
+		// The workers of a previous startup are idle, they are joined outside of the mutex.
+		previous_pool.reset();
+
+		const bool ready = LoadModulesParallel(phases[static_cast<std::size_t>(ModuleStartupPhase::kCritical)], pool);
+		startup.ready.store(ready, std::memory_order_release);
+		if (!ready)
+		{
+			LOG(ERROR) << "Failed to load the critical startup phase, the background phases are not loaded";
+			startup.mutex.Lock();
+			startup.queue.clear();
+			startup.modules.clear();
+			startup.failed = true;
+			startup.complete.store(true, std::memory_order_release);
+			startup.mutex.Unlock();
+			return false;
+		}
+
+		// One task per queued module, every task loads the module at the front of the queue at the time it runs.
+		startup.mutex.Lock();
+		startup.remaining_tasks = startup.queue.size();
+		if (startup.remaining_tasks == 0)
+		{
+			startup.modules.clear();
+			startup.complete.store(true, std::memory_order_release);
+			startup.mutex.Unlock();
+			return true;
+		}
+		startup.pool = std::make_unique<ThreadPool>(std::max<std::size_t>(options.background_threads, 1), options.background_priority);
+		for (std::size_t task = 0; task < startup.remaining_tasks; ++task)
+		{
+			startup.pool->Schedule([this]()
+				{
+					LoadNextPhasedModule();
+				});
+		}
+		startup.mutex.Unlock();
+		return true;
+	}
+
+	bool ModuleManager::WaitForStartup(absl::Duration timeout)
+	{
+		PhasedStartup& startup = m_phased_startup;
+		const absl::Condition complete(+[](std::atomic<bool>* complete) { return complete->load(std::memory_order_acquire); }, &startup.complete);
+		if (!startup.mutex.LockWhenWithTimeout(complete, timeout))
+		{
+			startup.mutex.Unlock();
+			return false;
+		}
+		const bool failed = startup.failed;
+		startup.mutex.Unlock();
+		return !failed;
+	}
+
+	void ModuleManager::LoadNextPhasedModule()
+	{
+		PhasedStartup& startup = m_phased_startup;
+		startup.mutex.Lock();
+		bool found = false;
+		ModuleInfo info = ModuleInfo::FromName("");
+		while (!startup.stopping && !startup.queue.empty())
+		{
+			info = startup.queue.front();
+			startup.queue.pop_front();
+			bool& queued = startup.modules.find(info)->second;
+			if (queued)
+			{
+				queued = false;
+				found = true;
+				break;
+			}
+		}
+		startup.mutex.Unlock();
+
+		const bool loaded = !found || LoadModuleIfNeeded(info);
+
+		startup.mutex.Lock();
+		startup.failed = startup.failed || !loaded;
+		const bool complete = --startup.remaining_tasks == 0;
+		if (complete)
+		{
+			startup.modules.clear();
+			startup.complete.store(true, std::memory_order_release);
+		}
+		startup.mutex.Unlock();
+	}
+
+	bool ModuleManager::TakePhasedModule(const ModuleInfo& info)
+	{
+		PhasedStartup& startup = m_phased_startup;
+		absl::MutexLock lock(&startup.mutex);
+		const auto iterator = startup.modules.find(info);
+		if (iterator == startup.modules.end())
+		{
+			return false;
+		}
+		iterator->second = false;
+		return true;
+	}
+
+	void ModuleManager::StopPhasedStartup()
+	{
+		PhasedStartup& startup = m_phased_startup;
+		startup.mutex.Lock();
+		startup.stopping = true;
+		startup.failed = startup.failed || !startup.complete.load(std::memory_order_relaxed);
+		std::unique_ptr<ThreadPool> pool = std::move(startup.pool);
+		startup.mutex.Unlock();
+
+		// The remaining tasks find the queue stopped and return right away.
+		pool.reset();
+
+		startup.mutex.Lock();
+		startup.queue.clear();
+		startup.modules.clear();
+		startup.complete.store(true, std::memory_order_release);
+		startup.mutex.Unlock();
+	}
+
+	std::vector<ModuleInfo> ModuleManager::RegisteredModuleInfos() const
+	{
+		const absl::Span<const ModuleFactory* const> factories = ModuleFactoryTable::Get().Factories();
+		std::vector<ModuleInfo> infos;
+		infos.reserve(factories.size());
+		for (const ModuleFactory* factory : factories)
+		{
+			infos.push_back(factory->info);
+		}
+		for (const RegistryShard& shard : m_shards)
+		{
+			shard.registered_modules_mutex.ReaderLock();
+			for (const auto& iterator : shard.registered_modules)
+			{
+				infos.push_back(iterator.first);
+			}
+			shard.registered_modules_mutex.ReaderUnlock();
+		}
+		return infos;
+	}
+
+	std::uint64_t ModuleManager::RegistryFingerprint() const
+	{
+		std::vector<ModuleInfo> infos = RegisteredModuleInfos();
+		std::sort(infos.begin(), infos.end(), [](const ModuleInfo& lhs, const ModuleInfo& rhs)
+			{
+				return lhs.ModuleHash() < rhs.ModuleHash();
+			});
+
+		std::uint64_t fingerprint = 14695981039346656037ull;
+		for (const ModuleInfo& info : infos)
+		{
+			fingerprint = AddToFingerprint(fingerprint, info.ModuleHash());
+
+			RegisteredModule registration;
+			FindRegisteredModule(info, registration);
+			std::vector<std::size_t> dependency_hashes;
+			dependency_hashes.reserve(registration.dependencies.size());
+			for (const ModuleInfo& dependency : registration.dependencies)
+			{
+				dependency_hashes.push_back(dependency.ModuleHash());
+			}
+			std::sort(dependency_hashes.begin(), dependency_hashes.end());
+			fingerprint = AddToFingerprint(fingerprint, dependency_hashes.size());
+			for (const std::size_t dependency_hash : dependency_hashes)
+			{
+				fingerprint = AddToFingerprint(fingerprint, dependency_hash);
+			}
+		}
+		return fingerprint;
+	}
+
+	StartupManifest ModuleManager::CreateStartupManifest() const
+	{
+		std::vector<ModuleInfo> infos;
+		std::vector<absl::Duration> startup_costs;
+		absl::flat_hash_map<ModuleInfo, std::vector<ModuleInfo>, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> observed_dependencies;
+		for (const RegistryShard& shard : m_shards)
+		{
+			shard.mutex.Lock();
+		}
+		for (const RegistryShard& shard : m_shards)
+		{
+			for (const auto& iterator : *shard.modules.load(std::memory_order_relaxed))
+			{
+				if (shard.attached_modules.contains(iterator.first))
+				{
+					continue;
+				}
+				const auto cost_iterator = shard.startup_costs.find(iterator.first);
+				infos.push_back(iterator.first);
+				startup_costs.push_back(cost_iterator != shard.startup_costs.end() ? cost_iterator->second : absl::ZeroDuration());
+			}
+			observed_dependencies.insert(shard.observed_dependencies.begin(), shard.observed_dependencies.end());
+		}
+		for (auto iterator = m_shards.rbegin(); iterator != m_shards.rend(); ++iterator)
+		{
+			iterator->mutex.Unlock();
+		}
+
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> indices;
+		for (std::size_t index = 0; index < infos.size(); ++index)
+		{
+			indices.emplace(infos[index], index);
+		}
+
+		// Wire up declared and observed dependencies between the loaded modules.
+		std::vector<std::vector<std::size_t>> dependencies(infos.size());
+		std::vector<std::vector<std::size_t>> dependents(infos.size());
+		const auto add_dependency = [&indices, &dependencies, &dependents](std::size_t index, const ModuleInfo& dependency)
+			{
+				const auto iterator = indices.find(dependency);
+				if (iterator == indices.end() || iterator->second == index)
+				{
+					return;
+				}
+				std::vector<std::size_t>& module_dependencies = dependencies[index];
+				if (std::find(module_dependencies.begin(), module_dependencies.end(), iterator->second) == module_dependencies.end())
+				{
+					module_dependencies.push_back(iterator->second);
+					dependents[iterator->second].push_back(index);
+				}
+			};
+		for (std::size_t index = 0; index < infos.size(); ++index)
+		{
+			RegisteredModule registration;
+			if (FindRegisteredModule(infos[index], registration))
+			{
+				for (const ModuleInfo& dependency : registration.dependencies)
+				{
+					add_dependency(index, dependency);
+				}
+			}
+			const auto iterator = observed_dependencies.find(infos[index]);
+			if (iterator != observed_dependencies.end())
+			{
+				for (const ModuleInfo& dependency : iterator->second)
+				{
+					add_dependency(index, dependency);
+				}
+			}
+		}
+
+		// Kahn's algorithm, modules on a cycle are appended and only keep the dependencies that precede them.
+		std::vector<std::size_t> order;
+		order.reserve(infos.size());
+		std::vector<std::size_t> remaining_dependencies(infos.size());
+		for (std::size_t index = 0; index < infos.size(); ++index)
+		{
+			remaining_dependencies[index] = dependencies[index].size();
+			if (remaining_dependencies[index] == 0)
+			{
+				order.push_back(index);
+			}
+		}
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			for (const std::size_t dependent : dependents[order[position]])
+			{
+				if (--remaining_dependencies[dependent] == 0)
+				{
+					order.push_back(dependent);
+				}
+			}
+		}
+		for (std::size_t index = 0; index < infos.size(); ++index)
+		{
+			if (remaining_dependencies[index] != 0)
+			{
+				LOG(WARNING) << "The module: " << infos[index].ModuleName() << " is part of a dependency cycle, its position in the startup manifest is unspecified";
+				order.push_back(index);
+			}
+		}
+
+		std::vector<std::size_t> positions(infos.size());
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			positions[order[position]] = position;
+		}
+
+		StartupManifest manifest;
+		manifest.registry_fingerprint = RegistryFingerprint();
+		manifest.modules.reserve(order.size());
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			const std::size_t index = order[position];
+			StartupManifestModule module{ std::string(infos[index].ModuleName()), infos[index].ModuleHash(), {}, 0, startup_costs[index] };
+			for (const std::size_t dependency : dependencies[index])
+			{
+				if (positions[dependency] < position)
+				{
+					module.dependencies.push_back(positions[dependency]);
+					module.level = std::max(module.level, manifest.modules[positions[dependency]].level + 1);
+				}
+			}
+			std::sort(module.dependencies.begin(), module.dependencies.end());
+			manifest.modules.push_back(std::move(module));
+		}
+		return manifest;
+	}
+
+	bool ModuleManager::BootModules(absl::Span<const ModuleInfo> infos, const std::string& manifest_path, ThreadPool& pool)
+	{
+		StartupManifest manifest;
+		std::vector<StartupNode> nodes;
+		std::vector<std::pair<ModuleInfo, ModuleInfo>> observed_dependencies;
+		bool loaded = false;
+		if (!StartupManifest::Read(manifest_path, manifest))
+		{
+			LOG(INFO) << "No startup manifest at: " << manifest_path << ", the modules are loaded without it";
+			loaded = LoadModulesParallel(infos, pool);
+		}
+		else if (!BuildManifestStartupGraph(manifest, infos, nodes, observed_dependencies))
+		{
+			loaded = LoadModulesParallel(infos, pool);
+		}
+		else
+		{
+			// A module that requires a module that is already loaded does not observe the dependency again.
+			for (const std::pair<ModuleInfo, ModuleInfo>& dependency : observed_dependencies)
+			{
+				RecordObservedDependency(dependency.first, dependency.second);
+			}
+			loaded = RunStartupGraph(std::move(nodes), &pool);
+		}
+
+		if (loaded && !WriteStartupManifest(manifest_path))
+		{
+			LOG(WARNING) << "Failed to update the startup manifest: " << manifest_path;
+		}
+		return loaded;
+	}
+
+	bool ModuleManager::BuildManifestStartupGraph(const StartupManifest& manifest, absl::Span<const ModuleInfo> roots, std::vector<StartupNode>& nodes,
+		std::vector<std::pair<ModuleInfo, ModuleInfo>>& observed_dependencies)
+	{
+		if (manifest.registry_fingerprint != RegistryFingerprint())
+		{
+			LOG(WARNING) << "The registered modules have changed since the startup manifest has been written, the manifest is ignored";
+			return false;
+		}
+
+		// The infos of the registry own their names, the names of the manifest are only used for diagnostics.
+		absl::flat_hash_map<std::size_t, ModuleInfo> registered_infos;
+		for (const ModuleInfo& info : RegisteredModuleInfos())
+		{
+			registered_infos.emplace(info.ModuleHash(), info);
+		}
+		std::vector<ModuleInfo> infos;
+		infos.reserve(manifest.modules.size());
+		absl::flat_hash_map<std::size_t, std::size_t> manifest_indices;
+		for (const StartupManifestModule& module : manifest.modules)
+		{
+			const auto iterator = registered_infos.find(module.module_hash);
+			if (iterator == registered_infos.end())
+			{
+				LOG(WARNING) << "The module: " << module.module_name << " of the startup manifest is not registered, the manifest is ignored";
+				return false;
+			}
+			manifest_indices.emplace(module.module_hash, infos.size());
+			infos.push_back(iterator->second);
+		}
+
+		std::vector<bool> included(manifest.modules.size(), false);
+		std::vector<std::size_t> pending;
+		for (const ModuleInfo& root : roots)
+		{
+			const auto iterator = manifest_indices.find(root.ModuleHash());
+			if (iterator == manifest_indices.end())
+			{
+				LOG(WARNING) << "The module: " << root.ModuleName() << " is not part of the startup manifest, the manifest is ignored";
+				return false;
+			}
+			pending.push_back(iterator->second);
+		}
+		while (!pending.empty())
+		{
+			const std::size_t index = pending.back();
+			pending.pop_back();
+			if (included[index])
+			{
+				continue;
+			}
+			included[index] = true;
+			pending.insert(pending.end(), manifest.modules[index].dependencies.begin(), manifest.modules[index].dependencies.end());
+		}
+
+		// The manifest is in topological order, dependencies always get their node before their dependents.
+		const std::vector<absl::Duration> critical_path_costs = manifest.CriticalPathCosts();
+		constexpr std::size_t kNoNode = static_cast<std::size_t>(-1);
+		std::vector<std::size_t> node_indices(manifest.modules.size(), kNoNode);
+		nodes.clear();
+		for (std::size_t index = 0; index < manifest.modules.size(); ++index)
+		{
+			if (!included[index] || IsModuleLoaded(infos[index]))
+			{
+				continue;
+			}
+
+			RegisteredModule registration;
+			FindRegisteredModule(infos[index], registration);
+			const std::size_t node_index = nodes.size();
+			node_indices[index] = node_index;
+			nodes.push_back(StartupNode{ infos[index], registration, {}, 0, critical_path_costs[index] });
+
+			for (const std::size_t dependency : manifest.modules[index].dependencies)
+			{
+				if (node_indices[dependency] != kNoNode)
+				{
+					nodes[node_indices[dependency]].dependents.push_back(node_index);
+					++nodes[node_index].dependency_count;
+				}
+
+				const ModuleInfo& dependency_info = infos[dependency];
+				const bool declared = std::any_of(registration.dependencies.begin(), registration.dependencies.end(), [&dependency_info](const ModuleInfo& declared_dependency)
+					{
+						return ModuleInfo::ModuleInfoEqual()(declared_dependency, dependency_info);
+					});
+				if (!declared)
+				{
+					observed_dependencies.emplace_back(infos[index], dependency_info);
+				}
+			}
+		}
+		return true;
+	}
+
+	bool ModuleManager::BuildStartupGraph(absl::Span<const ModuleInfo> roots, std::vector<StartupNode>& nodes)
+	{
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> node_indices;
+		std::vector<ModuleInfo> pending(roots.begin(), roots.end());
+
+		// Collect the modules that are not loaded yet and all their dependencies.
+		std::vector<StartupNode> unordered_nodes;
+		while (!pending.empty())
+		{
+			const ModuleInfo info = pending.back();
+			pending.pop_back();
+			if (node_indices.contains(info) || IsModuleLoaded(info))
+			{
+				continue;
+			}
+
+			RegisteredModule registration;
+			if (!FindRegisteredModule(info, registration))
+			{
+				LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is not registered and cannot be loaded";
+				return false;
+			}
+
+			node_indices.emplace(info, unordered_nodes.size());
+			pending.insert(pending.end(), registration.dependencies.begin(), registration.dependencies.end());
+			unordered_nodes.push_back(StartupNode{ info, std::move(registration), {}, 0, absl::ZeroDuration() });
+		}
+
+		// Wire up the dependencies between the collected modules, loaded dependencies are already satisfied.
+		for (std::size_t index = 0; index < unordered_nodes.size(); ++index)
+		{
+			for (const ModuleInfo& dependency : unordered_nodes[index].registration.dependencies)
+			{
+				const auto iterator = node_indices.find(dependency);
+				if (iterator != node_indices.end())
+				{
+					unordered_nodes[iterator->second].dependents.push_back(index);
+					++unordered_nodes[index].dependency_count;
+				}
+			}
+		}
+
+		// Kahn's algorithm, nodes that are never reached are part of a cycle.
+		std::vector<std::size_t> order;
+		order.reserve(unordered_nodes.size());
+		std::vector<std::size_t> remaining_dependencies(unordered_nodes.size());
+		for (std::size_t index = 0; index < unordered_nodes.size(); ++index)
+		{
+			remaining_dependencies[index] = unordered_nodes[index].dependency_count;
+			if (remaining_dependencies[index] == 0)
+			{
+				order.push_back(index);
+			}
+		}
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			for (const std::size_t dependent : unordered_nodes[order[position]].dependents)
+			{
+				if (--remaining_dependencies[dependent] == 0)
+				{
+					order.push_back(dependent);
+				}
+			}
+		}
+
+		if (order.size() != unordered_nodes.size())
+		{
+			for (std::size_t index = 0; index < unordered_nodes.size(); ++index)
+			{
+				if (remaining_dependencies[index] != 0)
+				{
+					LOG(ERROR) << "The module: " << unordered_nodes[index].info.ModuleName() << " is part of a dependency cycle and cannot be loaded";
+				}
+			}
+			return false;
+		}
+
+		// Store the nodes in topological order.
+		std::vector<std::size_t> positions(unordered_nodes.size());
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			positions[order[position]] = position;
+		}
+		nodes.clear();
+		nodes.reserve(unordered_nodes.size());
+		for (const std::size_t index : order)
+		{
+			nodes.push_back(std::move(unordered_nodes[index]));
+			for (std::size_t& dependent : nodes.back().dependents)
+			{
+				dependent = positions[dependent];
+			}
+		}
+		return true;
+	}
+
+	bool ModuleManager::RunStartupGraph(std::vector<StartupNode> nodes, ThreadPool* pool, ModuleBatch* batch)
+	{
+		if (pool == nullptr)
+		{
+			bool result = true;
+			std::vector<bool> dependency_failed(nodes.size(), false);
+			for (std::size_t index = 0; index < nodes.size(); ++index)
+			{
+				if (dependency_failed[index])
+				{
+					LOG(ERROR) << "The module: " << nodes[index].info.ModuleName() << " cannot be loaded, because a dependency failed to load";
+				}
+				else if (StartupModule(nodes[index], batch))
+				{
+					continue;
+				}
+
+				result = false;
+				for (const std::size_t dependent : nodes[index].dependents)
+				{
+					dependency_failed[dependent] = true;
+				}
+			}
+			return result;
+		}
+
+		/**
+		 * State shared by all startup tasks.
+		 * Owned by the tasks, so it stays valid until the last task finished, independent of the waiting thread.
+		 */
+		struct StartupExecution : std::enable_shared_from_this<StartupExecution>
+		{
+			ModuleManager* manager = nullptr;
+			ThreadPool* pool = nullptr;
+			ModuleBatch* batch = nullptr;
+			std::vector<StartupNode> nodes;
+			std::unique_ptr<std::atomic<std::size_t>[]> remaining_dependencies;
+			std::unique_ptr<std::atomic<bool>[]> dependency_failed;
+			std::atomic<bool> failed{ false };
+
+			absl::Mutex mutex;
+			std::size_t unfinished_nodes = 0;
+
+			void Schedule(std::size_t index)
+			{
+				std::shared_ptr<StartupExecution> self = shared_from_this();
+				pool->Schedule([self, index]()
+					{
+						self->Run(index);
+					});
+			}
+
+			void Run(std::size_t index)
+			{
+				std::vector<std::size_t> ready;
+				while (true)
+				{
+					const StartupNode& node = nodes[index];
+
+					bool succeeded = false;
+					if (dependency_failed[index].load(std::memory_order_acquire))
+					{
+						LOG(ERROR) << "The module: " << node.info.ModuleName() << " cannot be loaded, because a dependency failed to load";
+					}
+					else
+					{
+						succeeded = manager->StartupModule(node, batch);
+					}
+
+					if (!succeeded)
+					{
+						failed.store(true, std::memory_order_release);
+					}
+
+					ready.clear();
+					for (const std::size_t dependent : node.dependents)
+					{
+						if (!succeeded)
+						{
+							dependency_failed[dependent].store(true, std::memory_order_release);
+						}
+						if (remaining_dependencies[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+						{
+							ready.push_back(dependent);
+						}
+					}
+
+					// The ready dependent on the longest critical path continues on this thread, the others go to the pool.
+					SortByCriticalPath(ready);
+					for (std::size_t position = 1; position < ready.size(); ++position)
+					{
+						Schedule(ready[position]);
+					}
+
+					mutex.Lock();
+					--unfinished_nodes;
+					mutex.Unlock();
+
+					if (ready.empty())
+					{
+						return;
+					}
+					index = ready.front();
+				}
+			}
+
+			void SortByCriticalPath(std::vector<std::size_t>& indices) const
+			{
+				std::stable_sort(indices.begin(), indices.end(), [this](std::size_t lhs, std::size_t rhs)
+					{
+						return nodes[lhs].critical_path_cost > nodes[rhs].critical_path_cost;
+					});
+			}
+		};
+
+		std::shared_ptr<StartupExecution> execution = std::make_shared<StartupExecution>();
+		execution->manager = this;
+		execution->pool = pool;
+		execution->batch = batch;
+		execution->remaining_dependencies = std::make_unique<std::atomic<std::size_t>[]>(nodes.size());
+		execution->dependency_failed = std::make_unique<std::atomic<bool>[]>(nodes.size());
+		for (std::size_t index = 0; index < nodes.size(); ++index)
+		{
+			execution->remaining_dependencies[index].store(nodes[index].dependency_count, std::memory_order_relaxed);
+			execution->dependency_failed[index].store(false, std::memory_order_relaxed);
+		}
+		execution->unfinished_nodes = nodes.size();
+		execution->nodes = std::move(nodes);
+
+		std::vector<std::size_t> ready;
+		for (std::size_t index = 0; index < execution->nodes.size(); ++index)
+		{
+			if (execution->nodes[index].dependency_count == 0)
+			{
+				ready.push_back(index);
+			}
+		}
+		execution->SortByCriticalPath(ready);
+		for (const std::size_t index : ready)
+		{
+			execution->Schedule(index);
+		}
+
+		// Help the pool while waiting, the calling thread may itself be a worker of the pool.
+		const absl::Condition finished(+[](std::size_t* unfinished_nodes) { return *unfinished_nodes == 0; }, &execution->unfinished_nodes);
+		while (true)
+		{
+			execution->mutex.Lock();
+			const bool done = execution->unfinished_nodes == 0;
+			execution->mutex.Unlock();
+			if (done)
+			{
+				break;
+			}
+
+			if (!pool->TryRunPendingTask())
+			{
+				execution->mutex.LockWhenWithTimeout(finished, absl::Milliseconds(1));
+				execution->mutex.Unlock();
+			}
+		}
+		return !execution->failed.load(std::memory_order_acquire);
+	}
+
+	bool ModuleManager::UnloadModule(const ModuleInfo& info)
+	{
+		if (IsModuleAttached(info))
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " is attached and cannot be unloaded, its owner has to detach it";
+			return false;
+		}
+
+		ModuleSlot* slot = IsModuleLoaded(info) ? GetModuleSlot(info) : nullptr;
+		const ModuleLatchResult latch_result = slot != nullptr ? AcquireUnloadLatch(*slot) : ModuleLatchResult::kAlreadyDone;
+		if (latch_result == ModuleLatchResult::kRecursive)
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " cannot be unloaded while it is being loaded or unloaded on the same thread";
+			return false;
+		}
+		if (latch_result == ModuleLatchResult::kAlreadyDone)
+		{
+			LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is not loaded and cannot be unloaded";
+			return false;
+		}
+
+		// The module stays visible while it shuts down, the registry is not locked meanwhile.
+		std::shared_ptr<ModuleInterface> module_ptr = FindModule(info).lock();
+		if (module_ptr != nullptr)
+		{
+			m_event_bus.Unsubscribe(*module_ptr);
+			StopModuleExecutor(*module_ptr);
+			const ModuleManagerScope scope(*this);
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, info, ModulePhase::kShutdown);
+			module_ptr->OnShutdownModule();
+			module_ptr.reset();
+		}
+
+		UnpublishModule(info);
+		return true;
+	}
+
+	bool ModuleManager::ReloadModule(const ModuleInfo& info)
+	{
+		const ModuleManagerScope scope(*this);
+		if (IsModuleAttached(info))
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " is attached and cannot be reloaded, it is owned by somebody else";
+			return false;
+		}
+
+		ModuleSlot* slot = IsModuleLoaded(info) ? GetModuleSlot(info) : nullptr;
+		const ModuleLatchResult latch_result = slot != nullptr ? AcquireUnloadLatch(*slot) : ModuleLatchResult::kAlreadyDone;
+		if (latch_result == ModuleLatchResult::kRecursive)
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " cannot be reloaded while it is being loaded or unloaded on the same thread";
+			return false;
+		}
+		if (latch_result == ModuleLatchResult::kAlreadyDone)
+		{
+			LOG_EVERY_N_SEC(ERROR, kMissLogIntervalSeconds) << "The module: " << info.ModuleName() << " is not loaded and cannot be reloaded";
+			return false;
+		}
+
+		RegisteredModule registration;
+		const bool registered = FindRegisteredModule(info, registration);
+
+		std::shared_ptr<ModuleInterface> previous_module_ptr = FindModule(info).lock();
+		std::shared_ptr<ModuleInterface> module_ptr;
+		if (registered && previous_module_ptr != nullptr)
+		{
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, info, ModulePhase::kConstruction);
+			module_ptr = registration.Create();
+		}
+		if (module_ptr == nullptr)
+		{
+			ReleaseLatch(*slot, ModuleSlotState::kLoaded);
+			LOG(ERROR) << "Failed to create a new instance of the module: " << info.ModuleName() << ", the running instance is kept";
+			return false;
+		}
+		module_ptr->m_module_manager = this;
+
+		module_ptr->OnReloadModule(*previous_module_ptr);
+
+		// The dependencies observed during the startup of the new instance replace the ones of the previous instance.
+		RegistryShard& shard = GetShard(info);
+		shard.mutex.Lock();
+		shard.observed_dependencies.erase(info);
+		shard.mutex.Unlock();
+
+		const ModuleInfo* parent_module = t_starting_module;
+		t_starting_module = &info;
+		{
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, info, ModulePhase::kStartup);
+			module_ptr->OnStartupModule();
+		}
+		t_starting_module = parent_module;
+		ReplicateModule(info, registration, *module_ptr);
+
+		// The previous snapshot keeps the previous instance alive until all readers that may still see it have left.
+		shard.mutex.Lock();
+		ModuleMap* modules = new ModuleMap(*shard.modules.load(std::memory_order_relaxed));
+		(*modules)[info] = module_ptr;
+		UpdateModuleSlot(shard, info, module_ptr.get());
+		UpdateServices(info, previous_module_ptr.get(), module_ptr);
+		PublishModules(shard, modules);
+		shard.mutex.Unlock();
+
+		m_event_bus.Unsubscribe(*previous_module_ptr);
+		StopModuleExecutor(*previous_module_ptr);
+		{
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, info, ModulePhase::kShutdown);
+			previous_module_ptr->OnShutdownModule();
+		}
+		previous_module_ptr.reset();
+
+		ReleaseLatch(*slot, ModuleSlotState::kLoaded);
+		EpochDomain::Get().Reclaim();
+		return true;
+	}
+
+	bool ModuleManager::UnloadModules(absl::Span<const ModuleInfo> infos)
+	{
+		// Latches are acquired in hash order, so that overlapping batches cannot dead lock each other.
+		std::vector<ModuleInfo> batch_infos(infos.begin(), infos.end());
+		std::sort(batch_infos.begin(), batch_infos.end(), [](const ModuleInfo& lhs, const ModuleInfo& rhs)
+			{
+				return lhs.ModuleHash() < rhs.ModuleHash();
+			});
+		batch_infos.erase(std::unique(batch_infos.begin(), batch_infos.end(), ModuleInfo::ModuleInfoEqual()), batch_infos.end());
+
+		for (const ModuleInfo& info : batch_infos)
+		{
+			if (IsModuleAttached(info))
+			{
+				LOG(ERROR) << "The module: " << info.ModuleName() << " is attached and cannot be unloaded, no module of the batch has been unloaded";
+				return false;
+			}
+		}
+
+		std::vector<ModuleSlot*> slots;
+		slots.reserve(batch_infos.size());
+		for (const ModuleInfo& info : batch_infos)
+		{
+			ModuleSlot* slot = IsModuleLoaded(info) ? GetModuleSlot(info) : nullptr;
+			const ModuleLatchResult latch_result = slot != nullptr ? AcquireUnloadLatch(*slot) : ModuleLatchResult::kAlreadyDone;
+			if (latch_result == ModuleLatchResult::kAcquired)
+			{
+				slots.push_back(slot);
+				continue;
+			}
+
+			if (latch_result == ModuleLatchResult::kRecursive)
+			{
+				LOG(ERROR) << "The module: " << info.ModuleName() << " cannot be unloaded while it is being loaded or unloaded on the same thread, no module of the batch has been unloaded";
+			}
+			else
+			{
+				LOG(ERROR) << "The module: " << info.ModuleName() << " is not loaded, no module of the batch has been unloaded";
+			}
+			for (ModuleSlot* acquired_slot : slots)
+			{
+				ReleaseLatch(*acquired_slot, ModuleSlotState::kLoaded);
+			}
+			return false;
+		}
+
+		// Wire up declared and observed dependencies between the modules of the batch.
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> indices;
+		for (std::size_t index = 0; index < batch_infos.size(); ++index)
+		{
+			indices.emplace(batch_infos[index], index);
+		}
+		std::vector<std::vector<std::size_t>> dependencies(batch_infos.size());
+		const auto add_dependency = [&indices, &dependencies](std::size_t index, const ModuleInfo& dependency)
+			{
+				const auto iterator = indices.find(dependency);
+				if (iterator != indices.end() && iterator->second != index)
+				{
+					dependencies[index].push_back(iterator->second);
+				}
+			};
+
+		for (std::size_t index = 0; index < batch_infos.size(); ++index)
+		{
+			RegisteredModule registration;
+			if (FindRegisteredModule(batch_infos[index], registration))
+			{
+				for (const ModuleInfo& dependency : registration.dependencies)
+				{
+					add_dependency(index, dependency);
+				}
+			}
+
+			const RegistryShard& shard = GetShard(batch_infos[index]);
+			shard.mutex.Lock();
+			const auto iterator = shard.observed_dependencies.find(batch_infos[index]);
+			const std::vector<ModuleInfo> observed_dependencies = iterator != shard.observed_dependencies.end() ? iterator->second : std::vector<ModuleInfo>();
+			shard.mutex.Unlock();
+			for (const ModuleInfo& dependency : observed_dependencies)
+			{
+				add_dependency(index, dependency);
+			}
+		}
+
+		// Depth first post order lists dependencies before their dependents, modules on a cycle end up in unspecified order.
+		std::vector<std::size_t> order;
+		order.reserve(batch_infos.size());
+		std::vector<bool> visited(batch_infos.size(), false);
+		for (std::size_t root = 0; root < batch_infos.size(); ++root)
+		{
+			if (visited[root])
+			{
+				continue;
+			}
+
+			visited[root] = true;
+			std::vector<std::pair<std::size_t, std::size_t>> stack{ { root, 0 } };
+			while (!stack.empty())
+			{
+				const std::size_t index = stack.back().first;
+				const std::size_t position = stack.back().second++;
+				if (position < dependencies[index].size())
+				{
+					const std::size_t dependency = dependencies[index][position];
+					if (!visited[dependency])
+					{
+						visited[dependency] = true;
+						stack.emplace_back(dependency, 0);
+					}
+					continue;
+				}
+				order.push_back(index);
+				stack.pop_back();
+			}
+		}
+
+		// The modules stay visible while they shut down, the registry is not locked meanwhile.
+		for (auto iterator = order.rbegin(); iterator != order.rend(); ++iterator)
+		{
+			const ModuleInfo& info = batch_infos[*iterator];
+			std::shared_ptr<ModuleInterface> module_ptr = FindModule(info).lock();
+			if (module_ptr != nullptr)
+			{
+				m_event_bus.Unsubscribe(*module_ptr);
+				StopModuleExecutor(*module_ptr);
+				const ModuleManagerScope scope(*this);
+				ModuleInstrumentation::ScopedPhase phase(m_instrumentation, info, ModulePhase::kShutdown);
+				module_ptr->OnShutdownModule();
+				module_ptr.reset();
+			}
+		}
+
+		// Every shard is copied once for the whole batch.
+		std::array<std::vector<std::size_t>, kRegistryShardCount> shard_indices;
+		for (std::size_t index = 0; index < batch_infos.size(); ++index)
+		{
+			shard_indices[batch_infos[index].ModuleHash() % kRegistryShardCount].push_back(index);
+		}
+		for (std::size_t shard_index = 0; shard_index < kRegistryShardCount; ++shard_index)
+		{
+			if (shard_indices[shard_index].empty())
+			{
+				continue;
+			}
+
+			RegistryShard& shard = m_shards[shard_index];
+			shard.mutex.Lock();
+			ModuleMap* modules = new ModuleMap(*shard.modules.load(std::memory_order_relaxed));
+			for (const std::size_t index : shard_indices[shard_index])
+			{
+				const auto module_iterator = modules->find(batch_infos[index]);
+				if (module_iterator != modules->end())
+				{
+					UpdateServices(batch_infos[index], module_iterator->second.get(), nullptr);
+					modules->erase(module_iterator);
+				}
+				UpdateModuleSlot(shard, batch_infos[index], nullptr);
+				ReleaseLatch(*slots[index], ModuleSlotState::kUnloaded);
+				shard.observed_dependencies.erase(batch_infos[index]);
+			}
+			PublishModules(shard, modules);
+			shard.mutex.Unlock();
+		}
+
+		EpochDomain::Get().Reclaim();
+		return true;
+	}
+
+	bool ModuleManager::CreateModuleExecutor(ModuleInterface& module, const ModuleExecutorOptions& options)
+	{
+		if (module.m_executor != nullptr)
+		{
+			LOG(ERROR) << "The module already has an executor";
+			return false;
+		}
+		module.m_executor = ModuleExecutor::Create(options, GetThreadPool());
+		return true;
+	}
+
+	bool ModuleManager::AttachModule(const ModuleInfo& info, ModuleInterface& module)
+	{
+		ModuleSlot* slot = GetModuleSlot(info);
+		if (slot == nullptr)
+		{
+			return false;
+		}
+
+		switch (AcquireLoadLatch(*slot))
+		{
+		case ModuleLatchResult::kAlreadyDone:
+			LOG(ERROR) << "The module: " << info.ModuleName() << " is already loaded and cannot be attached";
+			return false;
+		case ModuleLatchResult::kRecursive:
+			LOG(ERROR) << "The module: " << info.ModuleName() << " cannot be attached while it is being loaded or unloaded on the same thread";
+			return false;
+		case ModuleLatchResult::kAcquired:
+			break;
+		}
+
+		// The owner of the module destroys it, the registry only holds a pointer that never deletes it.
+		const std::shared_ptr<ModuleInterface> module_ptr(&module, [](ModuleInterface*) {});
+		module.m_module_manager = this;
+
+		RegistryShard& shard = GetShard(info);
+		shard.mutex.Lock();
+		shard.attached_modules.insert(info);
+		shard.mutex.Unlock();
+
+		PublishModule(info, module_ptr);
+		ReleaseLatch(*slot, ModuleSlotState::kLoaded);
+		return true;
+	}
+
+	bool ModuleManager::DetachModule(const ModuleInfo& info)
+	{
+		ModuleSlot* slot = IsModuleAttached(info) ? GetModuleSlot(info) : nullptr;
+		const ModuleLatchResult latch_result = slot != nullptr ? AcquireUnloadLatch(*slot) : ModuleLatchResult::kAlreadyDone;
+		if (latch_result == ModuleLatchResult::kRecursive)
+		{
+			LOG(ERROR) << "The module: " << info.ModuleName() << " cannot be detached while it is being loaded or unloaded on the same thread";
+			return false;
+		}
+		if (latch_result == ModuleLatchResult::kAlreadyDone)
+		{
+			return false;
+		}
+
+		const std::shared_ptr<ModuleInterface> module_ptr = FindModule(info).lock();
+		if (module_ptr != nullptr)
+		{
+			// The owner shuts the module down right after it has been detached.
+			m_event_bus.Unsubscribe(*module_ptr);
+			StopModuleExecutor(*module_ptr);
+			module_ptr->m_module_manager = nullptr;
+		}
+		UnpublishModule(info);
+		return true;
+	}
+
+	ModuleManager::ModuleLatchResult ModuleManager::AcquireLoadLatch(ModuleSlot& slot)
+	{
+		const std::thread::id this_thread = std::this_thread::get_id();
+
+		slot.state_mutex.Lock();
+		while (true)
+		{
+			if (slot.state == ModuleSlotState::kUnloaded)
+			{
+				slot.state = ModuleSlotState::kLoading;
+				slot.state_owner = this_thread;
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kAcquired;
+			}
+			if (slot.state == ModuleSlotState::kLoaded)
+			{
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kAlreadyDone;
+			}
+			if (slot.state_owner == this_thread)
+			{
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kRecursive;
+			}
+
+			slot.state_mutex.Await(absl::Condition(+[](ModuleSlot* waiting_slot)
+				{
+					return waiting_slot->state == ModuleSlotState::kUnloaded || waiting_slot->state == ModuleSlotState::kLoaded;
+				}, &slot));
+		}
+	}
+
+	ModuleManager::ModuleLatchResult ModuleManager::AcquireUnloadLatch(ModuleSlot& slot)
+	{
+		const std::thread::id this_thread = std::this_thread::get_id();
+
+		slot.state_mutex.Lock();
+		while (true)
+		{
+			if (slot.state == ModuleSlotState::kLoaded)
+			{
+				slot.state = ModuleSlotState::kUnloading;
+				slot.state_owner = this_thread;
+
+				// No tick starts once the state left kLoaded, a module unloading itself from its tick does not wait for itself.
+				if (slot.tick_owner != this_thread)
+				{
+					slot.state_mutex.Await(absl::Condition(+[](ModuleSlot* waiting_slot)
+						{
+							return waiting_slot->tick_owner == std::thread::id();
+						}, &slot));
+				}
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kAcquired;
+			}
+			if (slot.state == ModuleSlotState::kUnloaded)
+			{
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kAlreadyDone;
+			}
+			if (slot.state_owner == this_thread)
+			{
+				slot.state_mutex.Unlock();
+				return ModuleLatchResult::kRecursive;
+			}
+
+			slot.state_mutex.Await(absl::Condition(+[](ModuleSlot* waiting_slot)
+				{
+					return waiting_slot->state == ModuleSlotState::kUnloaded || waiting_slot->state == ModuleSlotState::kLoaded;
+				}, &slot));
+		}
+	}
+
+	void ModuleManager::ReleaseLatch(ModuleSlot& slot, ModuleSlotState state)
+	{
+		slot.state_mutex.Lock();
+		slot.state = state;
+		slot.state_owner = std::thread::id();
+		slot.state_mutex.Unlock();
+	}
+
+	bool ModuleManager::StartupModule(const StartupNode& node, ModuleBatch* batch)
+	{
+		const ModuleManagerScope scope(*this);
+		ModuleSlot* slot = nullptr;
+		if (batch == nullptr)
+		{
+			slot = GetModuleSlot(node.info);
+			if (slot == nullptr)
+			{
+				return false;
+			}
+
+			switch (AcquireLoadLatch(*slot))
+			{
+			case ModuleLatchResult::kAlreadyDone:
+				// Another thread loaded the module in the meantime.
+				return true;
+			case ModuleLatchResult::kRecursive:
+				LOG(ERROR) << "The module: " << node.info.ModuleName() << " requires itself while it is being loaded";
+				return false;
+			case ModuleLatchResult::kAcquired:
+				break;
+			}
+		}
+
+		// Modules of a batch see the modules of the batch that have already been started.
+		ModuleBatch* parent_batch = t_module_batch;
+		if (batch != nullptr)
+		{
+			t_module_batch = batch;
+		}
+
+		const absl::Time startup_start = absl::Now();
+		std::shared_ptr<ModuleInterface> module_ptr;
+		{
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, node.info, ModulePhase::kConstruction);
+			module_ptr = node.registration.Create();
+		}
+		if (module_ptr == nullptr)
+		{
+			t_module_batch = parent_batch;
+			if (slot != nullptr)
+			{
+				ReleaseLatch(*slot, ModuleSlotState::kUnloaded);
+			}
+			LOG(ERROR) << "Failed to create module: " << node.info.ModuleName();
+			return false;
+		}
+		module_ptr->m_module_manager = this;
+
+		const ModuleInfo* parent_module = t_starting_module;
+		t_starting_module = &node.info;
+		{
+			ModuleInstrumentation::ScopedPhase phase(m_instrumentation, node.info, ModulePhase::kStartup);
+			module_ptr->OnStartupModule();
+		}
+		t_starting_module = parent_module;
+		t_module_batch = parent_batch;
+		ReplicateModule(node.info, node.registration, *module_ptr);
+
+		// Kept for the startup manifest.
+		const absl::Duration startup_cost = absl::Now() - startup_start;
+		RegistryShard& shard = GetShard(node.info);
+		shard.mutex.Lock();
+		shard.startup_costs[node.info] = startup_cost;
+		shard.mutex.Unlock();
+
+		if (batch != nullptr)
+		{
+			batch->Stage(node.info, module_ptr);
+		}
+		else
+		{
+			PublishModule(node.info, module_ptr);
+			ReleaseLatch(*slot, ModuleSlotState::kLoaded);
+		}
+
+		if (parent_module != nullptr)
+		{
+			RecordObservedDependency(*parent_module, node.info);
+		}
+		return true;
+	}
+
+	void ModuleManager::ReplicateModule(const ModuleInfo& info, const RegisteredModule& registration, ModuleInterface& module)
+	{
+		const std::uint32_t node_count = NumaTopology::NodeCount();
+		if (registration.replicate == nullptr || node_count == 1)
+		{
+			return;
+		}
+
+		// The module itself lives on the first node.
+		std::unique_ptr<ModuleInterface::Replicas> replicas = std::make_unique<ModuleInterface::Replicas>();
+		replicas->nodes.assign(node_count, &module);
+		replicas->storage.reserve(node_count - 1);
+		for (std::uint32_t node = 1; node < node_count; ++node)
+		{
+			std::shared_ptr<ModuleInterface> replica = registration.replicate(module, node);
+			if (replica == nullptr)
+			{
+				LOG(WARNING) << "Failed to replicate the module: " << info.ModuleName() << " onto NUMA node: " << node << ", the node uses the module itself";
+				continue;
+			}
+			replica->m_module_manager = this;
+			replicas->nodes[node] = replica.get();
+			replicas->storage.push_back(std::move(replica));
+		}
+		module.m_replicas = std::move(replicas);
+	}
+
+	ModuleArena& ModuleManager::GetNumaModuleArena(std::uint32_t node)
+	{
+		absl::call_once(m_numa_module_arenas_once, [this]()
+			{
+				const std::uint32_t node_count = NumaTopology::NodeCount();
+				m_numa_module_arenas = std::make_unique<ModuleArena[]>(node_count);
+				for (std::uint32_t arena_node = 0; arena_node < node_count; ++arena_node)
+				{
+					ModuleArenaOptions options;
+					options.numa_placement = NumaPlacement::kNode;
+					options.numa_node = arena_node;
+					m_numa_module_arenas[arena_node].Configure(options);
+				}
+			});
+		return m_numa_module_arenas[node];
+	}
+
+	InstrumentationSnapshot ModuleManager::GetInstrumentationSnapshot() const
+	{
+		InstrumentationSnapshot snapshot = m_instrumentation.Snapshot();
+		for (const RegistryShard& shard : m_shards)
+		{
+			snapshot.modules_mutex_wait += shard.mutex.WaitTime();
+			snapshot.registered_modules_mutex_wait += shard.registered_modules_mutex.WaitTime();
+		}
+
+		absl::flat_hash_map<ModuleInfo, std::size_t, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual> indices;
+		for (std::size_t index = 0; index < snapshot.modules.size(); ++index)
+		{
+			indices.emplace(snapshot.modules[index].info, index);
+		}
+		absl::MutexLock lock(&m_memory_resources_mutex);
+		for (const auto& iterator : m_memory_resources)
+		{
+			const auto index_iterator = indices.try_emplace(iterator.first, snapshot.modules.size()).first;
+			if (index_iterator->second == snapshot.modules.size())
+			{
+				snapshot.modules.push_back(ModuleStatistics{ iterator.first });
+			}
+			ModuleStatistics& statistics = snapshot.modules[index_iterator->second];
+			statistics.has_memory_statistics = true;
+			statistics.memory = iterator.second->Statistics();
+		}
+		return snapshot;
+	}
+
+	ModuleMemoryResource& ModuleManager::GetModuleMemoryResource(const ModuleInfo& info)
+	{
+		absl::MutexLock lock(&m_memory_resources_mutex);
+		std::unique_ptr<ModuleMemoryResource>& resource = m_memory_resources[info];
+		if (resource == nullptr)
+		{
+			resource = std::make_unique<ModuleMemoryResource>(info);
+		}
+		return *resource;
+	}
+
+	std::uint32_t ModuleManager::GetServiceIndex(const ServiceInfo& info)
+	{
+		static absl::Mutex mutex;
+		static absl::flat_hash_map<ServiceInfo, std::uint32_t, ServiceInfo::ServiceInfoHash, ServiceInfo::ServiceInfoEqual>* indices =
+			new absl::flat_hash_map<ServiceInfo, std::uint32_t, ServiceInfo::ServiceInfoHash, ServiceInfo::ServiceInfoEqual>();
+
+		absl::MutexLock lock(&mutex);
+		return indices->try_emplace(info, static_cast<std::uint32_t>(indices->size())).first->second;
+	}
+
+	void ModuleManager::UpdateServices(const ModuleInfo& info, const ModuleInterface* previous_module, const std::shared_ptr<ModuleInterface>& module)
+	{
+		RegisteredModule registration;
+		if (!FindRegisteredModule(info, registration) || registration.services == nullptr)
+		{
+			return;
+		}
+
+		absl::MutexLock lock(&m_services_mutex);
+		const ServiceTable* services = m_services.load(std::memory_order_relaxed);
+		ServiceTable* new_services = new ServiceTable(*services);
+		for (const ModuleServiceBinding& binding : registration.services->services)
+		{
+			const std::uint32_t service_index = GetServiceIndex(binding.info);
+			if (service_index >= new_services->size())
+			{
+				new_services->resize(service_index + 1);
+			}
+			std::vector<ServiceProvider>& providers = (*new_services)[service_index];
+
+			// Only the given instance is removed, another instance of the module may already have been published.
+			if (previous_module != nullptr)
+			{
+				providers.erase(std::remove_if(providers.begin(), providers.end(), [previous_module](const ServiceProvider& provider)
+					{
+						return provider.module.get() == previous_module;
+					}), providers.end());
+			}
+			if (module != nullptr)
+			{
+				ServiceProvider provider{ info, registration.services->priority, module, binding.cast(module.get()) };
+				const auto position = std::find_if(providers.begin(), providers.end(), [&provider](const ServiceProvider& other)
+					{
+						return other.priority < provider.priority || (other.priority == provider.priority && other.info.ModuleName() > provider.info.ModuleName());
+					});
+				providers.insert(position, std::move(provider));
+			}
+		}
+		m_services.store(new_services, std::memory_order_release);
+		EpochDomain::Get().Retire(services);
+	}
+
+	void ModuleManager::Tick(float delta_time, ThreadPool& pool)
+	{
+		absl::MutexLock lock(&m_tick_mutex);
+		if (!IsTickPlanCurrent())
+		{
+			BuildTickPlan();
+		}
+
+		for (const std::vector<TickNode>& group : m_tick_plan.groups)
+		{
+			TickGroup(group, delta_time, pool);
+		}
+	}
+
+	bool ModuleManager::IsTickPlanCurrent() const
+	{
+		if (!m_tick_plan.built)
+		{
+			return false;
+		}
+		for (std::size_t index = 0; index < kRegistryShardCount; ++index)
+		{
+			if (m_shards[index].generation.load(std::memory_order_acquire) != m_tick_plan.generations[index])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void ModuleManager::BuildTickPlan()
+	{
+		struct TickingModule
+		{
+			ModuleInfo info;
+			std::weak_ptr<ModuleInterface> module;
+			const ModuleTickSettings* settings;
+		};
+
+		std::vector<TickingModule> ticking_modules;
+		{
+			EpochGuard guard;
+			for (std::size_t index = 0; index < kRegistryShardCount; ++index)
+			{
+				// The generation is read first, a snapshot published in between only makes the plan stale.
+				m_tick_plan.generations[index] = m_shards[index].generation.load(std::memory_order_acquire);
+				for (const auto& iterator : *m_shards[index].modules.load(std::memory_order_acquire))
+				{
+					RegisteredModule registration;
+					if (FindRegisteredModule(iterator.first, registration) && registration.tick != nullptr)
+					{
+						ticking_modules.push_back(TickingModule{ iterator.first, iterator.second, registration.tick });
+					}
+				}
+			}
+		}
+
+		// Sorted by group and name, so the schedule does not depend on the hash order of the registry.
+		std::sort(ticking_modules.begin(), ticking_modules.end(), [](const TickingModule& lhs, const TickingModule& rhs)
+			{
+				if (lhs.settings->group != rhs.settings->group)
+				{
+					return lhs.settings->group < rhs.settings->group;
+				}
+				return lhs.info.ModuleName() < rhs.info.ModuleName();
+			});
+
+		using ModuleInfoSet = absl::flat_hash_set<ModuleInfo, ModuleInfo::ModuleInfoHash, ModuleInfo::ModuleInfoEqual>;
+		const auto intersects = [](const ModuleInfoSet& lhs, const ModuleInfoSet& rhs)
+			{
+				const ModuleInfoSet& smaller = lhs.size() < rhs.size() ? lhs : rhs;
+				const ModuleInfoSet& larger = lhs.size() < rhs.size() ? rhs : lhs;
+				return std::any_of(smaller.begin(), smaller.end(), [&larger](const ModuleInfo& info)
+					{
+						return larger.contains(info);
+					});
+			};
+
+		m_tick_plan.groups.clear();
+		std::size_t group_begin = 0;
+		while (group_begin < ticking_modules.size())
+		{
+			std::size_t group_end = group_begin;
+			while (group_end < ticking_modules.size() && ticking_modules[group_end].settings->group == ticking_modules[group_begin].settings->group)
+			{
+				++group_end;
+			}
+			const std::size_t count = group_end - group_begin;
+
+			std::vector<ModuleInfoSet> reads(count);
+			std::vector<ModuleInfoSet> writes(count);
+			for (std::size_t index = 0; index < count; ++index)
+			{
+				const TickingModule& module = ticking_modules[group_begin + index];
+				reads[index].insert(module.settings->reads.begin(), module.settings->reads.end());
+				writes[index].insert(module.settings->writes.begin(), module.settings->writes.end());
+				writes[index].insert(module.info);
+			}
+
+			// Order the group so writers come before their readers, modules on a cycle keep the order of their names.
+			std::vector<std::vector<std::size_t>> readers(count);
+			std::vector<std::size_t> remaining_writers(count, 0);
+			for (std::size_t writer = 0; writer < count; ++writer)
+			{
+				for (std::size_t reader = 0; reader < count; ++reader)
+				{
+					if (writer != reader && intersects(writes[writer], reads[reader]))
+					{
+						readers[writer].push_back(reader);
+						++remaining_writers[reader];
+					}
+				}
+			}
+			std::vector<std::size_t> order;
+			order.reserve(count);
+			std::vector<bool> ordered(count, false);
+			while (order.size() < count)
+			{
+				std::size_t next = count;
+				for (std::size_t index = 0; index < count && next == count; ++index)
+				{
+					if (!ordered[index] && remaining_writers[index] == 0)
+					{
+						next = index;
+					}
+				}
+				if (next == count)
+				{
+					next = static_cast<std::size_t>(std::find(ordered.begin(), ordered.end(), false) - ordered.begin());
+					LOG(WARNING) << "The module: " << ticking_modules[group_begin + next].info.ModuleName()
+						<< " reads and writes state cyclically with other modules of tick group " << ticking_modules[group_begin + next].settings->group
+						<< ", its tick order is unspecified";
+				}
+				ordered[next] = true;
+				order.push_back(next);
+				for (const std::size_t reader : readers[next])
+				{
+					--remaining_writers[reader];
+				}
+			}
+
+			// Conflicting modules tick in that order, all others are independent.
+			std::vector<TickNode> group;
+			group.reserve(count);
+			for (const std::size_t index : order)
+			{
+				const TickingModule& module = ticking_modules[group_begin + index];
+				group.push_back(TickNode{ module.info, module.module, GetModuleSlot(module.info), {}, 0 });
+			}
+			for (std::size_t before = 0; before < count; ++before)
+			{
+				const std::size_t lhs = order[before];
+				for (std::size_t after = before + 1; after < count; ++after)
+				{
+					const std::size_t rhs = order[after];
+					if (intersects(writes[lhs], reads[rhs]) || intersects(reads[lhs], writes[rhs]) || intersects(writes[lhs], writes[rhs]))
+					{
+						group[before].dependents.push_back(after);
+						++group[after].dependency_count;
+					}
+				}
+			}
+
+			m_tick_plan.groups.push_back(std::move(group));
+			group_begin = group_end;
+		}
+		m_tick_plan.built = true;
+	}
+
+	void ModuleManager::TickGroup(const std::vector<TickNode>& group, float delta_time, ThreadPool& pool)
+	{
+		/**
+		 * State shared by all tick tasks of a group.
+		 * Owned by the tasks, so it stays valid until the last task finished, independent of the waiting thread.
+		 */
+		struct TickExecution : std::enable_shared_from_this<TickExecution>
+		{
+			ModuleManager* manager = nullptr;
+			const std::vector<TickNode>* nodes = nullptr;
+			ThreadPool* pool = nullptr;
+			float delta_time = 0.0f;
+
+			/**
+			 * The modules, locked for the duration of the tick. Empty for modules that have been unloaded or skipped.
+			 */
+			std::vector<std::shared_ptr<ModuleInterface>> modules;
+			std::vector<absl::Duration> durations;
+			std::unique_ptr<std::atomic<std::size_t>[]> remaining_dependencies;
+
+			absl::Mutex mutex;
+			std::size_t unfinished_nodes = 0;
+
+			void Schedule(std::size_t index)
+			{
+				std::shared_ptr<TickExecution> self = shared_from_this();
+				pool->Schedule([self, index]()
+					{
+						self->Run(index);
+					});
+			}
+
+			void TickModule(std::size_t index)
+			{
+				ModuleSlot* slot = (*nodes)[index].slot;
+				if (modules[index] == nullptr || slot == nullptr)
+				{
+					modules[index].reset();
+					return;
+				}
+
+				// A module that is being unloaded is skipped, an unload that starts meanwhile waits for the tick.
+				slot->state_mutex.Lock();
+				const bool loaded = slot->state == ModuleSlotState::kLoaded;
+				if (loaded)
+				{
+					slot->tick_owner = std::this_thread::get_id();
+				}
+				slot->state_mutex.Unlock();
+				if (!loaded)
+				{
+					modules[index].reset();
+					return;
+				}
+
+				{
+					const ModuleManagerScope scope(*manager);
+					if constexpr (ModuleInstrumentation::kEnabled)
+					{
+						const absl::Time start = absl::Now();
+						modules[index]->OnTickModule(delta_time);
+						durations[index] = absl::Now() - start;
+					}
+					else
+					{
+						modules[index]->OnTickModule(delta_time);
+					}
+				}
+
+				slot->state_mutex.Lock();
+				slot->tick_owner = std::thread::id();
+				slot->state_mutex.Unlock();
+			}
+
+			void Run(std::size_t index)
+			{
+				while (true)
+				{
+					TickModule(index);
+
+					// The first ready dependent continues on this thread, the others go to the pool.
+					bool has_next = false;
+					std::size_t next = 0;
+					for (const std::size_t dependent : (*nodes)[index].dependents)
+					{
+						if (remaining_dependencies[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+						{
+							if (!has_next)
+							{
+								has_next = true;
+								next = dependent;
+							}
+							else
+							{
+								Schedule(dependent);
+							}
+						}
+					}
+
+					// The group may be gone once the last node finished, it must not be touched afterwards.
+					mutex.Lock();
+					--unfinished_nodes;
+					mutex.Unlock();
+
+					if (!has_next)
+					{
+						return;
+					}
+					index = next;
+				}
+			}
+		};
+
+		std::shared_ptr<TickExecution> execution = std::make_shared<TickExecution>();
+		execution->manager = this;
+		execution->nodes = &group;
+		execution->pool = &pool;
+		execution->delta_time = delta_time;
+		execution->modules.reserve(group.size());
+		for (const TickNode& node : group)
+		{
+			execution->modules.push_back(node.module.lock());
+		}
+		execution->durations.resize(group.size(), absl::ZeroDuration());
+
+		if (group.size() == 1)
+		{
+			execution->TickModule(0);
+		}
+		else
+		{
+			execution->remaining_dependencies = std::make_unique<std::atomic<std::size_t>[]>(group.size());
+			for (std::size_t index = 0; index < group.size(); ++index)
+			{
+				execution->remaining_dependencies[index].store(group[index].dependency_count, std::memory_order_relaxed);
+			}
+			execution->unfinished_nodes = group.size();
+
+			for (std::size_t index = 0; index < group.size(); ++index)
+			{
+				if (group[index].dependency_count == 0)
+				{
+					execution->Schedule(index);
+				}
+			}
+
+			// Help the pool while waiting, the calling thread may itself be a worker of the pool.
+			const absl::Condition finished(+[](std::size_t* unfinished_nodes) { return *unfinished_nodes == 0; }, &execution->unfinished_nodes);
+			while (true)
+			{
+				execution->mutex.Lock();
+				const bool done = execution->unfinished_nodes == 0;
+				execution->mutex.Unlock();
+				if (done)
+				{
+					break;
+				}
+
+				if (!pool.TryRunPendingTask())
+				{
+					execution->mutex.LockWhenWithTimeout(finished, absl::Milliseconds(1));
+					execution->mutex.Unlock();
+				}
+			}
+		}
+
+		if constexpr (ModuleInstrumentation::kEnabled)
+		{
+			for (std::size_t index = 0; index < group.size(); ++index)
+			{
+				if (execution->modules[index] != nullptr)
+				{
+					m_instrumentation.RecordPhase(group[index].info, ModulePhase::kTick, execution->durations[index]);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,108 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_memory.h"
+
+#include <new>
+#include <utility>
+
+namespace fkleafs
+{
+	void ModuleMemoryResource::SetBudget(ModuleMemoryBudget budget)
+	{
+		absl::MutexLock lock(&m_budget_mutex);
+		m_soft_limit.store(budget.soft_limit, std::memory_order_relaxed);
+		m_hard_limit.store(budget.hard_limit, std::memory_order_relaxed);
+		m_soft_limit_armed.store(true, std::memory_order_relaxed);
+		m_budget = std::move(budget);
+	}
+
+	ModuleMemoryStatistics ModuleMemoryResource::Statistics() const
+	{
+		ModuleMemoryStatistics statistics;
+		statistics.live_bytes = m_live_bytes.load(std::memory_order_relaxed);
+		statistics.peak_bytes = m_peak_bytes.load(std::memory_order_relaxed);
+		statistics.allocated_bytes = m_allocated_bytes.load(std::memory_order_relaxed);
+		statistics.allocation_count = m_allocation_count.load(std::memory_order_relaxed);
+		statistics.rejected_allocation_count = m_rejected_allocation_count.load(std::memory_order_relaxed);
+		statistics.tracked_duration = absl::Now() - m_created;
+		return statistics;
+	}
+
+	void* ModuleMemoryResource::do_allocate(std::size_t bytes, std::size_t alignment)
+	{
+		// The bytes are reserved first, so concurrent allocations cannot overshoot the hard limit together.
+		const std::size_t live_bytes = m_live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		const std::size_t hard_limit = m_hard_limit.load(std::memory_order_relaxed);
+		if (hard_limit != 0 && live_bytes > hard_limit)
+		{
+			m_live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+			m_rejected_allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+			std::function<void(const ModuleInfo&, std::size_t)> on_hard_limit_exceeded;
+			m_budget_mutex.Lock();
+			on_hard_limit_exceeded = m_budget.on_hard_limit_exceeded;
+			m_budget_mutex.Unlock();
+			if (on_hard_limit_exceeded)
+			{
+				on_hard_limit_exceeded(m_info, bytes);
+			}
+			throw std::bad_alloc();
+		}
+
+		void* pointer = nullptr;
+		try
+		{
+			pointer = m_upstream->allocate(bytes, alignment);
+		}
+		catch (...)
+		{
+			m_live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+			throw;
+		}
+
+		m_allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+		m_allocation_count.fetch_add(1, std::memory_order_relaxed);
+		std::size_t peak_bytes = m_peak_bytes.load(std::memory_order_relaxed);
+		while (live_bytes > peak_bytes && !m_peak_bytes.compare_exchange_weak(peak_bytes, live_bytes, std::memory_order_relaxed))
+		{
+		}
+
+		const std::size_t soft_limit = m_soft_limit.load(std::memory_order_relaxed);
+		if (soft_limit != 0 && live_bytes > soft_limit && m_soft_limit_armed.exchange(false, std::memory_order_relaxed))
+		{
+			std::function<void(const ModuleInfo&, std::size_t)> on_soft_limit_exceeded;
+			m_budget_mutex.Lock();
+			on_soft_limit_exceeded = m_budget.on_soft_limit_exceeded;
+			m_budget_mutex.Unlock();
+			if (on_soft_limit_exceeded)
+			{
+				on_soft_limit_exceeded(m_info, live_bytes);
+			}
+		}
+		return pointer;
+	}
+
+	void ModuleMemoryResource::do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment)
+	{
+		m_upstream->deallocate(pointer, bytes, alignment);
+		const std::size_t live_bytes = m_live_bytes.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+
+		const std::size_t soft_limit = m_soft_limit.load(std::memory_order_relaxed);
+		if (soft_limit != 0 && live_bytes <= soft_limit && !m_soft_limit_armed.load(std::memory_order_relaxed))
+		{
+			m_soft_limit_armed.store(true, std::memory_order_relaxed);
+		}
+	}
+}
@@ -0,0 +1,239 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+
+namespace fkleafs
+{
+#if defined(FKLEAFS_ENABLE_INSTRUMENTATION)
+	namespace
+	{
+		std::atomic<std::uint64_t> g_next_tracer_id{ 1 };
+		std::atomic<std::uint32_t> g_next_thread_id{ 1 };
+
+		/**
+		 * Buffer of the calling thread and the tracer it belongs to.
+		 * Caches the last tracer only, in practice a thread records into a single manager.
+		 */
+		thread_local std::uint64_t t_trace_buffer_owner = 0;
+		thread_local void* t_trace_buffer = nullptr;
+
+		std::uint32_t CurrentThreadId()
+		{
+			thread_local const std::uint32_t thread_id = g_next_thread_id.fetch_add(1, std::memory_order_relaxed);
+			return thread_id;
+		}
+
+		const char* EventCategory(TraceEventType type)
+		{
+			switch (type)
+			{
+			case TraceEventType::kRegistration:
+				return "registration";
+			case TraceEventType::kConstruction:
+				return "construction";
+			case TraceEventType::kStartup:
+				return "startup";
+			case TraceEventType::kShutdown:
+				return "shutdown";
+			case TraceEventType::kMutexWait:
+				return "mutex_wait";
+			}
+			return "unknown";
+		}
+
+		/**
+		 * Writes a string as a JSON string literal.
+		 */
+		void WriteJsonString(std::ostream& stream, const char* characters, std::size_t length)
+		{
+			stream << '"';
+			for (std::size_t index = 0; index < length; ++index)
+			{
+				const unsigned char character = static_cast<unsigned char>(characters[index]);
+				if (character == '"' || character == '\\')
+				{
+					stream << '\\' << characters[index];
+				}
+				else if (character < 0x20)
+				{
+					char escaped[8];
+					std::snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+					stream << escaped;
+				}
+				else
+				{
+					stream << characters[index];
+				}
+			}
+			stream << '"';
+		}
+
+		/**
+		 * Writes nanoseconds as the microseconds the trace event format expects.
+		 */
+		void WriteMicroseconds(std::ostream& stream, std::int64_t nanoseconds)
+		{
+			char microseconds[32];
+			std::snprintf(microseconds, sizeof(microseconds), "%.3f", static_cast<double>(nanoseconds) / 1000.0);
+			stream << microseconds;
+		}
+	}
+
+	ModuleTracer::ModuleTracer()
+		: m_id(g_next_tracer_id.fetch_add(1, std::memory_order_relaxed))
+	{
+	}
+
+	void ModuleTracer::Start()
+	{
+		m_start_nanoseconds.store(absl::GetCurrentTimeNanos(), std::memory_order_relaxed);
+		m_tracing.store(true, std::memory_order_relaxed);
+	}
+
+	void ModuleTracer::Stop()
+	{
+		m_tracing.store(false, std::memory_order_relaxed);
+	}
+
+	void ModuleTracer::RecordEvent(TraceEventType type, std::string_view name, absl::Time start, absl::Duration duration)
+	{
+		TraceBuffer& buffer = GetBuffer();
+		const std::size_t head = buffer.head.load(std::memory_order_relaxed);
+		if (head - buffer.tail.load(std::memory_order_acquire) == kBufferCapacity)
+		{
+			m_dropped_events.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		TraceEvent& event = buffer.events[head % kBufferCapacity];
+		event.type = type;
+		event.start_nanoseconds = absl::ToUnixNanos(start);
+		event.duration_nanoseconds = absl::ToInt64Nanoseconds(duration);
+		event.thread_id = buffer.thread_id;
+		event.name_length = static_cast<std::uint32_t>(std::min(name.size(), TraceEvent::kMaxNameLength));
+		std::copy_n(name.data(), event.name_length, event.name);
+		event.name[event.name_length] = '\0';
+		buffer.head.store(head + 1, std::memory_order_release);
+	}
+
+	bool ModuleTracer::WriteChromeTrace(const std::string& path)
+	{
+		absl::MutexLock lock(&m_buffers_mutex);
+		const std::int64_t start_nanoseconds = m_start_nanoseconds.load(std::memory_order_relaxed);
+
+		// The buffers are drained even if the file cannot be written, so the next dump starts fresh.
+		std::vector<TraceEvent> events;
+		for (const std::unique_ptr<TraceBuffer>& buffer : m_buffers)
+		{
+			const std::size_t tail = buffer->tail.load(std::memory_order_relaxed);
+			const std::size_t head = buffer->head.load(std::memory_order_acquire);
+			for (std::size_t index = tail; index != head; ++index)
+			{
+				const TraceEvent& event = buffer->events[index % kBufferCapacity];
+				if (event.start_nanoseconds >= start_nanoseconds)
+				{
+					events.push_back(event);
+				}
+			}
+			buffer->tail.store(head, std::memory_order_release);
+		}
+		std::sort(events.begin(), events.end(), [](const TraceEvent& lhs, const TraceEvent& rhs)
+			{
+				return lhs.start_nanoseconds < rhs.start_nanoseconds;
+			});
+
+		std::ofstream file(path, std::ios::out | std::ios::trunc);
+		if (!file)
+		{
+			LOG(ERROR) << "Failed to open the trace: " << path << " for writing";
+			return false;
+		}
+
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for (std::size_t index = 0; index < events.size(); ++index)
+		{
+			const TraceEvent& event = events[index];
+			file << (index == 0 ? "\n" : ",\n") << "{\"name\":";
+			WriteJsonString(file, event.name, event.name_length);
+			file << ",\"cat\":\"" << EventCategory(event.type) << "\",\"pid\":1,\"tid\":" << event.thread_id << ",\"ts\":";
+			WriteMicroseconds(file, event.start_nanoseconds - start_nanoseconds);
+			if (event.type == TraceEventType::kRegistration)
+			{
+				file << ",\"ph\":\"i\",\"s\":\"t\"}";
+			}
+			else
+			{
+				file << ",\"ph\":\"X\",\"dur\":";
+				WriteMicroseconds(file, event.duration_nanoseconds);
+				file << '}';
+			}
+		}
+		file << "\n]}\n";
+
+		file.close();
+		if (!file)
+		{
+			LOG(ERROR) << "Failed to write the trace: " << path;
+			return false;
+		}
+		return true;
+	}
+
+	ModuleTracer::TraceBuffer& ModuleTracer::GetBuffer()
+	{
+		if (t_trace_buffer_owner == m_id)
+		{
+			return *static_cast<TraceBuffer*>(t_trace_buffer);
+		}
+
+		// Buffers are never removed, a thread that switches between tracers finds its buffer again.
+		const std::uint32_t thread_id = CurrentThreadId();
+		TraceBuffer* buffer = nullptr;
+		m_buffers_mutex.Lock();
+		for (const std::unique_ptr<TraceBuffer>& existing_buffer : m_buffers)
+		{
+			if (existing_buffer->thread_id == thread_id)
+			{
+				buffer = existing_buffer.get();
+				break;
+			}
+		}
+		if (buffer == nullptr)
+		{
+			m_buffers.push_back(std::make_unique<TraceBuffer>());
+			buffer = m_buffers.back().get();
+			buffer->thread_id = thread_id;
+		}
+		m_buffers_mutex.Unlock();
+
+		t_trace_buffer_owner = m_id;
+		t_trace_buffer = buffer;
+		return *buffer;
+	}
+#else
+	bool ModuleTracer::WriteChromeTrace(const std::string& path)
+	{
+		LOG(ERROR) << "Failed to write the trace: " << path << ", tracing requires FKLEAFS_ENABLE_INSTRUMENTATION";
+		return false;
+	}
+#endif
+}
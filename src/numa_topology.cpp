@@ -0,0 +1,190 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "numa_topology.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <cstdlib>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * Number of CurrentNode calls a cached node is reused for before the node is queried again.
+		 */
+		constexpr std::uint32_t kNodeRefreshInterval = 1024;
+
+		struct CachedNode
+		{
+			std::uint32_t node = 0;
+			std::uint32_t remaining_calls = 0;
+		};
+
+		thread_local CachedNode t_cached_node;
+
+#if defined(__linux__)
+		// Memory policies of mbind, defined here so numaif.h and libnuma are not required.
+		constexpr int kMpolPreferred = 1;
+		constexpr int kMpolInterleave = 3;
+
+		/**
+		 * Highest node id a node mask can hold.
+		 */
+		constexpr std::size_t kMaxNodes = 1024;
+		constexpr std::size_t kNodeMaskWords = kMaxNodes / (8 * sizeof(unsigned long));
+
+		bool ApplyMemoryPolicy(void* memory, std::size_t size, int mode, const unsigned long* node_mask)
+		{
+			return syscall(SYS_mbind, memory, size, mode, node_mask, kMaxNodes, 0) == 0;
+		}
+
+		/**
+		 * Parses a node list like "0-3,5" and returns the highest node id plus one.
+		 */
+		std::uint32_t ParseNodeList(const char* list)
+		{
+			std::uint32_t count = 1;
+			while (*list != '\0')
+			{
+				char* end = nullptr;
+				const unsigned long node = std::strtoul(list, &end, 10);
+				if (end == list)
+				{
+					++list;
+					continue;
+				}
+				count = std::max(count, static_cast<std::uint32_t>(std::min<unsigned long>(node + 1, kMaxNodes)));
+				list = end;
+			}
+			return count;
+		}
+#endif
+
+		std::uint32_t QueryNodeCount()
+		{
+#if defined(_WIN32)
+			ULONG highest_node = 0;
+			if (!GetNumaHighestNodeNumber(&highest_node))
+			{
+				return 1;
+			}
+			return static_cast<std::uint32_t>(highest_node) + 1;
+#elif defined(__linux__)
+			std::FILE* file = std::fopen("/sys/devices/system/node/online", "r");
+			if (file == nullptr)
+			{
+				return 1;
+			}
+			char list[256] = {};
+			const bool read = std::fgets(list, sizeof(list), file) != nullptr;
+			std::fclose(file);
+			return read ? ParseNodeList(list) : 1;
+#else
+			return 1;
+#endif
+		}
+
+		std::uint32_t QueryCurrentNode()
+		{
+#if defined(_WIN32)
+			PROCESSOR_NUMBER processor;
+			GetCurrentProcessorNumberEx(&processor);
+			USHORT node = 0;
+			if (!GetNumaProcessorNodeEx(&processor, &node))
+			{
+				return 0;
+			}
+			return static_cast<std::uint32_t>(node);
+#elif defined(__linux__)
+			unsigned int cpu = 0;
+			unsigned int node = 0;
+			if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+			{
+				return 0;
+			}
+			return static_cast<std::uint32_t>(node);
+#else
+			return 0;
+#endif
+		}
+	}
+
+	std::uint32_t NumaTopology::NodeCount()
+	{
+		static const std::uint32_t node_count = QueryNodeCount();
+		return node_count;
+	}
+
+	std::uint32_t NumaTopology::CurrentNode()
+	{
+		const std::uint32_t node_count = NodeCount();
+		if (node_count == 1)
+		{
+			return 0;
+		}
+
+		CachedNode& cached_node = t_cached_node;
+		if (cached_node.remaining_calls == 0)
+		{
+			cached_node.node = std::min(QueryCurrentNode(), node_count - 1);
+			cached_node.remaining_calls = kNodeRefreshInterval;
+		}
+		--cached_node.remaining_calls;
+		return cached_node.node;
+	}
+
+	bool NumaTopology::PreferNode(void* memory, std::size_t size, std::uint32_t node)
+	{
+#if defined(__linux__)
+		if (NodeCount() == 1 || node >= NodeCount())
+		{
+			return false;
+		}
+		unsigned long node_mask[kNodeMaskWords] = {};
+		node_mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+		return ApplyMemoryPolicy(memory, size, kMpolPreferred, node_mask);
+#else
+		// Windows decides the node when the memory is allocated, see VirtualAllocExNuma.
+		return false;
+#endif
+	}
+
+	bool NumaTopology::Interleave(void* memory, std::size_t size)
+	{
+#if defined(__linux__)
+		const std::uint32_t node_count = NodeCount();
+		if (node_count == 1)
+		{
+			return false;
+		}
+		unsigned long node_mask[kNodeMaskWords] = {};
+		for (std::uint32_t node = 0; node < node_count; ++node)
+		{
+			node_mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+		}
+		return ApplyMemoryPolicy(memory, size, kMpolInterleave, node_mask);
+#else
+		return false;
+#endif
+	}
+}
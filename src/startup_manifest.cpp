@@ -0,0 +1,164 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "startup_manifest.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * First word of every manifest file.
+		 */
+		constexpr char kManifestMagic[] = "fkleafs-startup-manifest";
+	}
+
+	bool StartupManifest::Write(const std::string& path) const
+	{
+		// Readers never see a partially written manifest, the file is replaced once it is complete.
+		const std::string temporary_path = path + ".tmp";
+		{
+			std::ofstream file(temporary_path, std::ios::out | std::ios::trunc);
+			if (!file)
+			{
+				LOG(ERROR) << "Failed to open the startup manifest: " << temporary_path << " for writing";
+				return false;
+			}
+
+			file << kManifestMagic << ' ' << kVersion << '\n';
+			file << "fingerprint " << registry_fingerprint << '\n';
+			file << "modules " << modules.size() << '\n';
+			for (const StartupManifestModule& module : modules)
+			{
+				file << module.module_hash << ' ' << module.level << ' ' << absl::ToInt64Nanoseconds(module.startup_cost) << ' ' << module.dependencies.size();
+				for (const std::size_t dependency : module.dependencies)
+				{
+					file << ' ' << dependency;
+				}
+				// The name goes last, it may contain spaces.
+				file << ' ' << module.module_name << '\n';
+			}
+
+			file.flush();
+			if (!file)
+			{
+				LOG(ERROR) << "Failed to write the startup manifest: " << temporary_path;
+				return false;
+			}
+		}
+
+		if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+		{
+			// Windows does not replace existing files on rename.
+			std::remove(path.c_str());
+			if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+			{
+				LOG(ERROR) << "Failed to replace the startup manifest: " << path;
+				std::remove(temporary_path.c_str());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool StartupManifest::Read(const std::string& path, StartupManifest& manifest)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::string magic;
+		std::uint32_t version = 0;
+		std::string fingerprint_key;
+		std::string modules_key;
+		std::size_t module_count = 0;
+		file >> magic >> version >> fingerprint_key >> manifest.registry_fingerprint >> modules_key >> module_count;
+		if (!file || magic != kManifestMagic || fingerprint_key != "fingerprint" || modules_key != "modules")
+		{
+			LOG(WARNING) << "The startup manifest: " << path << " is malformed";
+			return false;
+		}
+		if (version != kVersion)
+		{
+			LOG(WARNING) << "The startup manifest: " << path << " has version " << version << ", expected version " << kVersion;
+			return false;
+		}
+
+		std::string line;
+		std::getline(file, line);
+		manifest.modules.clear();
+		manifest.modules.reserve(module_count);
+		for (std::size_t index = 0; index < module_count; ++index)
+		{
+			if (!std::getline(file, line))
+			{
+				LOG(WARNING) << "The startup manifest: " << path << " is truncated";
+				return false;
+			}
+
+			std::istringstream stream(line);
+			StartupManifestModule module;
+			std::int64_t startup_cost = 0;
+			std::size_t dependency_count = 0;
+			stream >> module.module_hash >> module.level >> startup_cost >> dependency_count;
+			module.startup_cost = absl::Nanoseconds(startup_cost);
+			module.dependencies.resize(dependency_count);
+			for (std::size_t& dependency : module.dependencies)
+			{
+				stream >> dependency;
+			}
+
+			// Dependencies must point backwards, otherwise the order would not be topological.
+			const bool ordered = std::all_of(module.dependencies.begin(), module.dependencies.end(), [index](std::size_t dependency)
+				{
+					return dependency < index;
+				});
+			stream.get();
+			std::getline(stream, module.module_name);
+			if (!stream || !ordered || module.module_name.empty())
+			{
+				LOG(WARNING) << "The startup manifest: " << path << " has a malformed entry on position " << index;
+				return false;
+			}
+			manifest.modules.push_back(std::move(module));
+		}
+		return true;
+	}
+
+	std::vector<absl::Duration> StartupManifest::CriticalPathCosts() const
+	{
+		// Dependents always come after their dependencies, walking backwards visits every dependent first.
+		std::vector<absl::Duration> downstream_costs(modules.size(), absl::ZeroDuration());
+		std::vector<absl::Duration> critical_path_costs(modules.size(), absl::ZeroDuration());
+		for (std::size_t index = modules.size(); index-- > 0;)
+		{
+			critical_path_costs[index] = modules[index].startup_cost + downstream_costs[index];
+			for (const std::size_t dependency : modules[index].dependencies)
+			{
+				downstream_costs[dependency] = std::max(downstream_costs[dependency], critical_path_costs[index]);
+			}
+		}
+		return critical_path_costs;
+	}
+}
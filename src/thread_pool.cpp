@@ -0,0 +1,194 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+namespace fkleafs
+{
+	namespace
+	{
+		/**
+		 * The pool and queue index of the calling worker thread.
+		 */
+		thread_local const ThreadPool* t_worker_pool = nullptr;
+		thread_local std::size_t t_worker_index = 0;
+
+		/**
+		 * Lowers the scheduling priority of the calling thread, failures are ignored.
+		 */
+		void LowerThreadPriority()
+		{
+#if defined(_WIN32)
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+			// Linux applies the nice value to the thread id only, not to the whole process.
+			setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#elif defined(__APPLE__)
+			pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#endif
+		}
+	}
+
+	ThreadPool::ThreadPool(std::size_t thread_count, ThreadPriority priority)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		m_queues.reserve(thread_count);
+		for (std::size_t index = 0; index < thread_count; ++index)
+		{
+			m_queues.push_back(std::make_unique<WorkerQueue>());
+		}
+
+		m_threads.reserve(thread_count);
+		for (std::size_t index = 0; index < thread_count; ++index)
+		{
+			m_threads.emplace_back([this, index, priority]() { WorkerLoop(index, priority); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		m_idle_mutex.Lock();
+		m_stopping = true;
+		m_idle_condition.SignalAll();
+		m_idle_mutex.Unlock();
+
+		for (std::thread& thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	void ThreadPool::Schedule(std::function<void()> task)
+	{
+		const std::size_t index = IsWorkerThread()
+			? t_worker_index
+			: m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+		// Counted before the push, so that the counter never underflows when the task is taken right away.
+		m_pending_tasks.fetch_add(1, std::memory_order_acq_rel);
+
+		WorkerQueue& queue = *m_queues[index];
+		queue.mutex.Lock();
+		queue.tasks.push_back(std::move(task));
+		queue.mutex.Unlock();
+
+		m_idle_mutex.Lock();
+		m_idle_condition.Signal();
+		m_idle_mutex.Unlock();
+	}
+
+	bool ThreadPool::TryRunPendingTask()
+	{
+		std::function<void()> task;
+		if (!PopTask(IsWorkerThread() ? t_worker_index : 0, task))
+		{
+			return false;
+		}
+		task();
+		return true;
+	}
+
+	bool ThreadPool::IsWorkerThread() const
+	{
+		return t_worker_pool == this;
+	}
+
+	void ThreadPool::WorkerLoop(std::size_t index, ThreadPriority priority)
+	{
+		t_worker_pool = this;
+		t_worker_index = index;
+		if (priority == ThreadPriority::kLow)
+		{
+			LowerThreadPriority();
+		}
+
+		std::function<void()> task;
+		while (true)
+		{
+			if (PopTask(index, task))
+			{
+				task();
+				task = nullptr;
+				continue;
+			}
+
+			m_idle_mutex.Lock();
+			while (m_pending_tasks.load(std::memory_order_acquire) == 0 && !m_stopping)
+			{
+				m_idle_condition.Wait(&m_idle_mutex);
+			}
+			const bool stop = m_stopping && m_pending_tasks.load(std::memory_order_acquire) == 0;
+			m_idle_mutex.Unlock();
+
+			if (stop)
+			{
+				return;
+			}
+		}
+	}
+
+	bool ThreadPool::PopTask(std::size_t index, std::function<void()>& task)
+	{
+		if (m_pending_tasks.load(std::memory_order_acquire) == 0)
+		{
+			return false;
+		}
+
+		// The own queue is used as a stack for locality.
+		WorkerQueue& own_queue = *m_queues[index];
+		own_queue.mutex.Lock();
+		if (!own_queue.tasks.empty())
+		{
+			task = std::move(own_queue.tasks.back());
+			own_queue.tasks.pop_back();
+			own_queue.mutex.Unlock();
+			m_pending_tasks.fetch_sub(1, std::memory_order_acq_rel);
+			return true;
+		}
+		own_queue.mutex.Unlock();
+
+		// Steal the oldest task of another queue.
+		for (std::size_t offset = 1; offset < m_queues.size(); ++offset)
+		{
+			WorkerQueue& victim_queue = *m_queues[(index + offset) % m_queues.size()];
+			victim_queue.mutex.Lock();
+			if (!victim_queue.tasks.empty())
+			{
+				task = std::move(victim_queue.tasks.front());
+				victim_queue.tasks.pop_front();
+				victim_queue.mutex.Unlock();
+				m_pending_tasks.fetch_sub(1, std::memory_order_acq_rel);
+				return true;
+			}
+			victim_queue.mutex.Unlock();
+		}
+		return false;
+	}
+}
@@ -0,0 +1,638 @@
+// Copyright 2023 Felix Kahle.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs randomized mixes of loads, unloads, reloads and lookups on many threads against one ModuleManager,
+// then races teardowns against unloads, checks the lifecycle invariants of every module instance
+// and prints a latency histogram per operation.
+// Build it with FKLEAFS_SANITIZER=address or FKLEAFS_SANITIZER=thread to catch the races the invariants cannot see.
+//
+// Usage: LeafsStress [--threads=N] [--seconds=S] [--seed=X]
+// Exits with a non zero status if an invariant has been violated.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/globals.h"
+
+#include "leafs.h"
+
+namespace
+{
+	/**
+	 * Number of distinct module types, few enough that threads collide on the same modules all the time.
+	 */
+	constexpr std::size_t kModuleCount = 16;
+
+	/**
+	 * Every fourth module starts a dependency chain, the others depend on their predecessor.
+	 */
+	constexpr std::size_t kChainLength = 4;
+
+	/**
+	 * Markers of live and destroyed module instances, a lookup that returns a destroyed instance sees kDeadMagic.
+	 */
+	constexpr std::uint64_t kLiveMagic = 0x4c454146534c4956;
+	constexpr std::uint64_t kDeadMagic = 0x4c45414653444541;
+
+	/**
+	 * Counts invariant violations and prints the first ones.
+	 */
+	class Violations
+	{
+	public:
+		static constexpr std::uint64_t kMaxReported = 32;
+
+		void Report(const char* what, std::size_t module_index)
+		{
+			if (m_count.fetch_add(1, std::memory_order_relaxed) < kMaxReported)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				std::fprintf(stderr, "Invariant violated: %s (module %zu)\n", what, module_index);
+			}
+		}
+
+		std::uint64_t Count() const
+		{
+			return m_count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<std::uint64_t> m_count{ 0 };
+		std::mutex m_mutex;
+	};
+
+	Violations g_violations;
+
+	/**
+	 * Lifecycle counters of one module type.
+	 */
+	struct ModuleCounters
+	{
+		std::atomic<std::int64_t> constructed{ 0 };
+		std::atomic<std::int64_t> destroyed{ 0 };
+		std::atomic<std::int64_t> started{ 0 };
+		std::atomic<std::int64_t> shut_down{ 0 };
+
+		/**
+		 * Instances that have been started and not shut down yet.
+		 * A reload briefly runs the new instance next to the previous one, so at most two are allowed.
+		 */
+		std::atomic<std::int64_t> running{ 0 };
+	};
+
+	std::array<ModuleCounters, kModuleCount> g_counters;
+
+	enum class InstanceState : int
+	{
+		kConstructed,
+		kStarted,
+		kShutDown
+	};
+
+	/**
+	 * Module whose instances check their own lifecycle.
+	 */
+	template<std::size_t Index>
+	class StressModule : FKL_MODULE_INTERFACE
+	{
+	public:
+		using FKLModuleDependencies = std::conditional_t<Index % kChainLength != 0,
+			fkleafs::ModuleDependencyList<StressModule<Index == 0 ? 0 : Index - 1>>, fkleafs::ModuleDependencyList<>>;
+
+		StressModule()
+		{
+			g_counters[Index].constructed.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~StressModule() override
+		{
+			if (m_state.load(std::memory_order_acquire) == InstanceState::kStarted)
+			{
+				g_violations.Report("destroyed without being shut down", Index);
+			}
+			m_magic.store(kDeadMagic, std::memory_order_release);
+			g_counters[Index].destroyed.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void OnStartupModule() override
+		{
+			InstanceState expected = InstanceState::kConstructed;
+			if (!m_state.compare_exchange_strong(expected, InstanceState::kStarted, std::memory_order_acq_rel))
+			{
+				g_violations.Report("started twice", Index);
+			}
+			g_counters[Index].started.fetch_add(1, std::memory_order_relaxed);
+			if (g_counters[Index].running.fetch_add(1, std::memory_order_acq_rel) >= 2)
+			{
+				g_violations.Report("more than two instances running at once", Index);
+			}
+
+			// Widens the window in which other threads race with the startup.
+			std::this_thread::yield();
+		}
+
+		void OnReloadModule(fkleafs::ModuleInterface& previous_module) override
+		{
+			StressModule& previous = static_cast<StressModule&>(previous_module);
+			if (!previous.IsAlive() || previous.m_state.load(std::memory_order_acquire) != InstanceState::kStarted)
+			{
+				g_violations.Report("reload handed over a module that is not running", Index);
+			}
+		}
+
+		void OnShutdownModule() override
+		{
+			InstanceState expected = InstanceState::kStarted;
+			if (!m_state.compare_exchange_strong(expected, InstanceState::kShutDown, std::memory_order_acq_rel))
+			{
+				g_violations.Report("shut down without running", Index);
+			}
+			g_counters[Index].shut_down.fetch_add(1, std::memory_order_relaxed);
+			g_counters[Index].running.fetch_sub(1, std::memory_order_acq_rel);
+		}
+
+		bool IsAlive() const
+		{
+			return m_magic.load(std::memory_order_acquire) == kLiveMagic;
+		}
+
+		/**
+		 * Checks an instance that has been returned by a lookup.
+		 * Published instances have been started, they may already be shutting down while the caller holds them.
+		 */
+		void CheckPublished() const
+		{
+			if (!IsAlive())
+			{
+				g_violations.Report("lookup returned a destroyed module", Index);
+			}
+			else if (m_state.load(std::memory_order_acquire) == InstanceState::kConstructed)
+			{
+				g_violations.Report("lookup returned a module that has not been started", Index);
+			}
+		}
+
+	private:
+		std::atomic<std::uint64_t> m_magic{ kLiveMagic };
+		std::atomic<InstanceState> m_state{ InstanceState::kConstructed };
+	};
+
+	/**
+	 * Log linear latency histogram in the style of HdrHistogram.
+	 * Every power of two range is split into kSubBuckets linear buckets, so recorded values keep about 3% precision.
+	 */
+	class LatencyHistogram
+	{
+	public:
+		static constexpr std::uint32_t kSubBucketBits = 5;
+		static constexpr std::uint64_t kSubBuckets = 1ull << kSubBucketBits;
+		static constexpr std::size_t kBucketCount = kSubBuckets * (64 - kSubBucketBits + 1);
+
+		void Record(std::uint64_t nanoseconds)
+		{
+			++m_buckets[BucketIndex(nanoseconds)];
+			++m_count;
+			m_sum += nanoseconds;
+			m_max = std::max(m_max, nanoseconds);
+		}
+
+		void Merge(const LatencyHistogram& other)
+		{
+			for (std::size_t index = 0; index < kBucketCount; ++index)
+			{
+				m_buckets[index] += other.m_buckets[index];
+			}
+			m_count += other.m_count;
+			m_sum += other.m_sum;
+			m_max = std::max(m_max, other.m_max);
+		}
+
+		std::uint64_t Count() const
+		{
+			return m_count;
+		}
+
+		double Mean() const
+		{
+			return m_count == 0 ? 0.0 : static_cast<double>(m_sum) / static_cast<double>(m_count);
+		}
+
+		std::uint64_t Max() const
+		{
+			return m_max;
+		}
+
+		/**
+		 * Returns the value below which the given fraction of the recorded values lies.
+		 *
+		 * @param fraction The fraction, between 0 and 1.
+		 * @return The upper bound of the bucket that contains the percentile.
+		 */
+		std::uint64_t Percentile(double fraction) const
+		{
+			if (m_count == 0)
+			{
+				return 0;
+			}
+
+			const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(fraction * static_cast<double>(m_count) + 0.5));
+			std::uint64_t seen = 0;
+			for (std::size_t index = 0; index < kBucketCount; ++index)
+			{
+				seen += m_buckets[index];
+				if (seen >= rank)
+				{
+					return std::min(BucketUpperBound(index), m_max);
+				}
+			}
+			return m_max;
+		}
+
+	private:
+		static std::size_t BucketIndex(std::uint64_t value)
+		{
+			if (value < kSubBuckets)
+			{
+				return static_cast<std::size_t>(value);
+			}
+			std::uint32_t exponent = 63;
+			while ((value >> exponent) == 0)
+			{
+				--exponent;
+			}
+			const std::uint32_t shift = exponent - kSubBucketBits;
+			return static_cast<std::size_t>(kSubBuckets * (shift + 1) + ((value >> shift) - kSubBuckets));
+		}
+
+		static std::uint64_t BucketUpperBound(std::size_t index)
+		{
+			if (index < kSubBuckets)
+			{
+				return index;
+			}
+			const std::uint64_t shift = index / kSubBuckets - 1;
+			const std::uint64_t sub_bucket = index % kSubBuckets + kSubBuckets;
+			return ((sub_bucket + 1) << shift) - 1;
+		}
+
+		std::vector<std::uint64_t> m_buckets = std::vector<std::uint64_t>(kBucketCount, 0);
+		std::uint64_t m_count = 0;
+		std::uint64_t m_sum = 0;
+		std::uint64_t m_max = 0;
+	};
+
+	enum class Operation : std::size_t
+	{
+		kGetModulePtr,
+		kPinModule,
+		kHandlePin,
+		kCheckThenLoad,
+		kLoadModule,
+		kUnloadModule,
+		kReloadModule,
+		kCount
+	};
+
+	constexpr std::size_t kOperationCount = static_cast<std::size_t>(Operation::kCount);
+
+	constexpr std::array<const char*, kOperationCount> kOperationNames = {
+		"GetModulePtr", "PinModule", "ModuleHandle::Pin", "IsModuleLoaded+LoadModule", "LoadModule", "UnloadModule", "ReloadModule" };
+
+	/**
+	 * Relative frequency of the operations, lookups dominate like they do in applications.
+	 */
+	constexpr std::array<std::uint32_t, kOperationCount> kOperationWeights = { 40, 15, 15, 10, 6, 8, 6 };
+
+	/**
+	 * Typed entry points of one module type, so the worker can pick modules at runtime.
+	 */
+	struct ModuleOperations
+	{
+		fkleafs::ModuleInfo info;
+		bool (*Register)(fkleafs::ModuleManager& manager);
+		void (*Lookup)(fkleafs::ModuleManager& manager);
+		void (*Pin)(fkleafs::ModuleManager& manager);
+		void (*HandlePin)(fkleafs::ModuleManager& manager);
+	};
+
+	template<std::size_t Index>
+	ModuleOperations MakeModuleOperations()
+	{
+		using Module = StressModule<Index>;
+		return ModuleOperations{
+			fkleafs::ModuleInfo::GetModuleInfo<Module>(),
+			[](fkleafs::ModuleManager& manager)
+			{
+				return manager.RegisterModule<Module>();
+			},
+			[](fkleafs::ModuleManager& manager)
+			{
+				// A lookup loads the module on a miss, it may still come back empty if another thread unloads it right away.
+				const std::shared_ptr<Module> module = manager.GetModulePtr<Module>().lock();
+				if (module != nullptr)
+				{
+					module->CheckPublished();
+				}
+			},
+			[](fkleafs::ModuleManager& manager)
+			{
+				const fkleafs::PinnedModule<Module> module = manager.PinModule<Module>();
+				if (module)
+				{
+					module->CheckPublished();
+				}
+			},
+			[](fkleafs::ModuleManager& manager)
+			{
+				const fkleafs::PinnedModule<Module> module = manager.GetModuleHandle<Module>().Pin();
+				if (module)
+				{
+					module->CheckPublished();
+				}
+			} };
+	}
+
+	template<std::size_t... Indices>
+	std::array<ModuleOperations, sizeof...(Indices)> MakeAllModuleOperations(std::index_sequence<Indices...>)
+	{
+		return { { MakeModuleOperations<Indices>()... } };
+	}
+
+	const std::array<ModuleOperations, kModuleCount> kModules = MakeAllModuleOperations(std::make_index_sequence<kModuleCount>());
+
+	struct StressOptions
+	{
+		std::size_t threads = std::max(4u, std::thread::hardware_concurrency());
+		double seconds = 10.0;
+		std::uint64_t seed = 1;
+	};
+
+	bool ParseOptions(int argc, char** argv, StressOptions& options)
+	{
+		for (int index = 1; index < argc; ++index)
+		{
+			const char* argument = argv[index];
+			if (std::strncmp(argument, "--threads=", 10) == 0)
+			{
+				options.threads = std::max<std::size_t>(1, std::strtoull(argument + 10, nullptr, 10));
+			}
+			else if (std::strncmp(argument, "--seconds=", 10) == 0)
+			{
+				options.seconds = std::strtod(argument + 10, nullptr);
+			}
+			else if (std::strncmp(argument, "--seed=", 7) == 0)
+			{
+				options.seed = std::strtoull(argument + 7, nullptr, 10);
+			}
+			else
+			{
+				std::fprintf(stderr, "Unknown argument: %s\nUsage: %s [--threads=N] [--seconds=S] [--seed=X]\n", argument, argv[0]);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Runs random operations until the deadline and records their latencies.
+	 */
+	void RunWorker(fkleafs::ModuleManager& manager, std::uint64_t seed, std::chrono::steady_clock::time_point deadline,
+		std::array<LatencyHistogram, kOperationCount>& histograms)
+	{
+		std::mt19937_64 random(seed);
+		std::discrete_distribution<std::size_t> operation_distribution(kOperationWeights.begin(), kOperationWeights.end());
+		std::uniform_int_distribution<std::size_t> module_distribution(0, kModuleCount - 1);
+
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			// Checking the deadline costs a clock read, run a few operations in between.
+			for (int iteration = 0; iteration < 64; ++iteration)
+			{
+				const std::size_t operation = operation_distribution(random);
+				const ModuleOperations& module = kModules[module_distribution(random)];
+
+				const auto start = std::chrono::steady_clock::now();
+				switch (static_cast<Operation>(operation))
+				{
+				case Operation::kGetModulePtr:
+					module.Lookup(manager);
+					break;
+				case Operation::kPinModule:
+					module.Pin(manager);
+					break;
+				case Operation::kHandlePin:
+					module.HandlePin(manager);
+					break;
+				case Operation::kCheckThenLoad:
+					// The gap between the check and the load is exactly what other threads race into.
+					if (!manager.IsModuleLoaded(module.info))
+					{
+						manager.LoadModule(module.info);
+					}
+					break;
+				case Operation::kLoadModule:
+					manager.LoadModule(module.info);
+					break;
+				case Operation::kUnloadModule:
+					manager.UnloadModule(module.info);
+					break;
+				case Operation::kReloadModule:
+					manager.ReloadModule(module.info);
+					break;
+				case Operation::kCount:
+					break;
+				}
+				const auto end = std::chrono::steady_clock::now();
+				histograms[operation].Record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+			}
+		}
+	}
+
+	/**
+	 * Number of fully loaded managers that are torn down while other threads unload their modules.
+	 */
+	constexpr std::size_t kTearDownRounds = 64;
+
+	/**
+	 * Races TearDown against UnloadModule, every instance must be shut down exactly once by one of them,
+	 * which the instances and CheckBalancedLifecycles verify.
+	 */
+	void RunTearDownRaces(std::size_t thread_count, std::uint64_t seed)
+	{
+		for (std::size_t round = 0; round < kTearDownRounds; ++round)
+		{
+			fkleafs::ModuleManager manager;
+			for (const ModuleOperations& module : kModules)
+			{
+				module.Register(manager);
+				manager.LoadModule(module.info);
+			}
+
+			std::atomic<bool> started{ false };
+			std::atomic<bool> torn_down{ false };
+			std::vector<std::thread> threads;
+			threads.reserve(thread_count);
+			for (std::size_t index = 0; index < thread_count; ++index)
+			{
+				threads.emplace_back([&manager, &started, &torn_down, thread_seed = seed * 1000003 + round * thread_count + index]()
+					{
+						std::mt19937_64 random(thread_seed);
+						std::uniform_int_distribution<std::size_t> module_distribution(0, kModuleCount - 1);
+						while (!started.load(std::memory_order_acquire))
+						{
+							std::this_thread::yield();
+						}
+						while (!torn_down.load(std::memory_order_acquire))
+						{
+							manager.UnloadModule(kModules[module_distribution(random)].info);
+						}
+					});
+			}
+
+			started.store(true, std::memory_order_release);
+			manager.TearDown();
+			torn_down.store(true, std::memory_order_release);
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+
+			for (std::size_t index = 0; index < kModuleCount; ++index)
+			{
+				if (manager.IsModuleLoaded(kModules[index].info))
+				{
+					g_violations.Report("module still loaded after a teardown that raced with unloads", index);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Checks that every instance that has been created has also been started, shut down and destroyed.
+	 * Only valid once the manager has been torn down.
+	 */
+	void CheckBalancedLifecycles()
+	{
+		for (std::size_t index = 0; index < kModuleCount; ++index)
+		{
+			const ModuleCounters& counters = g_counters[index];
+			if (counters.constructed.load() != counters.destroyed.load())
+			{
+				g_violations.Report("instances leaked or destroyed twice", index);
+			}
+			if (counters.started.load() != counters.shut_down.load())
+			{
+				g_violations.Report("started instances not shut down", index);
+			}
+			if (counters.running.load() != 0)
+			{
+				g_violations.Report("instances still running after the teardown", index);
+			}
+		}
+	}
+
+	void PrintHistograms(const std::array<LatencyHistogram, kOperationCount>& histograms, double seconds)
+	{
+		std::printf("%-26s %12s %10s %10s %10s %10s %10s %10s %12s\n", "operation (ns)", "count", "mean", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+		for (std::size_t operation = 0; operation < kOperationCount; ++operation)
+		{
+			const LatencyHistogram& histogram = histograms[operation];
+			std::printf("%-26s %12llu %10.0f %10llu %10llu %10llu %10llu %10llu %12llu\n", kOperationNames[operation],
+				static_cast<unsigned long long>(histogram.Count()), histogram.Mean(),
+				static_cast<unsigned long long>(histogram.Percentile(0.50)), static_cast<unsigned long long>(histogram.Percentile(0.90)),
+				static_cast<unsigned long long>(histogram.Percentile(0.99)), static_cast<unsigned long long>(histogram.Percentile(0.999)),
+				static_cast<unsigned long long>(histogram.Percentile(0.9999)), static_cast<unsigned long long>(histogram.Max()));
+		}
+
+		std::uint64_t total = 0;
+		for (const LatencyHistogram& histogram : histograms)
+		{
+			total += histogram.Count();
+		}
+		std::printf("%llu operations, %.0f operations per second\n", static_cast<unsigned long long>(total), static_cast<double>(total) / seconds);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	StressOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		return 2;
+	}
+
+	// Failed loads and unloads are expected while threads race, only invariant violations are reported.
+	absl::SetMinLogLevel(absl::LogSeverityAtLeast::kFatal);
+
+	std::printf("Stressing %zu modules on %zu threads for %.1f seconds, seed %llu\n", kModuleCount, options.threads, options.seconds,
+		static_cast<unsigned long long>(options.seed));
+
+	std::vector<std::array<LatencyHistogram, kOperationCount>> thread_histograms(options.threads);
+	{
+		fkleafs::ModuleManager manager;
+		for (const ModuleOperations& module : kModules)
+		{
+			module.Register(manager);
+		}
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options.seconds));
+		std::vector<std::thread> threads;
+		threads.reserve(options.threads);
+		for (std::size_t index = 0; index < options.threads; ++index)
+		{
+			threads.emplace_back(RunWorker, std::ref(manager), options.seed * 1000003 + index, deadline, std::ref(thread_histograms[index]));
+		}
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		manager.TearDown();
+	}
+	RunTearDownRaces(options.threads, options.seed);
+	std::printf("Raced %zu teardowns with unloads\n", kTearDownRounds);
+	CheckBalancedLifecycles();
+
+	std::array<LatencyHistogram, kOperationCount> histograms;
+	for (const std::array<LatencyHistogram, kOperationCount>& thread_histogram : thread_histograms)
+	{
+		for (std::size_t operation = 0; operation < kOperationCount; ++operation)
+		{
+			histograms[operation].Merge(thread_histogram[operation]);
+		}
+	}
+	PrintHistograms(histograms, options.seconds);
+
+	if (g_violations.Count() != 0)
+	{
+		std::fprintf(stderr, "%llu invariant violations\n", static_cast<unsigned long long>(g_violations.Count()));
+		return 1;
+	}
+	std::printf("No invariant violations\n");
+	return 0;
+}